@@ -207,13 +207,14 @@ static void __loop_update_dio(struct loop_device *lo, bool dio)
 	if (lo->lo_state == Lo_bound)
 		blk_mq_freeze_queue(lo->lo_queue);
 	lo->use_dio = use_dio;
-	if (use_dio) {
+	if (use_dio || lo->batch_io)
 		blk_queue_flag_clear(QUEUE_FLAG_NOMERGES, lo->lo_queue);
-		lo->lo_flags |= LO_FLAGS_DIRECT_IO;
-	} else {
+	else
 		blk_queue_flag_set(QUEUE_FLAG_NOMERGES, lo->lo_queue);
+	if (use_dio)
+		lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+	else
 		lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
-	}
 	if (lo->lo_state == Lo_bound)
 		blk_mq_unfreeze_queue(lo->lo_queue);
 }
@@ -335,11 +336,43 @@ static int lo_req_flush(struct loop_device *lo, struct request *rq)
 	return ret;
 }
 
+/* zero the part of @rq past the first @done bytes */
+static void lo_zero_fill_rq(struct request *rq, unsigned int done)
+{
+	struct req_iterator iter;
+	struct bio_vec bvec;
+
+	rq_for_each_segment(bvec, rq, iter) {
+		if (done >= bvec.bv_len) {
+			done -= bvec.bv_len;
+			continue;
+		}
+		zero_user(bvec.bv_page, bvec.bv_offset + done,
+			  bvec.bv_len - done);
+		done = 0;
+	}
+}
+
 static void lo_complete_rq(struct request *rq)
 {
 	struct loop_cmd *cmd = blk_mq_rq_to_pdu(rq);
 	blk_status_t ret = BLK_STS_OK;
 
+	/*
+	 * Buffered batch_io requests keep the semantics of lo_write_simple()
+	 * and lo_read_simple(): a short write fails, and a short read is
+	 * zero-filled past the end of the backing file.
+	 */
+	if (cmd->use_aio && !(cmd->iocb.ki_flags & IOCB_DIRECT) &&
+	    cmd->ret >= 0 && cmd->ret != blk_rq_bytes(rq)) {
+		if (req_op(rq) == REQ_OP_WRITE) {
+			cmd->ret = -EIO;
+		} else if (req_op(rq) == REQ_OP_READ) {
+			lo_zero_fill_rq(rq, cmd->ret);
+			cmd->ret = blk_rq_bytes(rq);
+		}
+	}
+
 	if (!cmd->use_aio || cmd->ret < 0 || cmd->ret == blk_rq_bytes(rq) ||
 	    req_op(rq) != REQ_OP_READ) {
 		if (cmd->ret < 0)
@@ -385,6 +418,16 @@ static void lo_rw_aio_do_completion(struct loop_cmd *cmd)
 static void lo_rw_aio_complete(struct kiocb *iocb, long ret)
 {
 	struct loop_cmd *cmd = container_of(iocb, struct loop_cmd, iocb);
+	struct request *rq = blk_mq_rq_from_pdu(cmd);
+
+	/* Buffered reads copied into the pages from the kernel mapping */
+	if (!(iocb->ki_flags & IOCB_DIRECT) && req_op(rq) == REQ_OP_READ) {
+		struct req_iterator iter;
+		struct bio_vec bvec;
+
+		rq_for_each_segment(bvec, rq, iter)
+			flush_dcache_page(bvec.bv_page);
+	}
 
 	cmd->ret = ret;
 	lo_rw_aio_do_completion(cmd);
@@ -444,13 +487,21 @@ static int lo_rw_aio(struct loop_device *lo, struct loop_cmd *cmd,
 	cmd->iocb.ki_pos = pos;
 	cmd->iocb.ki_filp = file;
 	cmd->iocb.ki_complete = lo_rw_aio_complete;
-	cmd->iocb.ki_flags = IOCB_DIRECT;
+	if (lo->use_dio)
+		cmd->iocb.ki_flags = IOCB_DIRECT;
+	else
+		cmd->iocb.ki_flags = iocb_flags(file) & ~IOCB_DIRECT;
 	cmd->iocb.ki_ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0);
 
-	if (rw == WRITE)
+	if (rw == WRITE) {
+		if (!lo->use_dio)
+			file_start_write(file);
 		ret = call_write_iter(file, &cmd->iocb, &iter);
-	else
+		if (!lo->use_dio)
+			file_end_write(file);
+	} else {
 		ret = call_read_iter(file, &cmd->iocb, &iter);
+	}
 
 	lo_rw_aio_do_completion(cmd);
 
@@ -459,6 +510,50 @@ static int lo_rw_aio(struct loop_device *lo, struct loop_cmd *cmd,
 	return 0;
 }
 
+/*
+ * With batch_io, try to serve a buffered read straight from the page cache
+ * in the submitter's context, without handing it to a worker.  Returns
+ * true if all of @rq was read.
+ */
+static bool lo_read_nowait(struct loop_device *lo, struct request *rq)
+{
+	struct file *file = lo->lo_backing_file;
+	struct bio *bio = rq->bio;
+	struct req_iterator rq_iter;
+	struct bio_vec tmp;
+	struct iov_iter iter;
+	struct kiocb kiocb;
+	unsigned int noio_flags;
+	int nr_bvec = 0;
+	ssize_t ret;
+
+	/* Multi-bio requests would need a bvec array, leave them to lo_rw_aio */
+	if (!(file->f_mode & FMODE_NOWAIT) || rq->bio != rq->biotail)
+		return false;
+
+	rq_for_each_bvec(tmp, rq, rq_iter)
+		nr_bvec++;
+
+	iov_iter_bvec(&iter, READ, __bvec_iter_bvec(bio->bi_io_vec, bio->bi_iter),
+		      nr_bvec, blk_rq_bytes(rq));
+	iter.iov_offset = bio->bi_iter.bi_bvec_done;
+
+	init_sync_kiocb(&kiocb, file);
+	kiocb.ki_pos = ((loff_t) blk_rq_pos(rq) << 9) + lo->lo_offset;
+	kiocb.ki_flags = (kiocb.ki_flags & ~IOCB_DIRECT) | IOCB_NOWAIT;
+
+	noio_flags = memalloc_noio_save();
+	ret = call_read_iter(file, &kiocb, &iter);
+	memalloc_noio_restore(noio_flags);
+
+	if (ret != blk_rq_bytes(rq))
+		return false;
+
+	rq_for_each_segment(tmp, rq, rq_iter)
+		flush_dcache_page(tmp.bv_page);
+	return true;
+}
+
 static int do_req_filebacked(struct loop_device *lo, struct request *rq)
 {
 	struct loop_cmd *cmd = blk_mq_rq_to_pdu(rq);
@@ -472,6 +567,9 @@ static int do_req_filebacked(struct loop_device *lo, struct request *rq)
 	 * this in io submit style function which submits all segments
 	 * of the req at one time. And direct read IO doesn't need to
 	 * run flush_dcache_page().
+	 *
+	 * With batch_io, buffered requests are submitted as a whole by
+	 * lo_rw_aio() as well, and the pages are flushed on completion.
 	 */
 	switch (req_op(rq)) {
 	case REQ_OP_FLUSH:
@@ -1787,6 +1885,9 @@ module_param(max_loop, int, 0444);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices");
 module_param(max_part, int, 0444);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per loop device");
+static bool batch_io;
+module_param(batch_io, bool, 0444);
+MODULE_PARM_DESC(batch_io, "Merge and batch requests, serve cached reads inline");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -1802,6 +1903,12 @@ static blk_status_t loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 	if (lo->lo_state != Lo_bound)
 		return BLK_STS_IOERR;
 
+	if (lo->batch_io && !lo->use_dio && req_op(rq) == REQ_OP_READ &&
+	    lo_read_nowait(lo, rq)) {
+		blk_mq_end_request(rq, BLK_STS_OK);
+		return BLK_STS_OK;
+	}
+
 	switch (req_op(rq)) {
 	case REQ_OP_FLUSH:
 	case REQ_OP_DISCARD:
@@ -1809,7 +1916,7 @@ static blk_status_t loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 		cmd->use_aio = false;
 		break;
 	default:
-		cmd->use_aio = lo->use_dio;
+		cmd->use_aio = lo->use_dio || lo->batch_io;
 		break;
 	}
 
@@ -1881,17 +1988,32 @@ static void loop_process_work(struct loop_worker *worker,
 {
 	int orig_flags = current->flags;
 	struct loop_cmd *cmd;
+	struct blk_plug plug;
+	LIST_HEAD(batch);
 
 	current->flags |= PF_LOCAL_THROTTLE | PF_MEMALLOC_NOIO;
+	/*
+	 * With batch_io, take everything queued so far in one go and plug
+	 * so that the I/O issued to the backing file reaches its device
+	 * together.
+	 */
+	if (lo->batch_io)
+		blk_start_plug(&plug);
 	spin_lock_irq(&lo->lo_work_lock);
 	while (!list_empty(cmd_list)) {
-		cmd = container_of(
-			cmd_list->next, struct loop_cmd, list_entry);
-		list_del(cmd_list->next);
+		if (lo->batch_io)
+			list_splice_init(cmd_list, &batch);
+		else
+			list_move(cmd_list->next, &batch);
 		spin_unlock_irq(&lo->lo_work_lock);
 
-		loop_handle_cmd(cmd);
-		cond_resched();
+		while (!list_empty(&batch)) {
+			cmd = list_first_entry(&batch, struct loop_cmd,
+					       list_entry);
+			list_del(&cmd->list_entry);
+			loop_handle_cmd(cmd);
+			cond_resched();
+		}
 
 		spin_lock_irq(&lo->lo_work_lock);
 	}
@@ -1907,6 +2029,8 @@ static void loop_process_work(struct loop_worker *worker,
 		loop_set_timer(lo);
 	}
 	spin_unlock_irq(&lo->lo_work_lock);
+	if (lo->batch_io)
+		blk_finish_plug(&plug);
 	current->flags = orig_flags;
 }
 
@@ -1986,6 +2110,10 @@ static int loop_add(int i)
 	lo->tag_set.cmd_size = sizeof(struct loop_cmd);
 	lo->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_STACKING |
 		BLK_MQ_F_NO_SCHED_BY_DEFAULT;
+	/* ->queue_rq() may read from the page cache, see lo_read_nowait() */
+	lo->batch_io = batch_io;
+	if (lo->batch_io)
+		lo->tag_set.flags |= BLK_MQ_F_BLOCKING;
 	lo->tag_set.driver_data = lo;
 
 	err = blk_mq_alloc_tag_set(&lo->tag_set);
@@ -2006,8 +2134,10 @@ static int loop_add(int i)
 	 * merge because the I/O submitted to backing file is handled page by
 	 * page. For directio mode, merge does help to dispatch bigger request
 	 * to underlayer disk. We will enable merge once directio is enabled.
+	 * With batch_io, requests are submitted as a whole, so keep merging.
 	 */
-	blk_queue_flag_set(QUEUE_FLAG_NOMERGES, lo->lo_queue);
+	if (!lo->batch_io)
+		blk_queue_flag_set(QUEUE_FLAG_NOMERGES, lo->lo_queue);
 
 	/*
 	 * Disable partition scanning by default. The in-kernel partition
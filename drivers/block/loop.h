@@ -49,6 +49,7 @@ struct loop_device {
 	struct rb_root          worker_tree;
 	struct timer_list       timer;
 	bool			use_dio;
+	bool			batch_io;
 	bool			sysfs_inited;
 
 	struct request_queue	*lo_queue;
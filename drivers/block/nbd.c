@@ -60,6 +60,7 @@ struct nbd_sock {
 	bool dead;
 	int fallback_index;
 	int cookie;
+	atomic_t inflight;
 };
 
 struct recv_thread_args {
@@ -394,6 +395,18 @@ static u32 req_to_nbd_cmd_type(struct request *req)
 	}
 }
 
+/*
+ * Called once NBD_CMD_INFLIGHT has been cleared, with a reference on the
+ * config held, to drop the command from its socket's queue depth.
+ */
+static void nbd_cmd_sent_done(struct nbd_device *nbd, struct nbd_cmd *cmd)
+{
+	struct nbd_config *config = nbd->config;
+
+	if (config->socks && cmd->index < config->num_connections)
+		atomic_dec(&config->socks[cmd->index]->inflight);
+}
+
 static enum blk_eh_timer_return nbd_xmit_timeout(struct request *req,
 						 bool reserved)
 {
@@ -415,6 +428,7 @@ static enum blk_eh_timer_return nbd_xmit_timeout(struct request *req,
 		goto done;
 	}
 	config = nbd->config;
+	nbd_cmd_sent_done(nbd, cmd);
 
 	if (config->num_connections > 1 ||
 	    (config->num_connections == 1 && nbd->tag_set.timeout)) {
@@ -537,6 +551,54 @@ static int sock_xmit(struct nbd_device *nbd, int index, int send,
 	return result;
 }
 
+/*
+ * Send one bio segment, starting @skip bytes in.  Pages that can be handed
+ * to the network stack are sent with ->sendpage() so TCP references them
+ * instead of copying them into socket buffers; the request is only
+ * completed on the server's reply, by which point the data is on the wire.
+ * Returns a positive value on success and a negative one on failure.
+ */
+static int sock_send_bvec(struct nbd_device *nbd, int index,
+			  struct bio_vec *bvec, unsigned int skip,
+			  int msg_flags, int *sent)
+{
+	struct socket *sock = nbd->config->socks[index]->sock;
+	unsigned int offset = bvec->bv_offset + skip;
+	size_t len = bvec->bv_len - skip;
+	unsigned int noreclaim_flag;
+	int result;
+
+	if (unlikely(!sock) || !sock->ops->sendpage ||
+	    !sendpage_ok(bvec->bv_page)) {
+		struct iov_iter from;
+
+		iov_iter_bvec(&from, WRITE, bvec, 1, bvec->bv_len);
+		iov_iter_advance(&from, skip);
+		return sock_xmit(nbd, index, 1, &from, msg_flags, sent);
+	}
+
+	if (msg_flags & MSG_MORE)
+		msg_flags |= MSG_SENDPAGE_NOTLAST;
+
+	noreclaim_flag = memalloc_noreclaim_save();
+	do {
+		sock->sk->sk_allocation = GFP_NOIO | __GFP_MEMALLOC;
+		result = kernel_sendpage(sock, bvec->bv_page, offset, len,
+					 msg_flags | MSG_NOSIGNAL);
+		if (result <= 0) {
+			if (result == 0)
+				result = -EPIPE;
+			break;
+		}
+		*sent += result;
+		offset += result;
+		len -= result;
+	} while (len);
+	memalloc_noreclaim_restore(noreclaim_flag);
+
+	return result;
+}
+
 /*
  * Different settings for sk->sk_sndtimeo can result in different return values
  * if there is a signal pending when we enter sendmsg, because reasons?
@@ -649,16 +711,13 @@ static int nbd_send_cmd(struct nbd_device *nbd, struct nbd_cmd *cmd, int index)
 
 			dev_dbg(nbd_to_dev(nbd), "request %p: sending %d bytes data\n",
 				req, bvec.bv_len);
-			iov_iter_bvec(&from, WRITE, &bvec, 1, bvec.bv_len);
-			if (skip) {
-				if (skip >= iov_iter_count(&from)) {
-					skip -= iov_iter_count(&from);
-					continue;
-				}
-				iov_iter_advance(&from, skip);
-				skip = 0;
+			if (skip >= bvec.bv_len) {
+				skip -= bvec.bv_len;
+				continue;
 			}
-			result = sock_xmit(nbd, index, 1, &from, flags, &sent);
+			result = sock_send_bvec(nbd, index, &bvec, skip, flags,
+						&sent);
+			skip = 0;
 			if (result < 0) {
 				if (was_interrupted(result)) {
 					/* We've already sent the header, we
@@ -752,6 +811,7 @@ static struct nbd_cmd *nbd_handle_reply(struct nbd_device *nbd, int index,
 		ret = -ENOENT;
 		goto out;
 	}
+	nbd_cmd_sent_done(nbd, cmd);
 	if (cmd->index != index) {
 		dev_err(disk_to_dev(nbd->disk), "Unexpected reply %d from different sock %d (expected %d)",
 			tag, index, cmd->index);
@@ -884,6 +944,7 @@ static bool nbd_clear_req(struct request *req, void *data, bool reserved)
 		mutex_unlock(&cmd->lock);
 		return true;
 	}
+	nbd_cmd_sent_done(cmd->nbd, cmd);
 	cmd->status = BLK_STS_IOERR;
 	mutex_unlock(&cmd->lock);
 
@@ -954,6 +1015,46 @@ static int wait_for_reconnect(struct nbd_device *nbd)
 				  config->dead_conn_timeout) > 0;
 }
 
+/*
+ * With several connections, send each request on the live socket with the
+ * fewest commands awaiting a reply rather than on the one tied to the
+ * hardware queue, so a slow connection doesn't hold up a fixed share of
+ * the I/O.  Ties go to the hardware queue's own socket.  The lockless
+ * reads are only a hint; nbd_handle_cmd() rechecks under tx_lock.
+ */
+static int nbd_select_sock(struct nbd_device *nbd, struct nbd_cmd *cmd,
+			   int index)
+{
+	struct request *req = blk_mq_rq_from_pdu(cmd);
+	struct nbd_config *config = nbd->config;
+	int num = config->num_connections;
+	int best = index, i;
+	int best_load = INT_MAX;
+
+	if (num <= 1)
+		return index;
+
+	/* A partially transmitted request must be finished where it started */
+	if (cmd->index >= 0 && cmd->index < num &&
+	    READ_ONCE(config->socks[cmd->index]->pending) == req)
+		return cmd->index;
+
+	for (i = 0; i < num; i++) {
+		int cur = (index + i) % num;
+		struct nbd_sock *nsock = config->socks[cur];
+		int load;
+
+		if (READ_ONCE(nsock->dead) || READ_ONCE(nsock->pending))
+			continue;
+		load = atomic_read(&nsock->inflight);
+		if (load < best_load) {
+			best_load = load;
+			best = cur;
+		}
+	}
+	return best;
+}
+
 static int nbd_handle_cmd(struct nbd_cmd *cmd, int index)
 {
 	struct request *req = blk_mq_rq_from_pdu(cmd);
@@ -976,6 +1077,7 @@ static int nbd_handle_cmd(struct nbd_cmd *cmd, int index)
 		return -EINVAL;
 	}
 	cmd->status = BLK_STS_OK;
+	index = nbd_select_sock(nbd, cmd, index);
 again:
 	nsock = config->socks[index];
 	mutex_lock(&nsock->tx_lock);
@@ -1021,9 +1123,10 @@ static int nbd_handle_cmd(struct nbd_cmd *cmd, int index)
 	 * Access to this flag is protected by cmd->lock, thus it's safe to set
 	 * the flag after nbd_send_cmd() succeed to send request to server.
 	 */
-	if (!ret)
+	if (!ret) {
 		__set_bit(NBD_CMD_INFLIGHT, &cmd->flags);
-	else if (ret == -EAGAIN) {
+		atomic_inc(&nsock->inflight);
+	} else if (ret == -EAGAIN) {
 		dev_err_ratelimited(disk_to_dev(nbd->disk),
 				    "Request send failed, requeueing\n");
 		nbd_mark_nsock_dead(nbd, nsock, 1);
@@ -1144,6 +1247,7 @@ static int nbd_add_socket(struct nbd_device *nbd, unsigned long arg,
 	nsock->pending = NULL;
 	nsock->sent = 0;
 	nsock->cookie = 0;
+	atomic_set(&nsock->inflight, 0);
 	socks[config->num_connections++] = nsock;
 	atomic_inc(&config->live_connections);
 	blk_mq_unfreeze_queue(nbd->disk->queue);
@@ -1710,6 +1814,7 @@ static int nbd_init_request(struct blk_mq_tag_set *set, struct request *rq,
 	struct nbd_cmd *cmd = blk_mq_rq_to_pdu(rq);
 	cmd->nbd = set->driver_data;
 	cmd->flags = 0;
+	cmd->index = -1;
 	mutex_init(&cmd->lock);
 	return 0;
 }
@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Content-hash deduplication of zram objects
+ *
+ * Every compressed object stored while deduplication is enabled is
+ * indexed by a checksum of its compressed data.  A later write that
+ * compresses to the same bytes takes a reference on the existing
+ * object instead of allocating a new one.
+ */
+
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/xxhash.h>
+
+#include "zram_drv.h"
+
+/* One hash bucket per 2^ZRAM_HASH_SHIFT pages of disk */
+#define ZRAM_HASH_SHIFT		10
+#define ZRAM_HASH_SIZE_MIN	(1 << 10)
+
+bool zram_dedup_enabled(struct zram *zram)
+{
+	return zram->use_dedup;
+}
+
+u32 zram_dedup_checksum(const void *mem, unsigned int len)
+{
+	return xxh32(mem, len, 0);
+}
+
+static struct zram_hash *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->hash[checksum % zram->hash_size];
+}
+
+static bool zram_dedup_match(struct zram *zram, struct zram_dedup_entry *entry,
+			     const void *mem, unsigned int len)
+{
+	void *cmem;
+	bool match;
+
+	if (entry->len != len)
+		return false;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	match = !memcmp(mem, cmem, len);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Look up an object holding the @len bytes at @mem and take a reference
+ * on it.  Returns NULL if there is none.
+ */
+struct zram_dedup_entry *zram_dedup_find(struct zram *zram, const void *mem,
+					 unsigned int len, u32 checksum)
+{
+	struct zram_hash *hash = zram_dedup_bucket(zram, checksum);
+	struct zram_dedup_entry *entry;
+	struct rb_node *rb_node, *prev;
+
+	spin_lock(&hash->lock);
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_dedup_entry, rb_node);
+		if (checksum == entry->checksum)
+			break;
+		rb_node = checksum < entry->checksum ?
+			rb_node->rb_left : rb_node->rb_right;
+	}
+
+	if (!rb_node)
+		goto miss;
+
+	/* Entries with equal checksums are adjacent, start at the first */
+	while ((prev = rb_prev(rb_node))) {
+		entry = rb_entry(prev, struct zram_dedup_entry, rb_node);
+		if (entry->checksum != checksum)
+			break;
+		rb_node = prev;
+	}
+
+	for (; rb_node; rb_node = rb_next(rb_node)) {
+		entry = rb_entry(rb_node, struct zram_dedup_entry, rb_node);
+		if (entry->checksum != checksum)
+			break;
+
+		if (zram_dedup_match(zram, entry, mem, len)) {
+			entry->refcount++;
+			spin_unlock(&hash->lock);
+			atomic64_add(len, &zram->stats.dup_data_size);
+			return entry;
+		}
+	}
+miss:
+	spin_unlock(&hash->lock);
+	return NULL;
+}
+
+/*
+ * Index the freshly stored object @handle.  Returns NULL if memory for
+ * the entry could not be had, in which case the object is simply not
+ * shared.
+ */
+struct zram_dedup_entry *zram_dedup_insert(struct zram *zram,
+					   unsigned long handle,
+					   unsigned int len, u32 checksum)
+{
+	struct zram_hash *hash = zram_dedup_bucket(zram, checksum);
+	struct zram_dedup_entry *entry, *cur;
+	struct rb_node **rb_node, *parent = NULL;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO | __GFP_NOWARN);
+	if (!entry)
+		return NULL;
+
+	entry->len = len;
+	entry->checksum = checksum;
+	entry->refcount = 1;
+	entry->handle = handle;
+
+	spin_lock(&hash->lock);
+	rb_node = &hash->rb_root.rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		cur = rb_entry(parent, struct zram_dedup_entry, rb_node);
+		rb_node = checksum < cur->checksum ?
+			&parent->rb_left : &parent->rb_right;
+	}
+	rb_link_node(&entry->rb_node, parent, rb_node);
+	rb_insert_color(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	atomic64_add(sizeof(*entry), &zram->stats.meta_data_size);
+	return entry;
+}
+
+/*
+ * Drop a slot's reference on @entry, freeing the object with the last
+ * one.  Called with the slot lock held.
+ */
+void zram_dedup_put(struct zram *zram, struct zram_dedup_entry *entry)
+{
+	struct zram_hash *hash = zram_dedup_bucket(zram, entry->checksum);
+	struct zram_comp_stats *cs = &zram->stats.comp[ZRAM_PRIMARY_COMP];
+
+	spin_lock(&hash->lock);
+	if (--entry->refcount) {
+		spin_unlock(&hash->lock);
+		atomic64_sub(entry->len, &zram->stats.dup_data_size);
+		return;
+	}
+	rb_erase(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	zs_free(zram->mem_pool, entry->handle);
+	atomic64_sub(entry->len, &zram->stats.compr_data_size);
+	atomic64_dec(&cs->pages);
+	atomic64_sub(entry->len, &cs->compr_size);
+	atomic64_sub(sizeof(*entry), &zram->stats.meta_data_size);
+	kfree(entry);
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	size_t i;
+
+	if (!zram_dedup_enabled(zram))
+		return 0;
+
+	zram->hash_size = max_t(size_t, num_pages >> ZRAM_HASH_SHIFT,
+				ZRAM_HASH_SIZE_MIN);
+	zram->hash = vzalloc(array_size(zram->hash_size,
+					sizeof(struct zram_hash)));
+	if (!zram->hash)
+		return -ENOMEM;
+
+	for (i = 0; i < zram->hash_size; i++) {
+		spin_lock_init(&zram->hash[i].lock);
+		zram->hash[i].rb_root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+}
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Content-hash deduplication of zram objects
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+
+struct zram;
+
+/*
+ * A zsmalloc object shared by every slot holding the same data.  Slots
+ * flagged ZRAM_DEDUP keep a pointer to this in place of the handle.
+ */
+struct zram_dedup_entry {
+	struct rb_node rb_node;
+	u32 len;
+	u32 checksum;
+	unsigned long refcount;	/* protected by the bucket lock */
+	unsigned long handle;
+};
+
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
+#ifdef CONFIG_ZRAM_DEDUP
+bool zram_dedup_enabled(struct zram *zram);
+u32 zram_dedup_checksum(const void *mem, unsigned int len);
+struct zram_dedup_entry *zram_dedup_find(struct zram *zram, const void *mem,
+					 unsigned int len, u32 checksum);
+struct zram_dedup_entry *zram_dedup_insert(struct zram *zram,
+					   unsigned long handle,
+					   unsigned int len, u32 checksum);
+void zram_dedup_put(struct zram *zram, struct zram_dedup_entry *entry);
+
+int zram_dedup_init(struct zram *zram, size_t num_pages);
+void zram_dedup_fini(struct zram *zram);
+#else
+static inline bool zram_dedup_enabled(struct zram *zram) { return false; }
+static inline u32 zram_dedup_checksum(const void *mem, unsigned int len)
+{
+	return 0;
+}
+static inline struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+		const void *mem, unsigned int len, u32 checksum)
+{
+	return NULL;
+}
+static inline struct zram_dedup_entry *zram_dedup_insert(struct zram *zram,
+		unsigned long handle, unsigned int len, u32 checksum)
+{
+	return NULL;
+}
+static inline void zram_dedup_put(struct zram *zram,
+		struct zram_dedup_entry *entry) { }
+
+static inline int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	return 0;
+}
+static inline void zram_dedup_fini(struct zram *zram) { }
+#endif
+
+#endif /* _ZRAM_DEDUP_H_ */
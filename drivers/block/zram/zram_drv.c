@@ -33,6 +33,7 @@
 #include <linux/debugfs.h>
 #include <linux/cpuhotplug.h>
 #include <linux/part_stat.h>
+#include <linux/seq_file.h>
 
 #include "zram_drv.h"
 
@@ -144,6 +145,24 @@ static inline bool zram_allocated(struct zram *zram, u32 index)
 			zram_test_flag(zram, index, ZRAM_WB);
 }
 
+static inline u32 zram_get_prio(struct zram *zram, u32 index)
+{
+	return zram_test_flag(zram, index, ZRAM_RECOMP) ?
+		ZRAM_SECONDARY_COMP : ZRAM_PRIMARY_COMP;
+}
+
+static inline void zram_comp_done(struct zram *zram, u32 prio, u64 start)
+{
+	atomic64_inc(&zram->stats.comp[prio].nr_comp);
+	atomic64_add(ktime_get_ns() - start, &zram->stats.comp[prio].comp_ns);
+}
+
+static inline void zram_decomp_done(struct zram *zram, u32 prio, u64 start)
+{
+	atomic64_inc(&zram->stats.comp[prio].nr_decomp);
+	atomic64_add(ktime_get_ns() - start, &zram->stats.comp[prio].decomp_ns);
+}
+
 #if PAGE_SIZE != 4096
 static inline bool is_partial_io(struct bio_vec *bvec)
 {
@@ -643,18 +662,275 @@ static int read_from_bdev_async(struct zram *zram, struct bio_vec *bvec,
 #define IDLE_WRITEBACK 2
 
 
+/* Pages gathered into one bio to the backing device */
+#define ZRAM_WB_BATCH_PAGES	32
+/* Writeback bios kept in flight */
+#define ZRAM_WB_QUEUE_DEPTH	8
+
+struct zram_wb_ctl {
+	spinlock_t lock;
+	struct list_head done;
+	wait_queue_head_t wait;
+	struct list_head free;
+	unsigned int inflight;
+};
+
+struct zram_wb_req {
+	struct list_head entry;
+	struct zram_wb_ctl *ctl;
+	struct bio *bio;
+	unsigned long blk_idx;	/* first block on the backing device */
+	unsigned int nr_blks;	/* blocks reserved from blk_idx */
+	unsigned int nr;	/* slots gathered */
+	u32 index[ZRAM_WB_BATCH_PAGES];
+	struct page *pages[ZRAM_WB_BATCH_PAGES];
+};
+
+/*
+ * Reserve up to *nr contiguous blocks on the backing device so that a
+ * batch can go out as one bio.  Falls back to a single block when the
+ * device is fragmented.  Returns 0 if the device is full.
+ */
+static unsigned long alloc_blocks_bdev(struct zram *zram, unsigned int *nr)
+{
+	unsigned long blk_idx, i;
+
+	/* skip 0 bit to confuse zram.handle = 0 */
+	blk_idx = 1;
+	while (*nr > 1) {
+		blk_idx = bitmap_find_next_zero_area(zram->bitmap,
+				zram->nr_pages, blk_idx, *nr, 0);
+		if (blk_idx >= zram->nr_pages)
+			break;
+
+		for (i = 0; i < *nr; i++) {
+			if (test_and_set_bit(blk_idx + i, zram->bitmap))
+				break;
+		}
+		if (i == *nr) {
+			atomic64_add(*nr, &zram->stats.bd_count);
+			return blk_idx;
+		}
+
+		/* Raced with another allocation, undo and look further */
+		while (i--)
+			clear_bit(blk_idx + i, zram->bitmap);
+		blk_idx++;
+	}
+
+	*nr = 1;
+	return alloc_block_bdev(zram);
+}
+
+/* Take one page worth of writeback_limit, false if it is exhausted */
+static bool zram_wb_limit_take(struct zram *zram)
+{
+	bool ret = true;
+
+	spin_lock(&zram->wb_limit_lock);
+	if (zram->wb_limit_enable) {
+		if (zram->bd_wb_limit < 1UL << (PAGE_SHIFT - 12))
+			ret = false;
+		else
+			zram->bd_wb_limit -= 1UL << (PAGE_SHIFT - 12);
+	}
+	spin_unlock(&zram->wb_limit_lock);
+	return ret;
+}
+
+static void zram_wb_limit_return(struct zram *zram)
+{
+	spin_lock(&zram->wb_limit_lock);
+	if (zram->wb_limit_enable)
+		zram->bd_wb_limit += 1UL << (PAGE_SHIFT - 12);
+	spin_unlock(&zram->wb_limit_lock);
+}
+
+static void zram_wb_end_io(struct bio *bio)
+{
+	struct zram_wb_req *req = bio->bi_private;
+	struct zram_wb_ctl *ctl = req->ctl;
+	unsigned long flags;
+
+	/*
+	 * ctl lives on the stack of writeback_store(), which takes the lock
+	 * before it can see this request, so wake it up under the lock.
+	 */
+	spin_lock_irqsave(&ctl->lock, flags);
+	list_add_tail(&req->entry, &ctl->done);
+	wake_up(&ctl->wait);
+	spin_unlock_irqrestore(&ctl->lock, flags);
+}
+
+static void zram_wb_submit(struct zram *zram, struct zram_wb_req *req)
+{
+	struct bio *bio;
+	unsigned int i;
+
+	/* Hand back the blocks the batch did not fill */
+	for (i = req->nr; i < req->nr_blks; i++)
+		free_block_bdev(zram, req->blk_idx + i);
+
+	if (!req->nr) {
+		req->nr_blks = 0;
+		list_add(&req->entry, &req->ctl->free);
+		return;
+	}
+
+	bio = bio_alloc(zram->bdev, req->nr, REQ_OP_WRITE, GFP_NOIO);
+	bio->bi_iter.bi_sector = req->blk_idx * (PAGE_SIZE >> 9);
+	for (i = 0; i < req->nr; i++)
+		bio_add_page(bio, req->pages[i], PAGE_SIZE, 0);
+	bio->bi_private = req;
+	bio->bi_end_io = zram_wb_end_io;
+	req->bio = bio;
+	req->ctl->inflight++;
+	submit_bio(bio);
+}
+
+/*
+ * Finish a completed writeback bio: point the slots that are still idle
+ * at the backing device and release everything else.
+ */
+static int zram_wb_complete(struct zram *zram, struct zram_wb_req *req)
+{
+	int err = blk_status_to_errno(req->bio->bi_status);
+	unsigned int i;
+
+	for (i = 0; i < req->nr; i++) {
+		u32 index = req->index[i];
+		unsigned long blk_idx = req->blk_idx + i;
+
+		zram_slot_lock(zram, index);
+		/*
+		 * We released zram_slot_lock so need to check if the slot was
+		 * changed. If there is freeing for the slot, we can catch it
+		 * easily by zram_allocated.
+		 * A subtle case is the slot is freed/reallocated/marked as
+		 * ZRAM_IDLE again. To close the race, idle_store doesn't
+		 * mark ZRAM_IDLE once it found the slot was ZRAM_UNDER_WB.
+		 * Thus, we could close the race by checking ZRAM_IDLE bit.
+		 */
+		if (err || !zram_allocated(zram, index) ||
+			  !zram_test_flag(zram, index, ZRAM_IDLE)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			zram_clear_flag(zram, index, ZRAM_IDLE);
+			zram_slot_unlock(zram, index);
+			/*
+			 * Nothing ended up on the backing device for this
+			 * slot, so refund the limit charged at queue time.
+			 */
+			free_block_bdev(zram, blk_idx);
+			zram_wb_limit_return(zram);
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram_set_element(zram, index, blk_idx);
+		atomic64_inc(&zram->stats.pages_stored);
+		zram_slot_unlock(zram, index);
+		atomic64_inc(&zram->stats.bd_writes);
+	}
+
+	bio_put(req->bio);
+	req->bio = NULL;
+	req->nr = 0;
+	req->nr_blks = 0;
+	req->ctl->inflight--;
+	list_add(&req->entry, &req->ctl->free);
+	return err;
+}
+
+/* Wait for writeback bios to complete and finish them */
+static int zram_wb_reap(struct zram *zram, struct zram_wb_ctl *ctl)
+{
+	struct zram_wb_req *req, *tmp;
+	LIST_HEAD(done);
+	int ret = 0, err;
+
+	wait_event(ctl->wait, !list_empty_careful(&ctl->done));
+
+	spin_lock_irq(&ctl->lock);
+	list_splice_init(&ctl->done, &done);
+	spin_unlock_irq(&ctl->lock);
+
+	list_for_each_entry_safe(req, tmp, &done, entry) {
+		list_del(&req->entry);
+		err = zram_wb_complete(zram, req);
+		/*
+		 * Return last IO error unless every IO were
+		 * not suceeded.
+		 */
+		if (err)
+			ret = err;
+	}
+	return ret;
+}
+
+static void zram_wb_free_reqs(struct zram_wb_ctl *ctl)
+{
+	struct zram_wb_req *req, *tmp;
+	unsigned int i;
+
+	list_for_each_entry_safe(req, tmp, &ctl->free, entry) {
+		for (i = 0; i < ZRAM_WB_BATCH_PAGES; i++) {
+			if (req->pages[i])
+				__free_page(req->pages[i]);
+		}
+		kfree(req);
+	}
+}
+
+/*
+ * Set up enough requests to write back @nr_pages slots.  Running short
+ * of memory only lowers the batch size or queue depth, as long as one
+ * page can be had.
+ */
+static int zram_wb_alloc_reqs(struct zram_wb_ctl *ctl, unsigned long nr_pages)
+{
+	unsigned int batch = min_t(unsigned long, nr_pages, ZRAM_WB_BATCH_PAGES);
+	unsigned int depth = min_t(unsigned long, DIV_ROUND_UP(nr_pages, batch),
+				   ZRAM_WB_QUEUE_DEPTH);
+	struct zram_wb_req *req;
+	unsigned int i;
+
+	while (depth--) {
+		req = kzalloc(sizeof(*req), GFP_KERNEL);
+		if (!req)
+			break;
+
+		for (i = 0; i < batch; i++) {
+			req->pages[i] = alloc_page(GFP_KERNEL);
+			if (!req->pages[i])
+				break;
+		}
+		if (!i) {
+			kfree(req);
+			break;
+		}
+
+		req->ctl = ctl;
+		list_add(&req->entry, &ctl->free);
+		if (i < batch)
+			break;
+	}
+
+	return list_empty(&ctl->free) ? -ENOMEM : 0;
+}
+
 static ssize_t writeback_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
 {
 	struct zram *zram = dev_to_zram(dev);
 	unsigned long nr_pages = zram->disksize >> PAGE_SHIFT;
 	unsigned long index = 0;
-	struct bio bio;
-	struct bio_vec bio_vec;
-	struct page *page;
+	struct zram_wb_ctl ctl;
+	struct zram_wb_req *req = NULL;
 	ssize_t ret = len;
 	int mode, err;
-	unsigned long blk_idx = 0;
+	u64 start;
 
 	if (sysfs_streq(buf, "idle"))
 		mode = IDLE_WRITEBACK;
@@ -683,30 +959,39 @@ static ssize_t writeback_store(struct device *dev,
 		goto release_init_lock;
 	}
 
-	page = alloc_page(GFP_KERNEL);
-	if (!page) {
+	spin_lock_init(&ctl.lock);
+	INIT_LIST_HEAD(&ctl.done);
+	INIT_LIST_HEAD(&ctl.free);
+	init_waitqueue_head(&ctl.wait);
+	ctl.inflight = 0;
+	if (zram_wb_alloc_reqs(&ctl, nr_pages)) {
 		ret = -ENOMEM;
 		goto release_init_lock;
 	}
 
+	start = ktime_get_ns();
 	for (; nr_pages != 0; index++, nr_pages--) {
 		struct bio_vec bvec;
 
-		bvec.bv_page = page;
-		bvec.bv_len = PAGE_SIZE;
-		bvec.bv_offset = 0;
-
-		spin_lock(&zram->wb_limit_lock);
-		if (zram->wb_limit_enable && !zram->bd_wb_limit) {
-			spin_unlock(&zram->wb_limit_lock);
-			ret = -EIO;
-			break;
+		if (!req) {
+			if (list_empty(&ctl.free)) {
+				err = zram_wb_reap(zram, &ctl);
+				if (err)
+					ret = err;
+			}
+			req = list_first_entry(&ctl.free, struct zram_wb_req,
+					       entry);
+			list_del(&req->entry);
 		}
-		spin_unlock(&zram->wb_limit_lock);
 
-		if (!blk_idx) {
-			blk_idx = alloc_block_bdev(zram);
-			if (!blk_idx) {
+		if (!req->nr_blks) {
+			req->nr_blks = min_t(unsigned long, nr_pages,
+					     ZRAM_WB_BATCH_PAGES);
+			while (req->nr_blks && !req->pages[req->nr_blks - 1])
+				req->nr_blks--;
+			req->blk_idx = alloc_blocks_bdev(zram, &req->nr_blks);
+			if (!req->blk_idx) {
+				req->nr_blks = 0;
 				ret = -ENOSPC;
 				break;
 			}
@@ -727,6 +1012,12 @@ static ssize_t writeback_store(struct device *dev,
 		if (mode == HUGE_WRITEBACK &&
 			  !zram_test_flag(zram, index, ZRAM_HUGE))
 			goto next;
+
+		if (!zram_wb_limit_take(zram)) {
+			zram_slot_unlock(zram, index);
+			ret = -EIO;
+			break;
+		}
 		/*
 		 * Clearing ZRAM_UNDER_WB is duty of caller.
 		 * IOW, zram_free_page never clear it.
@@ -735,73 +1026,40 @@ static ssize_t writeback_store(struct device *dev,
 		/* Need for hugepage writeback racing */
 		zram_set_flag(zram, index, ZRAM_IDLE);
 		zram_slot_unlock(zram, index);
+
+		bvec.bv_page = req->pages[req->nr];
+		bvec.bv_len = PAGE_SIZE;
+		bvec.bv_offset = 0;
 		if (zram_bvec_read(zram, &bvec, index, 0, NULL)) {
 			zram_slot_lock(zram, index);
 			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 			zram_clear_flag(zram, index, ZRAM_IDLE);
 			zram_slot_unlock(zram, index);
+			zram_wb_limit_return(zram);
 			continue;
 		}
 
-		bio_init(&bio, zram->bdev, &bio_vec, 1,
-			 REQ_OP_WRITE | REQ_SYNC);
-		bio.bi_iter.bi_sector = blk_idx * (PAGE_SIZE >> 9);
-
-		bio_add_page(&bio, bvec.bv_page, bvec.bv_len,
-				bvec.bv_offset);
-		/*
-		 * XXX: A single page IO would be inefficient for write
-		 * but it would be not bad as starter.
-		 */
-		err = submit_bio_wait(&bio);
-		if (err) {
-			zram_slot_lock(zram, index);
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
-			zram_slot_unlock(zram, index);
-			/*
-			 * Return last IO error unless every IO were
-			 * not suceeded.
-			 */
-			ret = err;
-			continue;
+		req->index[req->nr++] = index;
+		if (req->nr == req->nr_blks) {
+			zram_wb_submit(zram, req);
+			req = NULL;
 		}
-
-		atomic64_inc(&zram->stats.bd_writes);
-		/*
-		 * We released zram_slot_lock so need to check if the slot was
-		 * changed. If there is freeing for the slot, we can catch it
-		 * easily by zram_allocated.
-		 * A subtle case is the slot is freed/reallocated/marked as
-		 * ZRAM_IDLE again. To close the race, idle_store doesn't
-		 * mark ZRAM_IDLE once it found the slot was ZRAM_UNDER_WB.
-		 * Thus, we could close the race by checking ZRAM_IDLE bit.
-		 */
-		zram_slot_lock(zram, index);
-		if (!zram_allocated(zram, index) ||
-			  !zram_test_flag(zram, index, ZRAM_IDLE)) {
-			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-			zram_clear_flag(zram, index, ZRAM_IDLE);
-			goto next;
-		}
-
-		zram_free_page(zram, index);
-		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
-		zram_set_flag(zram, index, ZRAM_WB);
-		zram_set_element(zram, index, blk_idx);
-		blk_idx = 0;
-		atomic64_inc(&zram->stats.pages_stored);
-		spin_lock(&zram->wb_limit_lock);
-		if (zram->wb_limit_enable && zram->bd_wb_limit > 0)
-			zram->bd_wb_limit -=  1UL << (PAGE_SHIFT - 12);
-		spin_unlock(&zram->wb_limit_lock);
+		continue;
 next:
 		zram_slot_unlock(zram, index);
 	}
 
-	if (blk_idx)
-		free_block_bdev(zram, blk_idx);
-	__free_page(page);
+	if (req)
+		zram_wb_submit(zram, req);
+
+	while (ctl.inflight) {
+		err = zram_wb_reap(zram, &ctl);
+		if (err)
+			ret = err;
+	}
+	atomic64_add(ktime_get_ns() - start, &zram->stats.bd_wb_time);
+
+	zram_wb_free_reqs(&ctl);
 release_init_lock:
 	up_read(&zram->init_lock);
 
@@ -927,13 +1185,14 @@ static ssize_t read_block_state(struct file *file, char __user *buf,
 
 		ts = ktime_to_timespec64(zram->table[index].ac_time);
 		copied = snprintf(kbuf + written, count,
-			"%12zd %12lld.%06lu %c%c%c%c\n",
+			"%12zd %12lld.%06lu %c%c%c%c%c\n",
 			index, (s64)ts.tv_sec,
 			ts.tv_nsec / NSEC_PER_USEC,
 			zram_test_flag(zram, index, ZRAM_SAME) ? 's' : '.',
 			zram_test_flag(zram, index, ZRAM_WB) ? 'w' : '.',
 			zram_test_flag(zram, index, ZRAM_HUGE) ? 'h' : '.',
-			zram_test_flag(zram, index, ZRAM_IDLE) ? 'i' : '.');
+			zram_test_flag(zram, index, ZRAM_IDLE) ? 'i' : '.',
+			zram_test_flag(zram, index, ZRAM_RECOMP) ? 'r' : '.');
 
 		if (count <= copied) {
 			zram_slot_unlock(zram, index);
@@ -960,6 +1219,47 @@ static const struct file_operations proc_zram_block_state_op = {
 	.llseek = default_llseek,
 };
 
+static int comp_stat_show(struct seq_file *m, void *v)
+{
+	struct zram *zram = m->private;
+	const char *names[ZRAM_MAX_COMPS] = {
+		zram->compressor, zram->recompressor
+	};
+	int i;
+
+	down_read(&zram->init_lock);
+	seq_puts(m, "algorithm     orig_size   compr_size  ratio  comp_ns decomp_ns\n");
+	for (i = 0; i < ZRAM_MAX_COMPS; i++) {
+		struct zram_comp_stats *cs = &zram->stats.comp[i];
+		u64 orig = (u64)atomic64_read(&cs->pages) << PAGE_SHIFT;
+		u64 compr = atomic64_read(&cs->compr_size);
+		u64 nr_comp = atomic64_read(&cs->nr_comp);
+		u64 nr_decomp = atomic64_read(&cs->nr_decomp);
+		u64 comp_ns = 0, decomp_ns = 0;
+		u32 ratio = 0;
+
+		if (!zram->comps[i])
+			continue;
+
+		/* ratio in hundredths, average latencies in ns */
+		if (compr)
+			ratio = div64_u64(orig * 100, compr);
+		if (nr_comp)
+			comp_ns = div64_u64(atomic64_read(&cs->comp_ns), nr_comp);
+		if (nr_decomp)
+			decomp_ns = div64_u64(atomic64_read(&cs->decomp_ns),
+					      nr_decomp);
+
+		seq_printf(m, "%-12s %10llu %12llu %3u.%02u %8llu %9llu\n",
+			   names[i], orig, compr, ratio / 100, ratio % 100,
+			   comp_ns, decomp_ns);
+	}
+	up_read(&zram->init_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(comp_stat);
+
 static void zram_debugfs_register(struct zram *zram)
 {
 	if (!zram_debugfs_root)
@@ -969,6 +1269,8 @@ static void zram_debugfs_register(struct zram *zram)
 						zram_debugfs_root);
 	debugfs_create_file("block_state", 0400, zram->debugfs_dir,
 				zram, &proc_zram_block_state_op);
+	debugfs_create_file("comp_stat", 0400, zram->debugfs_dir,
+				zram, &comp_stat_fops);
 }
 
 static void zram_debugfs_unregister(struct zram *zram)
@@ -1020,11 +1322,10 @@ static ssize_t comp_algorithm_show(struct device *dev,
 	return sz;
 }
 
-static ssize_t comp_algorithm_store(struct device *dev,
-		struct device_attribute *attr, const char *buf, size_t len)
+static ssize_t __comp_algorithm_store(struct zram *zram, char *dst,
+		const char *buf, size_t len)
 {
-	struct zram *zram = dev_to_zram(dev);
-	char compressor[ARRAY_SIZE(zram->compressor)];
+	char compressor[CRYPTO_MAX_ALG_NAME];
 	size_t sz;
 
 	strlcpy(compressor, buf, sizeof(compressor));
@@ -1043,10 +1344,278 @@ static ssize_t comp_algorithm_store(struct device *dev,
 		return -EBUSY;
 	}
 
-	strcpy(zram->compressor, compressor);
+	strcpy(dst, compressor);
+	up_write(&zram->init_lock);
+	return len;
+}
+
+static ssize_t comp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return __comp_algorithm_store(zram, zram->compressor, buf, len);
+}
+
+#ifdef CONFIG_ZRAM_DEDUP
+static ssize_t use_dedup_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	bool val;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	val = zram->use_dedup;
+	up_read(&zram->init_lock);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", val);
+}
+
+static ssize_t use_dedup_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	bool val;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (kstrtobool(buf, &val))
+		return -EINVAL;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		up_write(&zram->init_lock);
+		pr_info("Can't change dedup usage for initialized device\n");
+		return -EBUSY;
+	}
+	zram->use_dedup = val;
 	up_write(&zram->init_lock);
 	return len;
 }
+#endif
+
+static ssize_t recomp_algorithm_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	size_t sz;
+	struct zram *zram = dev_to_zram(dev);
+
+	down_read(&zram->init_lock);
+	sz = zcomp_available_show(zram->recompressor, buf);
+	up_read(&zram->init_lock);
+
+	return sz;
+}
+
+static ssize_t recomp_algorithm_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return __comp_algorithm_store(zram, zram->recompressor, buf, len);
+}
+
+#define RECOMP_IDLE	BIT(0)
+#define RECOMP_HUGE	BIT(1)
+
+/*
+ * Recompress the slot with the secondary algorithm and keep the result
+ * if it is smaller.  Called with the slot lock held.
+ */
+static int zram_recompress(struct zram *zram, u32 index, struct page *page)
+{
+	struct zcomp *comp = zram->comps[ZRAM_SECONDARY_COMP];
+	struct zcomp_strm *zstrm;
+	unsigned long handle, new_handle;
+	unsigned int size, comp_len;
+	void *src, *dst;
+	u64 start;
+	int ret;
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	ktime_t ac_time = zram->table[index].ac_time;
+#endif
+
+	handle = zram_get_handle(zram, index);
+	size = zram_get_obj_size(zram, index);
+
+	if (size != PAGE_SIZE)
+		zstrm = zcomp_stream_get(zram->comps[ZRAM_PRIMARY_COMP]);
+
+	start = ktime_get_ns();
+	src = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	dst = kmap_atomic(page);
+	if (size == PAGE_SIZE) {
+		memcpy(dst, src, PAGE_SIZE);
+		ret = 0;
+	} else {
+		ret = zcomp_decompress(zstrm, src, size, dst);
+	}
+	kunmap_atomic(dst);
+	if (size != PAGE_SIZE) {
+		zcomp_stream_put(zram->comps[ZRAM_PRIMARY_COMP]);
+		zram_decomp_done(zram, ZRAM_PRIMARY_COMP, start);
+	}
+	zs_unmap_object(zram->mem_pool, handle);
+	if (WARN_ON(ret))
+		return ret;
+
+	zstrm = zcomp_stream_get(comp);
+	start = ktime_get_ns();
+	src = kmap_atomic(page);
+	ret = zcomp_compress(zstrm, src, &comp_len);
+	kunmap_atomic(src);
+	zram_comp_done(zram, ZRAM_SECONDARY_COMP, start);
+	if (ret) {
+		zcomp_stream_put(comp);
+		return ret;
+	}
+
+	/* Not worth it, and don't try this slot again until it is rewritten */
+	if (comp_len >= size || comp_len >= huge_class_size) {
+		zcomp_stream_put(comp);
+		zram_set_flag(zram, index, ZRAM_INCOMPRESSIBLE);
+		return 0;
+	}
+
+	/* We hold the slot lock, so the allocation must not sleep */
+	new_handle = zs_malloc(zram->mem_pool, comp_len,
+			__GFP_KSWAPD_RECLAIM |
+			__GFP_NOWARN |
+			__GFP_HIGHMEM |
+			__GFP_MOVABLE);
+	if (!new_handle) {
+		zcomp_stream_put(comp);
+		return -ENOMEM;
+	}
+
+	dst = zs_map_object(zram->mem_pool, new_handle, ZS_MM_WO);
+	memcpy(dst, zstrm->buffer, comp_len);
+	zcomp_stream_put(comp);
+	zs_unmap_object(zram->mem_pool, new_handle);
+
+	zram_free_page(zram, index);
+	zram_set_handle(zram, index, new_handle);
+	zram_set_obj_size(zram, index, comp_len);
+	zram_set_flag(zram, index, ZRAM_RECOMP);
+	/* The page did not become any less idle */
+	zram_set_flag(zram, index, ZRAM_IDLE);
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	zram->table[index].ac_time = ac_time;
+#endif
+
+	atomic64_add(comp_len, &zram->stats.compr_data_size);
+	atomic64_inc(&zram->stats.comp[ZRAM_SECONDARY_COMP].pages);
+	atomic64_add(comp_len, &zram->stats.comp[ZRAM_SECONDARY_COMP].compr_size);
+	atomic64_inc(&zram->stats.pages_stored);
+	return 0;
+}
+
+static bool zram_recomp_candidate(struct zram *zram, u32 index, int mode)
+{
+	if (!zram_get_handle(zram, index) ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+	    zram_test_flag(zram, index, ZRAM_RECOMP) ||
+	    zram_test_flag(zram, index, ZRAM_INCOMPRESSIBLE) ||
+	    zram_test_flag(zram, index, ZRAM_DEDUP))
+		return false;
+
+	if ((mode & RECOMP_IDLE) && !zram_test_flag(zram, index, ZRAM_IDLE))
+		return false;
+	if ((mode & RECOMP_HUGE) && !zram_test_flag(zram, index, ZRAM_HUGE))
+		return false;
+	return true;
+}
+
+static void zram_recomp_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, recomp_work);
+	int mode = READ_ONCE(zram->recomp_mode);
+	unsigned long nr_pages, index;
+	struct page *page;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram) || !zram->comps[ZRAM_SECONDARY_COMP])
+		goto out;
+
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		if (READ_ONCE(zram->recomp_stop))
+			break;
+
+		zram_slot_lock(zram, index);
+		if (zram_recomp_candidate(zram, index, mode))
+			zram_recompress(zram, index, page);
+		zram_slot_unlock(zram, index);
+		cond_resched();
+	}
+out:
+	up_read(&zram->init_lock);
+	__free_page(page);
+}
+
+/*
+ * Kick off background recompression of idle ("idle"), incompressible
+ * ("huge") or idle and incompressible ("huge_idle") slots with the
+ * secondary algorithm.  Slots are marked idle with the 'idle' attribute.
+ */
+static ssize_t recompress_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	ssize_t ret = len;
+	int mode;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = RECOMP_IDLE;
+	else if (sysfs_streq(buf, "huge"))
+		mode = RECOMP_HUGE;
+	else if (sysfs_streq(buf, "huge_idle"))
+		mode = RECOMP_IDLE | RECOMP_HUGE;
+	else
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (!zram->comps[ZRAM_SECONDARY_COMP]) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	WRITE_ONCE(zram->recomp_mode, mode);
+	queue_work(system_unbound_wq, &zram->recomp_work);
+out:
+	up_read(&zram->init_lock);
+	return ret;
+}
+
+static ssize_t async_write_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%d\n", READ_ONCE(zram->async_write));
+}
+
+static ssize_t async_write_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	bool val;
+
+	if (kstrtobool(buf, &val))
+		return -EINVAL;
+
+	WRITE_ONCE(zram->async_write, val);
+	return len;
+}
 
 static ssize_t compact_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t len)
@@ -1087,6 +1656,8 @@ static ssize_t mm_stat_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
 	struct zram *zram = dev_to_zram(dev);
+	struct zram_comp_stats *secondary =
+		&zram->stats.comp[ZRAM_SECONDARY_COMP];
 	struct zs_pool_stats pool_stats;
 	u64 orig_size, mem_used = 0;
 	long max_used;
@@ -1104,7 +1675,7 @@ static ssize_t mm_stat_show(struct device *dev,
 	max_used = atomic_long_read(&zram->stats.max_used_pages);
 
 	ret = scnprintf(buf, PAGE_SIZE,
-			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu %8llu %8llu\n",
+			"%8llu %8llu %8llu %8lu %8ld %8llu %8lu %8llu %8llu %8llu %8llu %8llu %8llu\n",
 			orig_size << PAGE_SHIFT,
 			(u64)atomic64_read(&zram->stats.compr_data_size),
 			mem_used << PAGE_SHIFT,
@@ -1113,7 +1684,11 @@ static ssize_t mm_stat_show(struct device *dev,
 			(u64)atomic64_read(&zram->stats.same_pages),
 			atomic_long_read(&pool_stats.pages_compacted),
 			(u64)atomic64_read(&zram->stats.huge_pages),
-			(u64)atomic64_read(&zram->stats.huge_pages_since));
+			(u64)atomic64_read(&zram->stats.huge_pages_since),
+			(u64)atomic64_read(&secondary->pages) << PAGE_SHIFT,
+			(u64)atomic64_read(&secondary->compr_size),
+			(u64)atomic64_read(&zram->stats.dup_data_size),
+			(u64)atomic64_read(&zram->stats.meta_data_size));
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -1125,14 +1700,22 @@ static ssize_t bd_stat_show(struct device *dev,
 		struct device_attribute *attr, char *buf)
 {
 	struct zram *zram = dev_to_zram(dev);
+	u64 wb_time, wb_kb, wb_bw = 0;
 	ssize_t ret;
 
 	down_read(&zram->init_lock);
+	wb_time = atomic64_read(&zram->stats.bd_wb_time);
+	wb_kb = FOUR_K((u64)atomic64_read(&zram->stats.bd_writes)) * 4;
+	/* writeback bandwidth in KiB/s */
+	if (wb_time)
+		wb_bw = div64_u64(wb_kb * NSEC_PER_SEC, wb_time);
 	ret = scnprintf(buf, PAGE_SIZE,
-		"%8llu %8llu %8llu\n",
+		"%8llu %8llu %8llu %8llu %8llu\n",
 			FOUR_K((u64)atomic64_read(&zram->stats.bd_count)),
 			FOUR_K((u64)atomic64_read(&zram->stats.bd_reads)),
-			FOUR_K((u64)atomic64_read(&zram->stats.bd_writes)));
+			FOUR_K((u64)atomic64_read(&zram->stats.bd_writes)),
+			div_u64(wb_time, NSEC_PER_MSEC),
+			wb_bw);
 	up_read(&zram->init_lock);
 
 	return ret;
@@ -1173,6 +1756,7 @@ static void zram_meta_free(struct zram *zram, u64 disksize)
 	for (index = 0; index < num_pages; index++)
 		zram_free_page(zram, index);
 
+	zram_dedup_fini(zram);
 	zs_destroy_pool(zram->mem_pool);
 	vfree(zram->table);
 }
@@ -1192,6 +1776,12 @@ static bool zram_meta_alloc(struct zram *zram, u64 disksize)
 		return false;
 	}
 
+	if (zram_dedup_init(zram, num_pages)) {
+		zs_destroy_pool(zram->mem_pool);
+		vfree(zram->table);
+		return false;
+	}
+
 	if (!huge_class_size)
 		huge_class_size = zs_huge_class_size(zram->mem_pool);
 	return true;
@@ -1205,6 +1795,8 @@ static bool zram_meta_alloc(struct zram *zram, u64 disksize)
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	unsigned long handle;
+	size_t size;
+	u32 prio;
 
 #ifdef CONFIG_ZRAM_MEMORY_TRACKING
 	zram->table[index].ac_time = 0;
@@ -1212,6 +1804,8 @@ static void zram_free_page(struct zram *zram, size_t index)
 	if (zram_test_flag(zram, index, ZRAM_IDLE))
 		zram_clear_flag(zram, index, ZRAM_IDLE);
 
+	zram_clear_flag(zram, index, ZRAM_INCOMPRESSIBLE);
+
 	if (zram_test_flag(zram, index, ZRAM_HUGE)) {
 		zram_clear_flag(zram, index, ZRAM_HUGE);
 		atomic64_dec(&zram->stats.huge_pages);
@@ -1237,10 +1831,20 @@ static void zram_free_page(struct zram *zram, size_t index)
 	if (!handle)
 		return;
 
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		zram_clear_flag(zram, index, ZRAM_DEDUP);
+		zram_dedup_put(zram, (struct zram_dedup_entry *)handle);
+		goto out;
+	}
+
 	zs_free(zram->mem_pool, handle);
 
-	atomic64_sub(zram_get_obj_size(zram, index),
-			&zram->stats.compr_data_size);
+	size = zram_get_obj_size(zram, index);
+	prio = zram_get_prio(zram, index);
+	zram_clear_flag(zram, index, ZRAM_RECOMP);
+	atomic64_sub(size, &zram->stats.compr_data_size);
+	atomic64_dec(&zram->stats.comp[prio].pages);
+	atomic64_sub(size, &zram->stats.comp[prio].compr_size);
 out:
 	atomic64_dec(&zram->stats.pages_stored);
 	zram_set_handle(zram, index, 0);
@@ -1256,6 +1860,7 @@ static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 	unsigned long handle;
 	unsigned int size;
 	void *src, *dst;
+	u32 prio;
 	int ret;
 
 	zram_slot_lock(zram, index);
@@ -1285,10 +1890,14 @@ static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 		return 0;
 	}
 
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		handle = ((struct zram_dedup_entry *)handle)->handle;
+
 	size = zram_get_obj_size(zram, index);
+	prio = zram_get_prio(zram, index);
 
 	if (size != PAGE_SIZE)
-		zstrm = zcomp_stream_get(zram->comp);
+		zstrm = zcomp_stream_get(zram->comps[prio]);
 
 	src = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 	if (size == PAGE_SIZE) {
@@ -1297,10 +1906,13 @@ static int __zram_bvec_read(struct zram *zram, struct page *page, u32 index,
 		kunmap_atomic(dst);
 		ret = 0;
 	} else {
+		u64 start = ktime_get_ns();
+
 		dst = kmap_atomic(page);
 		ret = zcomp_decompress(zstrm, src, size, dst);
 		kunmap_atomic(dst);
-		zcomp_stream_put(zram->comp);
+		zcomp_stream_put(zram->comps[prio]);
+		zram_decomp_done(zram, prio, start);
 	}
 	zs_unmap_object(zram->mem_pool, handle);
 	zram_slot_unlock(zram, index);
@@ -1353,8 +1965,12 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 	unsigned long handle = 0;
 	unsigned int comp_len = 0;
 	void *src, *dst, *mem;
+	struct zcomp *comp = zram->comps[ZRAM_PRIMARY_COMP];
 	struct zcomp_strm *zstrm;
 	struct page *page = bvec->bv_page;
+	struct zram_dedup_entry *entry = NULL;
+	u32 checksum = 0;
+	u64 start;
 	unsigned long element = 0;
 	enum zram_pageflags flags = 0;
 
@@ -1369,13 +1985,15 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 	kunmap_atomic(mem);
 
 compress_again:
-	zstrm = zcomp_stream_get(zram->comp);
+	zstrm = zcomp_stream_get(comp);
+	start = ktime_get_ns();
 	src = kmap_atomic(page);
 	ret = zcomp_compress(zstrm, src, &comp_len);
 	kunmap_atomic(src);
+	zram_comp_done(zram, ZRAM_PRIMARY_COMP, start);
 
 	if (unlikely(ret)) {
-		zcomp_stream_put(zram->comp);
+		zcomp_stream_put(comp);
 		pr_err("Compression failed! err=%d\n", ret);
 		zs_free(zram->mem_pool, handle);
 		return ret;
@@ -1383,6 +2001,25 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 
 	if (comp_len >= huge_class_size)
 		comp_len = PAGE_SIZE;
+
+	if (zram_dedup_enabled(zram)) {
+		src = zstrm->buffer;
+		if (comp_len == PAGE_SIZE)
+			src = kmap_atomic(page);
+		checksum = zram_dedup_checksum(src, comp_len);
+		entry = zram_dedup_find(zram, src, comp_len, checksum);
+		if (comp_len == PAGE_SIZE)
+			kunmap_atomic(src);
+
+		if (entry) {
+			/* Share the existing object, drop what we allocated */
+			zcomp_stream_put(comp);
+			if (handle)
+				zs_free(zram->mem_pool, handle);
+			handle = (unsigned long)entry;
+			goto out;
+		}
+	}
 	/*
 	 * handle allocation has 2 paths:
 	 * a) fast path is executed with preemption disabled (for
@@ -1403,7 +2040,7 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 				__GFP_HIGHMEM |
 				__GFP_MOVABLE);
 	if (!handle) {
-		zcomp_stream_put(zram->comp);
+		zcomp_stream_put(comp);
 		atomic64_inc(&zram->stats.writestall);
 		handle = zs_malloc(zram->mem_pool, comp_len,
 				GFP_NOIO | __GFP_HIGHMEM |
@@ -1417,7 +2054,7 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 	update_used_max(zram, alloced_pages);
 
 	if (zram->limit_pages && alloced_pages > zram->limit_pages) {
-		zcomp_stream_put(zram->comp);
+		zcomp_stream_put(comp);
 		zs_free(zram->mem_pool, handle);
 		return -ENOMEM;
 	}
@@ -1431,9 +2068,17 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 	if (comp_len == PAGE_SIZE)
 		kunmap_atomic(src);
 
-	zcomp_stream_put(zram->comp);
+	zcomp_stream_put(comp);
 	zs_unmap_object(zram->mem_pool, handle);
 	atomic64_add(comp_len, &zram->stats.compr_data_size);
+	atomic64_inc(&zram->stats.comp[ZRAM_PRIMARY_COMP].pages);
+	atomic64_add(comp_len, &zram->stats.comp[ZRAM_PRIMARY_COMP].compr_size);
+
+	if (zram_dedup_enabled(zram)) {
+		entry = zram_dedup_insert(zram, handle, comp_len, checksum);
+		if (entry)
+			handle = (unsigned long)entry;
+	}
 out:
 	/*
 	 * Free memory associated with this sector
@@ -1454,6 +2099,8 @@ static int __zram_bvec_write(struct zram *zram, struct bio_vec *bvec,
 	}  else {
 		zram_set_handle(zram, index, handle);
 		zram_set_obj_size(zram, index, comp_len);
+		if (entry)
+			zram_set_flag(zram, index, ZRAM_DEDUP);
 	}
 	zram_slot_unlock(zram, index);
 
@@ -1620,6 +2267,51 @@ static void __zram_make_request(struct zram *zram, struct bio *bio)
 	bio_endio(bio);
 }
 
+struct zram_bio_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct bio *bio;
+};
+
+static void zram_bio_work(struct work_struct *work)
+{
+	struct zram_bio_work *zbw = container_of(work, struct zram_bio_work,
+						 work);
+	struct zram *zram = zbw->zram;
+
+	__zram_make_request(zram, zbw->bio);
+	kfree(zbw);
+	atomic_dec(&zram->async_bios);
+}
+
+/*
+ * Hand a write bio to the unbound workers of zram->wq so that the
+ * submitter does not pay for compression.  Returns false if the bio
+ * has to be handled synchronously, which also throttles submitters
+ * once enough bios are queued to keep every CPU busy.
+ */
+static bool zram_queue_bio(struct zram *zram, struct bio *bio)
+{
+	struct zram_bio_work *zbw;
+
+	if (atomic_inc_return(&zram->async_bios) >
+	    ZRAM_ASYNC_BIOS_PER_CPU * num_online_cpus())
+		goto out;
+
+	zbw = kmalloc(sizeof(*zbw), GFP_NOIO | __GFP_NOWARN);
+	if (!zbw)
+		goto out;
+
+	INIT_WORK(&zbw->work, zram_bio_work);
+	zbw->zram = zram;
+	zbw->bio = bio;
+	queue_work(zram->wq, &zbw->work);
+	return true;
+out:
+	atomic_dec(&zram->async_bios);
+	return false;
+}
+
 /*
  * Handler function for all zram I/O requests.
  */
@@ -1634,6 +2326,10 @@ static void zram_submit_bio(struct bio *bio)
 		return;
 	}
 
+	if (READ_ONCE(zram->async_write) && bio_op(bio) == REQ_OP_WRITE &&
+	    zram_queue_bio(zram, bio))
+		return;
+
 	__zram_make_request(zram, bio);
 }
 
@@ -1667,6 +2363,10 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 		return -ENOTSUPP;
 	zram = bdev->bd_disk->private_data;
 
+	/* Let the caller fall back to a bio, which is compressed out of line */
+	if (op_is_write(op) && READ_ONCE(zram->async_write))
+		return -EOPNOTSUPP;
+
 	if (!valid_io_request(zram, sector, PAGE_SIZE)) {
 		atomic64_inc(&zram->stats.invalid_io);
 		ret = -EINVAL;
@@ -1710,10 +2410,16 @@ static int zram_rw_page(struct block_device *bdev, sector_t sector,
 
 static void zram_reset_device(struct zram *zram)
 {
-	struct zcomp *comp;
 	u64 disksize;
+	int i;
+
+	/* Background recompression holds init_lock, ask it to bail out */
+	WRITE_ONCE(zram->recomp_stop, true);
+	cancel_work_sync(&zram->recomp_work);
+	flush_workqueue(zram->wq);
 
 	down_write(&zram->init_lock);
+	WRITE_ONCE(zram->recomp_stop, false);
 
 	zram->limit_pages = 0;
 
@@ -1722,7 +2428,6 @@ static void zram_reset_device(struct zram *zram)
 		return;
 	}
 
-	comp = zram->comp;
 	disksize = zram->disksize;
 	zram->disksize = 0;
 
@@ -1732,7 +2437,11 @@ static void zram_reset_device(struct zram *zram)
 	/* I/O operation under all of CPU are done so let's free */
 	zram_meta_free(zram, disksize);
 	memset(&zram->stats, 0, sizeof(zram->stats));
-	zcomp_destroy(comp);
+	for (i = 0; i < ZRAM_MAX_COMPS; i++) {
+		if (zram->comps[i])
+			zcomp_destroy(zram->comps[i]);
+		zram->comps[i] = NULL;
+	}
 	reset_bdev(zram);
 
 	up_write(&zram->init_lock);
@@ -1771,13 +2480,28 @@ static ssize_t disksize_store(struct device *dev,
 		goto out_free_meta;
 	}
 
-	zram->comp = comp;
+	zram->comps[ZRAM_PRIMARY_COMP] = comp;
+
+	if (zram->recompressor[0]) {
+		comp = zcomp_create(zram->recompressor);
+		if (IS_ERR(comp)) {
+			pr_err("Cannot initialise %s recompressing backend\n",
+					zram->recompressor);
+			err = PTR_ERR(comp);
+			goto out_free_comp;
+		}
+		zram->comps[ZRAM_SECONDARY_COMP] = comp;
+	}
+
 	zram->disksize = disksize;
 	set_capacity_and_notify(zram->disk, zram->disksize >> SECTOR_SHIFT);
 	up_write(&zram->init_lock);
 
 	return len;
 
+out_free_comp:
+	zcomp_destroy(zram->comps[ZRAM_PRIMARY_COMP]);
+	zram->comps[ZRAM_PRIMARY_COMP] = NULL;
 out_free_meta:
 	zram_meta_free(zram, disksize);
 out_unlock:
@@ -1866,6 +2590,12 @@ static DEVICE_ATTR_WO(mem_used_max);
 static DEVICE_ATTR_WO(idle);
 static DEVICE_ATTR_RW(max_comp_streams);
 static DEVICE_ATTR_RW(comp_algorithm);
+static DEVICE_ATTR_RW(recomp_algorithm);
+static DEVICE_ATTR_WO(recompress);
+static DEVICE_ATTR_RW(async_write);
+#ifdef CONFIG_ZRAM_DEDUP
+static DEVICE_ATTR_RW(use_dedup);
+#endif
 #ifdef CONFIG_ZRAM_WRITEBACK
 static DEVICE_ATTR_RW(backing_dev);
 static DEVICE_ATTR_WO(writeback);
@@ -1883,6 +2613,12 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_idle.attr,
 	&dev_attr_max_comp_streams.attr,
 	&dev_attr_comp_algorithm.attr,
+	&dev_attr_recomp_algorithm.attr,
+	&dev_attr_recompress.attr,
+	&dev_attr_async_write.attr,
+#ifdef CONFIG_ZRAM_DEDUP
+	&dev_attr_use_dedup.attr,
+#endif
 #ifdef CONFIG_ZRAM_WRITEBACK
 	&dev_attr_backing_dev.attr,
 	&dev_attr_writeback.attr,
@@ -1922,6 +2658,15 @@ static int zram_add(void)
 #ifdef CONFIG_ZRAM_WRITEBACK
 	spin_lock_init(&zram->wb_limit_lock);
 #endif
+	INIT_WORK(&zram->recomp_work, zram_recomp_work);
+
+	zram->wq = alloc_workqueue("zram%d",
+				   WQ_UNBOUND | WQ_HIGHPRI | WQ_MEM_RECLAIM, 0,
+				   device_id);
+	if (!zram->wq) {
+		ret = -ENOMEM;
+		goto out_free_idr;
+	}
 
 	/* gendisk structure */
 	zram->disk = blk_alloc_disk(NUMA_NO_NODE);
@@ -1929,7 +2674,7 @@ static int zram_add(void)
 		pr_err("Error allocating disk structure for device %d\n",
 			device_id);
 		ret = -ENOMEM;
-		goto out_free_idr;
+		goto out_free_wq;
 	}
 
 	zram->disk->major = zram_major;
@@ -1983,6 +2728,8 @@ static int zram_add(void)
 
 out_cleanup_disk:
 	blk_cleanup_disk(zram->disk);
+out_free_wq:
+	destroy_workqueue(zram->wq);
 out_free_idr:
 	idr_remove(&zram_index_idr, device_id);
 out_free_dev:
@@ -2035,6 +2782,7 @@ static int zram_remove(struct zram *zram)
 	zram_reset_device(zram);
 
 	blk_cleanup_disk(zram->disk);
+	destroy_workqueue(zram->wq);
 	kfree(zram);
 	return 0;
 }
@@ -18,8 +18,10 @@
 #include <linux/rwsem.h>
 #include <linux/zsmalloc.h>
 #include <linux/crypto.h>
+#include <linux/workqueue.h>
 
 #include "zcomp.h"
+#include "zram_dedup.h"
 
 #define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
@@ -27,6 +29,8 @@
 #define ZRAM_LOGICAL_BLOCK_SIZE	(1 << ZRAM_LOGICAL_BLOCK_SHIFT)
 #define ZRAM_SECTOR_PER_LOGICAL_BLOCK	\
 	(1 << (ZRAM_LOGICAL_BLOCK_SHIFT - SECTOR_SHIFT))
+/* Write bios queued to zram->wq per online CPU before writing inline */
+#define ZRAM_ASYNC_BIOS_PER_CPU	16
 
 
 /*
@@ -38,8 +42,11 @@
  * footprint small so we can squeeze size and flags into a field.
  * The lower ZRAM_FLAG_SHIFT bits is for object size (excluding header),
  * the higher bits is for zram_pageflags.
+ *
+ * An object is at most PAGE_SIZE bytes, so PAGE_SHIFT + 1 bits hold its
+ * size and leave enough room for the flags in a 32-bit long.
  */
-#define ZRAM_FLAG_SHIFT 24
+#define ZRAM_FLAG_SHIFT (PAGE_SHIFT + 1)
 
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
@@ -50,10 +57,18 @@ enum zram_pageflags {
 	ZRAM_UNDER_WB,	/* page is under writeback */
 	ZRAM_HUGE,	/* Incompressible page */
 	ZRAM_IDLE,	/* not accessed page since last idle marking */
+	ZRAM_RECOMP,	/* page is compressed with the secondary algorithm */
+	ZRAM_INCOMPRESSIBLE, /* recompression did not make the page smaller */
+	ZRAM_DEDUP,	/* handle points to a shared zram_dedup_entry */
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
+/* Indices of zram->comps[] and zram->stats.comp[] */
+#define ZRAM_PRIMARY_COMP	0
+#define ZRAM_SECONDARY_COMP	1
+#define ZRAM_MAX_COMPS		2
+
 /*-- Data structures */
 
 /* Allocated for each disk page */
@@ -68,6 +83,16 @@ struct zram_table_entry {
 #endif
 };
 
+/* Per-algorithm statistics */
+struct zram_comp_stats {
+	atomic64_t pages;	/* no. of compressed pages stored */
+	atomic64_t compr_size;	/* compressed size of those pages */
+	atomic64_t nr_comp;	/* no. of compressions */
+	atomic64_t comp_ns;	/* time spent compressing */
+	atomic64_t nr_decomp;	/* no. of decompressions */
+	atomic64_t decomp_ns;	/* time spent decompressing */
+};
+
 struct zram_stats {
 	atomic64_t compr_data_size;	/* compressed size of pages stored */
 	atomic64_t num_reads;	/* failed + successful */
@@ -83,17 +108,21 @@ struct zram_stats {
 	atomic_long_t max_used_pages;	/* no. of maximum pages stored */
 	atomic64_t writestall;		/* no. of write slow paths */
 	atomic64_t miss_free;		/* no. of missed free */
+	atomic64_t dup_data_size;	/* compressed bytes saved by dedup */
+	atomic64_t meta_data_size;	/* size of dedup metadata */
+	struct zram_comp_stats comp[ZRAM_MAX_COMPS];
 #ifdef	CONFIG_ZRAM_WRITEBACK
 	atomic64_t bd_count;		/* no. of pages in backing device */
 	atomic64_t bd_reads;		/* no. of reads from backing device */
 	atomic64_t bd_writes;		/* no. of writes from backing device */
+	atomic64_t bd_wb_time;		/* ns spent writing back */
 #endif
 };
 
 struct zram {
 	struct zram_table_entry *table;
 	struct zs_pool *mem_pool;
-	struct zcomp *comp;
+	struct zcomp *comps[ZRAM_MAX_COMPS];
 	struct gendisk *disk;
 	/* Prevent concurrent execution of device init */
 	struct rw_semaphore init_lock;
@@ -109,6 +138,15 @@ struct zram {
 	 */
 	u64 disksize;	/* bytes */
 	char compressor[CRYPTO_MAX_ALG_NAME];
+	/* secondary algorithm used to recompress idle/huge slots */
+	char recompressor[CRYPTO_MAX_ALG_NAME];
+	struct work_struct recomp_work;
+	int recomp_mode;
+	bool recomp_stop;
+	/* compress writes in zram->wq instead of the submitter */
+	bool async_write;
+	struct workqueue_struct *wq;
+	atomic_t async_bios;
 	/*
 	 * zram is claimed so open request will be failed
 	 */
@@ -125,5 +163,10 @@ struct zram {
 #ifdef CONFIG_ZRAM_MEMORY_TRACKING
 	struct dentry *debugfs_dir;
 #endif
+#ifdef CONFIG_ZRAM_DEDUP
+	bool use_dedup;
+	struct zram_hash *hash;
+	size_t hash_size;
+#endif
 };
 #endif
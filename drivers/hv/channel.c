@@ -1067,6 +1067,26 @@ int vmbus_sendpacket(struct vmbus_channel *channel, void *buffer,
 }
 EXPORT_SYMBOL(vmbus_sendpacket);
 
+/**
+ * vmbus_sendpacket_batch() - Send several in-band packets on a channel
+ * @channel: Pointer to vmbus_channel structure
+ * @pkts: Packets to send, in order
+ * @count: Number of entries in @pkts
+ *
+ * Like calling vmbus_sendpacket() for each packet, except that the ring
+ * buffer lock is taken once and the host is signaled at most once for the
+ * whole batch. The packets are sent in order until the ring buffer fills up.
+ *
+ * Return: the number of packets sent, or -EAGAIN if the ring buffer has no
+ * room for the first one.
+ */
+int vmbus_sendpacket_batch(struct vmbus_channel *channel,
+			   const struct vmbus_batch_packet *pkts, u32 count)
+{
+	return hv_ringbuffer_write_batch(channel, pkts, count);
+}
+EXPORT_SYMBOL_GPL(vmbus_sendpacket_batch);
+
 /*
  * vmbus_sendpacket_pagebuffer - Send a range of single-page buffer
  * packets using a GPADL Direct packet type. This interface allows you
@@ -725,7 +725,7 @@ void dxgdevice_release(struct kref *refcount)
 	struct dxgdevice *device;
 
 	device = container_of(refcount, struct dxgdevice, device_kref);
-	vfree(device);
+	kvfree_rcu(device, rcu);
 }
 
 void dxgdevice_add_paging_queue(struct dxgdevice *device,
@@ -836,7 +836,7 @@ void dxgcontext_release(struct kref *refcount)
 	struct dxgcontext *context;
 
 	context = container_of(refcount, struct dxgcontext, context_kref);
-	vfree(context);
+	kvfree_rcu(context, rcu);
 }
 
 int dxgcontext_add_hwqueue(struct dxgcontext *context,
@@ -992,7 +992,7 @@ void dxgpagingqueue_destroy(struct dxgpagingqueue *pqueue)
 	hmgrtable_unlock(&process->handle_table, DXGLOCK_EXCL);
 	if (pqueue->device)
 		dxgdevice_remove_paging_queue(pqueue);
-	vfree(pqueue);
+	kvfree_rcu(pqueue, rcu);
 }
 
 struct dxgprocess_adapter *dxgprocess_adapter_create(struct dxgprocess *process,
@@ -1371,5 +1371,5 @@ void dxghwqueue_release(struct kref *refcount)
 	struct dxghwqueue *hwqueue;
 
 	hwqueue = container_of(refcount, struct dxghwqueue, hwqueue_kref);
-	vfree(hwqueue);
+	kvfree_rcu(hwqueue, rcu);
 }
@@ -22,6 +22,7 @@
 #include <linux/rwsem.h>
 #include <linux/atomic.h>
 #include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <linux/gfp.h>
 #include <linux/miscdevice.h>
 #include <linux/pci.h>
@@ -71,14 +72,43 @@ enum dxgobjectstate {
 	DXGOBJECTSTATE_DESTROYED,
 };
 
+/*
+ * The completion table maps the request ID of a VM bus packet to the packet,
+ * waiting for completion. The low DXGVMBUS_SLOT_SHIFT bits of the request ID
+ * are the slot index and the high bits are the request sequence number,
+ * which is the slot generation.
+ */
+#define DXGVMBUS_SLOT_SHIFT	12
+#define DXGVMBUS_NUM_SLOTS	(1 << DXGVMBUS_SLOT_SHIFT)
+
+struct dxgvmbuspacket;
+
+struct dxgvmbusslot {
+	struct dxgvmbuspacket	*packet;
+	/* 0 when the slot is free */
+	u64			request_id;
+};
+
+/*
+ * slots - the completion table
+ * slot_bitmap - bitmap of the used slots
+ * slot_wait - senders wait here when the table is full
+ * packet_request_id - request sequence number
+ */
 struct dxgvmbuschannel {
 	struct vmbus_channel	*channel;
 	struct hv_device	*hdev;
 	struct dxgadapter	*adapter;
-	spinlock_t		packet_list_mutex;
-	struct list_head	packet_list_head;
+	struct dxgvmbusslot	*slots;
+	unsigned long		*slot_bitmap;
+	wait_queue_head_t	slot_wait;
 	struct kmem_cache	*packet_cache;
 	atomic64_t		packet_request_id;
+#if IS_ENABLED(CONFIG_DXGKRNL_KUNIT_TEST)
+	/* Replaces the VM bus channel with a fake host in unit tests */
+	int (*test_send)(struct dxgvmbuschannel *ch, void *command,
+			 u32 command_size, u64 request_id);
+#endif
 };
 
 int dxgvmbuschannel_init(struct dxgvmbuschannel *ch, struct hv_device *hdev);
@@ -93,6 +123,8 @@ struct dxgpagingqueue {
 	struct d3dkmthandle	handle;
 	struct d3dkmthandle	syncobj_handle;
 	void			*mapped_address;
+	/* The object is freed after a grace period for lockless lookups */
+	struct rcu_head		rcu;
 };
 
 /*
@@ -504,6 +536,8 @@ struct dxgdevice {
 	enum d3dkmt_deviceexecution_state execution_state;
 	int			execution_state_counter;
 	u32			handle_valid;
+	/* The object is freed after a grace period for lockless lookups */
+	struct rcu_head		rcu;
 };
 
 struct dxgdevice *dxgdevice_create(struct dxgadapter *a, struct dxgprocess *p);
@@ -547,6 +581,8 @@ struct dxgcontext {
 	struct kref		context_kref;
 	struct d3dkmthandle	handle;
 	struct d3dkmthandle	device_handle;
+	/* The object is freed after a grace period for lockless lookups */
+	struct rcu_head		rcu;
 };
 
 struct dxgcontext *dxgcontext_create(struct dxgdevice *dev);
@@ -573,6 +609,8 @@ struct dxghwqueue {
 	struct d3dkmthandle	handle;
 	struct d3dkmthandle	device_handle;
 	void			*progress_fence_mapped_address;
+	/* The object is freed after a grace period for lockless lookups */
+	struct rcu_head		rcu;
 };
 
 struct dxghwqueue *dxghwqueue_create(struct dxgcontext *ctx);
@@ -915,6 +915,8 @@ static int __init dxg_drv_init(void)
 static void __exit dxg_drv_exit(void)
 {
 	dxgglobal_destroy();
+	/* Wait for the handle tables freed by hmgrtable_destroy() */
+	rcu_barrier();
 }
 
 module_init(dxg_drv_init);
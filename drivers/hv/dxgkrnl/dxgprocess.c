@@ -267,6 +267,12 @@ struct dxgadapter *dxgprocess_adapter_by_handle(struct dxgprocess *process,
 	return adapter;
 }
 
+/*
+ * Gets the device object by a handle of the device or of a device child.
+ * The device object is referenced.
+ * The lookup is done without the handle table lock. The objects, which are
+ * looked up here, are freed after an RCU grace period.
+ */
 struct dxgdevice *dxgprocess_device_by_object_handle(struct dxgprocess *process,
 						     enum hmgrentry_type t,
 						     struct d3dkmthandle handle)
@@ -274,8 +280,9 @@ struct dxgdevice *dxgprocess_device_by_object_handle(struct dxgprocess *process,
 	struct dxgdevice *device = NULL;
 	void *obj;
 
-	hmgrtable_lock(&process->handle_table, DXGLOCK_SHARED);
-	obj = hmgrtable_get_object_by_type(&process->handle_table, t, handle);
+	rcu_read_lock();
+	obj = hmgrtable_get_object_by_type_rcu(&process->handle_table, t,
+					       handle);
 	if (obj) {
 		struct d3dkmthandle device_handle = {};
 
@@ -300,7 +307,7 @@ struct dxgdevice *dxgprocess_device_by_object_handle(struct dxgprocess *process,
 			break;
 		}
 		if (device == NULL)
-			device = hmgrtable_get_object_by_type(
+			device = hmgrtable_get_object_by_type_rcu(
 					&process->handle_table,
 					 HMGRENTRY_TYPE_DXGDEVICE,
 					 device_handle);
@@ -308,9 +315,9 @@ struct dxgdevice *dxgprocess_device_by_object_handle(struct dxgprocess *process,
 			if (kref_get_unless_zero(&device->device_kref) == 0)
 				device = NULL;
 	}
+	rcu_read_unlock();
 	if (device == NULL)
 		pr_err("device_by_handle failed: %d %x\n", t, handle.v);
-	hmgrtable_unlock(&process->handle_table, DXGLOCK_SHARED);
 	return device;
 }
 
@@ -12,6 +12,7 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/bitmap.h>
 #include <linux/completion.h>
 #include <linux/slab.h>
 #include <linux/eventfd.h>
@@ -31,12 +32,18 @@
  * The structure is used to track VM bus packets, waiting for completion.
  */
 struct dxgvmbuspacket {
-	struct list_head packet_list_entry;
 	u64 request_id;
 	struct completion wait;
 	void *buffer;
 	u32 buffer_length;
 	int status;
+/* Entry in dxgvmbusbatch::packet_list_head */
+	struct list_head batch_list_entry;
+/* Where to store the command status when the batch is completed */
+	int *batch_status;
+/* Result buffer for commands, which return only NTSTATUS */
+	struct ntstatus ntstatus;
+	bool ntstatus_result;
 };
 
 struct dxgvmb_ext_header {
@@ -187,23 +194,51 @@ int ntstatus2int(struct ntstatus status)
 	}
 }
 
-int dxgvmbuschannel_init(struct dxgvmbuschannel *ch, struct hv_device *hdev)
+int dxgvmbuschannel_init_packets(struct dxgvmbuschannel *ch)
 {
-	int ret;
-
-	ch->hdev = hdev;
-	spin_lock_init(&ch->packet_list_mutex);
-	INIT_LIST_HEAD(&ch->packet_list_head);
+	init_waitqueue_head(&ch->slot_wait);
 	atomic64_set(&ch->packet_request_id, 0);
 
+	ch->slots = kcalloc(DXGVMBUS_NUM_SLOTS, sizeof(ch->slots[0]),
+			    GFP_KERNEL);
+	ch->slot_bitmap = bitmap_zalloc(DXGVMBUS_NUM_SLOTS, GFP_KERNEL);
+	if (ch->slots == NULL || ch->slot_bitmap == NULL) {
+		pr_err("completion table alloc failed");
+		goto cleanup;
+	}
+
 	ch->packet_cache = kmem_cache_create("DXGK packet cache",
 					     sizeof(struct dxgvmbuspacket), 0,
 					     0, NULL);
 	if (ch->packet_cache == NULL) {
 		pr_err("packet_cache alloc failed");
-		ret = -ENOMEM;
 		goto cleanup;
 	}
+	return 0;
+
+cleanup:
+	dxgvmbuschannel_destroy_packets(ch);
+	return -ENOMEM;
+}
+
+void dxgvmbuschannel_destroy_packets(struct dxgvmbuschannel *ch)
+{
+	kmem_cache_destroy(ch->packet_cache);
+	ch->packet_cache = NULL;
+	bitmap_free(ch->slot_bitmap);
+	ch->slot_bitmap = NULL;
+	kfree(ch->slots);
+	ch->slots = NULL;
+}
+
+int dxgvmbuschannel_init(struct dxgvmbuschannel *ch, struct hv_device *hdev)
+{
+	int ret;
+
+	ch->hdev = hdev;
+	ret = dxgvmbuschannel_init_packets(ch);
+	if (ret)
+		goto cleanup;
 
 	hdev->channel->max_pkt_size = DXG_MAX_VM_BUS_PACKET_SIZE;
 	ret = vmbus_open(hdev->channel, RING_BUFSIZE, RING_BUFSIZE,
@@ -222,13 +257,13 @@ int dxgvmbuschannel_init(struct dxgvmbuschannel *ch, struct hv_device *hdev)
 
 void dxgvmbuschannel_destroy(struct dxgvmbuschannel *ch)
 {
-	kmem_cache_destroy(ch->packet_cache);
-	ch->packet_cache = NULL;
-
+	/* stop the receive callback before freeing the completion table */
 	if (ch->channel) {
 		vmbus_close(ch->channel);
 		ch->channel = NULL;
 	}
+
+	dxgvmbuschannel_destroy_packets(ch);
 }
 
 static inline void command_vm_to_host_init0(struct dxgkvmb_command_vm_to_host
@@ -317,24 +352,85 @@ void process_inband_packet(struct dxgvmbuschannel *channel,
 	}
 }
 
+/*
+ * Finds a free slot in the completion table. The search starts at the slot,
+ * derived from the request sequence number, so concurrent senders usually
+ * do not compete for the same bit.
+ */
+static int dxgvmbuschannel_get_slot(struct dxgvmbuschannel *channel, u64 seq)
+{
+	unsigned long start = seq & (DXGVMBUS_NUM_SLOTS - 1);
+	unsigned long i;
+
+	for (;;) {
+		i = find_next_zero_bit(channel->slot_bitmap,
+				       DXGVMBUS_NUM_SLOTS, start);
+		if (i >= DXGVMBUS_NUM_SLOTS)
+			i = find_first_zero_bit(channel->slot_bitmap,
+						DXGVMBUS_NUM_SLOTS);
+		if (i >= DXGVMBUS_NUM_SLOTS)
+			return -EBUSY;
+		if (!test_and_set_bit_lock(i, channel->slot_bitmap))
+			return i;
+		start = i;
+	}
+}
+
+/*
+ * Publishes the packet in the completion table. The request ID is the
+ * request sequence number, tagged with the slot index.
+ */
+static void dxgvmbuschannel_add_packet(struct dxgvmbuschannel *channel,
+				       struct dxgvmbuspacket *packet)
+{
+	struct dxgvmbusslot *slot;
+	u64 seq;
+	int i;
+
+	seq = atomic64_inc_return(&channel->packet_request_id);
+	wait_event(channel->slot_wait,
+		   (i = dxgvmbuschannel_get_slot(channel, seq)) >= 0);
+
+	slot = &channel->slots[i];
+	packet->request_id = (seq << DXGVMBUS_SLOT_SHIFT) | i;
+	slot->packet = packet;
+	/* Pairs with cmpxchg64() in dxgvmbuschannel_take_packet() */
+	smp_wmb();
+	WRITE_ONCE(slot->request_id, packet->request_id);
+}
+
+/*
+ * Removes the packet with the given request ID from the completion table.
+ * Only one of the receive callback and the sender can succeed, so the packet
+ * is completed at most once. Stale or bogus request IDs do not match the
+ * slot generation and are rejected.
+ */
+static struct dxgvmbuspacket *
+dxgvmbuschannel_take_packet(struct dxgvmbuschannel *channel, u64 request_id)
+{
+	u32 i = request_id & (DXGVMBUS_NUM_SLOTS - 1);
+	struct dxgvmbusslot *slot = &channel->slots[i];
+	struct dxgvmbuspacket *packet;
+
+	if (request_id == 0 ||
+	    cmpxchg64(&slot->request_id, request_id, 0) != request_id)
+		return NULL;
+
+	packet = slot->packet;
+	slot->packet = NULL;
+	clear_bit_unlock(i, channel->slot_bitmap);
+	if (wq_has_sleeper(&channel->slot_wait))
+		wake_up(&channel->slot_wait);
+	return packet;
+}
+
 void process_completion_packet(struct dxgvmbuschannel *channel,
 			       struct vmpacket_descriptor *desc)
 {
-	struct dxgvmbuspacket *packet = NULL;
-	struct dxgvmbuspacket *entry;
+	struct dxgvmbuspacket *packet;
 	u32 packet_length = hv_pkt_datalen(desc);
-	unsigned long flags;
-
-	spin_lock_irqsave(&channel->packet_list_mutex, flags);
-	list_for_each_entry(entry, &channel->packet_list_head,
-			    packet_list_entry) {
-		if (desc->trans_id == entry->request_id) {
-			packet = entry;
-			list_del(&packet->packet_list_entry);
-			break;
-		}
-	}
-	spin_unlock_irqrestore(&channel->packet_list_mutex, flags);
+
+	packet = dxgvmbuschannel_take_packet(channel, desc->trans_id);
 	if (packet) {
 		if (packet->buffer_length) {
 			if (packet_length < packet->buffer_length) {
@@ -376,6 +472,67 @@ void dxgvmbuschannel_receive(void *ctx)
 	}
 }
 
+static int dxgvmbuschannel_send(struct dxgvmbuschannel *channel,
+				void *command, u32 cmd_size,
+				u64 request_id, u32 flags)
+{
+#if IS_ENABLED(CONFIG_DXGKRNL_KUNIT_TEST)
+	if (channel->test_send)
+		return channel->test_send(channel, command, cmd_size,
+					  request_id);
+#endif
+	return vmbus_sendpacket(channel->channel, command, cmd_size,
+				request_id, VM_PKT_DATA_INBAND, flags);
+}
+
+static struct dxgvmbuspacket *
+dxgvmb_alloc_packet(struct dxgvmbuschannel *channel,
+		    void *result, u32 result_size)
+{
+	struct dxgvmbuspacket *packet;
+
+	packet = kmem_cache_alloc(channel->packet_cache, 0);
+	if (packet == NULL) {
+		pr_err("kmem_cache_alloc failed");
+		return NULL;
+	}
+	packet->request_id = 0;
+	init_completion(&packet->wait);
+	packet->buffer = result;
+	packet->buffer_length = result_size;
+	packet->status = 0;
+	packet->batch_status = NULL;
+	packet->ntstatus_result = false;
+	return packet;
+}
+
+/*
+ * Adds the packet to the completion table and sends the command to the
+ * host. The command is copied to the ring buffer, so the command buffer
+ * can be reused as soon as the function returns.
+ */
+static int dxgvmb_post_packet(struct dxgvmbuschannel *channel,
+			      struct dxgvmbuspacket *packet,
+			      void *command, u32 cmd_size)
+{
+	int ret;
+
+	dxgvmbuschannel_add_packet(channel, packet);
+
+	ret = dxgvmbuschannel_send(channel, command, cmd_size,
+				   packet->request_id,
+				   VMBUS_DATA_PACKET_FLAG_COMPLETION_REQUESTED);
+	if (ret) {
+		if (ret != -EAGAIN)
+			pr_err("vmbus_sendpacket failed: %x", ret);
+		/* The host did not see the command, so it cannot complete it */
+		if (dxgvmbuschannel_take_packet(channel,
+						packet->request_id) == NULL)
+			wait_for_completion(&packet->wait);
+	}
+	return ret;
+}
+
 int dxgvmb_send_sync_msg(struct dxgvmbuschannel *channel,
 			 void *command,
 			 u32 cmd_size,
@@ -393,11 +550,9 @@ int dxgvmb_send_sync_msg(struct dxgvmbuschannel *channel,
 		return -EINVAL;
 	}
 
-	packet = kmem_cache_alloc(channel->packet_cache, 0);
-	if (packet == NULL) {
-		pr_err("kmem_cache_alloc failed");
+	packet = dxgvmb_alloc_packet(channel, result, result_size);
+	if (packet == NULL)
 		return -ENOMEM;
-	}
 
 	if (channel->adapter == NULL) {
 		cmd1 = command;
@@ -409,23 +564,11 @@ int dxgvmb_send_sync_msg(struct dxgvmbuschannel *channel,
 			cmd2->command_type, command, cmd_size, result_size);
 	}
 
-	packet->request_id = atomic64_inc_return(&channel->packet_request_id);
-	init_completion(&packet->wait);
-	packet->buffer = result;
-	packet->buffer_length = result_size;
-	packet->status = 0;
-	spin_lock_irq(&channel->packet_list_mutex);
-	list_add_tail(&packet->packet_list_entry, &channel->packet_list_head);
-	spin_unlock_irq(&channel->packet_list_mutex);
-
-	ret = vmbus_sendpacket(channel->channel, command, cmd_size,
-			       packet->request_id, VM_PKT_DATA_INBAND,
-			       VMBUS_DATA_PACKET_FLAG_COMPLETION_REQUESTED);
+	ret = dxgvmb_post_packet(channel, packet, command, cmd_size);
 	if (ret) {
-		pr_err("vmbus_sendpacket failed: %x", ret);
-		spin_lock_irq(&channel->packet_list_mutex);
-		list_del(&packet->packet_list_entry);
-		spin_unlock_irq(&channel->packet_list_mutex);
+		/* A batch retries on a full ring, a synchronous send fails */
+		if (ret == -EAGAIN)
+			pr_err_ratelimited("vmbus_sendpacket failed: %x", ret);
 		goto cleanup;
 	}
 
@@ -443,6 +586,137 @@ int dxgvmb_send_sync_msg(struct dxgvmbuschannel *channel,
 	return ret;
 }
 
+void dxgvmb_batch_init(struct dxgvmbusbatch *batch,
+		       struct dxgvmbuschannel *channel)
+{
+	batch->channel = channel;
+	INIT_LIST_HEAD(&batch->packet_list_head);
+	batch->inflight = 0;
+	batch->status = 0;
+}
+
+/*
+ * Waits for the oldest command in the batch and records its status.
+ */
+static void dxgvmb_batch_wait_one(struct dxgvmbusbatch *batch)
+{
+	struct dxgvmbuspacket *packet;
+	int ret;
+
+	packet = list_first_entry(&batch->packet_list_head,
+				  struct dxgvmbuspacket, batch_list_entry);
+	list_del(&packet->batch_list_entry);
+	batch->inflight--;
+
+	wait_for_completion(&packet->wait);
+	ret = packet->status;
+	if (ret >= 0 && packet->ntstatus_result)
+		ret = ntstatus2int(packet->ntstatus);
+	dev_dbg(dxgglobaldev, "batch completion done: %llu %x",
+		packet->request_id, ret);
+	if (packet->batch_status)
+		*packet->batch_status = ret;
+	if (ret < 0 && batch->status == 0)
+		batch->status = ret;
+	kmem_cache_free(batch->channel->packet_cache, packet);
+}
+
+static int dxgvmb_batch_submit(struct dxgvmbusbatch *batch,
+			       void *command, u32 cmd_size,
+			       void *result, u32 result_size,
+			       bool ntstatus_result, int *status)
+{
+	struct dxgvmbuschannel *channel = batch->channel;
+	struct dxgvmbuspacket *packet;
+	int ret;
+
+	if (status)
+		*status = 0;
+
+	if (cmd_size > DXG_MAX_VM_BUS_PACKET_SIZE ||
+	    result_size > DXG_MAX_VM_BUS_PACKET_SIZE) {
+		pr_err("%s invalid data size", __func__);
+		ret = -EINVAL;
+		goto cleanup;
+	}
+
+	if (batch->inflight >= DXGVMBUSBATCH_MAX_INFLIGHT)
+		dxgvmb_batch_wait_one(batch);
+
+	packet = dxgvmb_alloc_packet(channel, result, result_size);
+	if (packet == NULL) {
+		ret = -ENOMEM;
+		goto cleanup;
+	}
+	if (ntstatus_result) {
+		packet->buffer = &packet->ntstatus;
+		packet->buffer_length = sizeof(packet->ntstatus);
+		packet->ntstatus_result = true;
+	}
+	packet->batch_status = status;
+
+	/*
+	 * When the ring buffer is full, let the host drain the commands,
+	 * which are already submitted, and try again.
+	 */
+	while ((ret = dxgvmb_post_packet(channel, packet, command,
+					 cmd_size)) == -EAGAIN &&
+	       batch->inflight)
+		dxgvmb_batch_wait_one(batch);
+	if (ret) {
+		kmem_cache_free(channel->packet_cache, packet);
+		goto cleanup;
+	}
+
+	list_add_tail(&packet->batch_list_entry, &batch->packet_list_head);
+	batch->inflight++;
+
+cleanup:
+	if (ret) {
+		if (status)
+			*status = ret;
+		if (batch->status == 0)
+			batch->status = ret;
+		dev_dbg(dxgglobaldev, "%s failed: %x", __func__, ret);
+	}
+	return ret;
+}
+
+/*
+ * Submits the command to the host without waiting for its completion.
+ * The result buffer and the status location must stay valid until
+ * dxgvmb_batch_wait() returns.
+ */
+int dxgvmb_batch_add(struct dxgvmbusbatch *batch,
+		     void *command, u32 cmd_size,
+		     void *result, u32 result_size, int *status)
+{
+	return dxgvmb_batch_submit(batch, command, cmd_size,
+				   result, result_size, false, status);
+}
+
+/*
+ * Submits a command, which returns NTSTATUS. The status is converted to
+ * an errno value when the batch is completed.
+ */
+int dxgvmb_batch_add_ntstatus(struct dxgvmbusbatch *batch,
+			      void *command, u32 cmd_size, int *status)
+{
+	return dxgvmb_batch_submit(batch, command, cmd_size,
+				   NULL, 0, true, status);
+}
+
+/*
+ * Waits for all commands in the batch. Returns the first error, reported
+ * for any command in the batch, or 0.
+ */
+int dxgvmb_batch_wait(struct dxgvmbusbatch *batch)
+{
+	while (!list_empty(&batch->packet_list_head))
+		dxgvmb_batch_wait_one(batch);
+	return batch->status;
+}
+
 int dxgvmb_send_async_msg(struct dxgvmbuschannel *channel,
 			  void *command,
 			  u32 cmd_size)
@@ -461,8 +735,7 @@ int dxgvmb_send_async_msg(struct dxgvmbuschannel *channel,
 	}
 
 	do {
-		ret = vmbus_sendpacket(channel->channel, command, cmd_size,
-				0, VM_PKT_DATA_INBAND, 0);
+		ret = dxgvmbuschannel_send(channel, command, cmd_size, 0, 0);
 		/*
 		 * -EAGAIN is returned when the VM bus ring buffer if full.
 		 * Wait 2ms to allow the host to process messages and try again.
@@ -1323,6 +1596,7 @@ int create_existing_sysmem(struct dxgdevice *device,
 	u64 *pfn;
 	u32 pages_to_send;
 	u32 i;
+	struct dxgvmbusbatch batch;
 
 	/*
 	 * Create a guest physical address list and set it as the allocation
@@ -1402,6 +1676,11 @@ int create_existing_sysmem(struct dxgdevice *device,
 		set_pages_command->device = device->handle;
 		set_pages_command->allocation = host_alloc->allocation;
 
+		/*
+		 * The chunks are independent of each other, so they are
+		 * pipelined to the host instead of waiting for each one.
+		 */
+		dxgvmb_batch_init(&batch, msg.channel);
 		page_in = dxgalloc->pages;
 		while (alloc_offset_in_pages < npages) {
 			pfn = (u64 *)((char *)msg.msg +
@@ -1415,15 +1694,15 @@ int create_existing_sysmem(struct dxgdevice *device,
 			for (i = 0; i < pages_to_send; i++)
 				*pfn++ = page_to_pfn(*page_in++);
 
-			ret = dxgvmb_send_sync_msg_ntstatus(msg.channel,
-							    msg.hdr,
-							    msg.size);
-			if (ret < 0) {
-				pr_err("failed to set existing pages: %x", ret);
+			ret = dxgvmb_batch_add_ntstatus(&batch, msg.hdr,
+							msg.size, NULL);
+			if (ret < 0)
 				break;
-			}
 			alloc_offset_in_pages += pages_to_send;
 		}
+		ret = dxgvmb_batch_wait(&batch);
+		if (ret < 0)
+			pr_err("failed to set existing pages: %x", ret);
 	}
 
 cleanup:
@@ -915,5 +915,38 @@ int
 dxgvmb_send_sync_msg(struct dxgvmbuschannel *channel,
 		     void *command, u32 command_size, void *result,
 		     u32 result_size);
+int dxgvmbuschannel_init_packets(struct dxgvmbuschannel *ch);
+void dxgvmbuschannel_destroy_packets(struct dxgvmbuschannel *ch);
+void process_completion_packet(struct dxgvmbuschannel *channel,
+			       struct vmpacket_descriptor *desc);
+
+/* The maximum number of commands of a batch, which the host is processing */
+#define DXGVMBUSBATCH_MAX_INFLIGHT	32
+
+/*
+ * The structure is used to pipeline independent commands to the host.
+ * The commands are sent without waiting for the previous command to
+ * complete and the completions are collected by dxgvmb_batch_wait().
+ *
+ * packet_list_head - list of submitted packets (dxgvmbuspacket), in
+ *	the submission order
+ * inflight - number of packets in packet_list_head
+ * status - the first error, reported for a command in the batch
+ */
+struct dxgvmbusbatch {
+	struct dxgvmbuschannel	*channel;
+	struct list_head	packet_list_head;
+	u32			inflight;
+	int			status;
+};
+
+void dxgvmb_batch_init(struct dxgvmbusbatch *batch,
+		       struct dxgvmbuschannel *channel);
+int dxgvmb_batch_add(struct dxgvmbusbatch *batch,
+		     void *command, u32 command_size,
+		     void *result, u32 result_size, int *status);
+int dxgvmb_batch_add_ntstatus(struct dxgvmbusbatch *batch,
+			      void *command, u32 command_size, int *status);
+int dxgvmb_batch_wait(struct dxgvmbusbatch *batch);
 
 #endif /* _DXGVMBUS_H */
@@ -14,6 +14,9 @@
 #include <linux/kernel.h>
 #include <linux/mutex.h>
 #include <linux/rwsem.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
 
 #include "misc.h"
 #include "dxgkrnl.h"
@@ -50,6 +53,9 @@ const struct d3dkmthandle zerohandle;
 
 /*
  * Handle entry
+ *
+ * The state word is updated with a single store, so lockless readers see
+ * a consistent type, unique and destroyed state.
  */
 struct hmgrentry {
 	union {
@@ -59,19 +65,68 @@ struct hmgrentry {
 			u32 next_free_index;
 		};
 	};
-	u32 type:HMGRENTRY_TYPE_BITS + 1;
-	u32 unique:HMGRHANDLE_UNIQUE_BITS;
-	u32 instance:HMGRHANDLE_INSTANCE_BITS;
-	u32 destroyed:1;
+	union {
+		struct {
+			u32 type:HMGRENTRY_TYPE_BITS + 1;
+			u32 unique:HMGRHANDLE_UNIQUE_BITS;
+			u32 instance:HMGRHANDLE_INSTANCE_BITS;
+			u32 destroyed:1;
+		};
+		u32 state;
+	};
+};
+
+/*
+ * The entries are allocated in chunks of HMGRTABLE_CHUNK_SIZE entries.
+ * A chunk never moves after it is allocated. When the table grows, only
+ * new chunks are allocated and the directory of chunk pointers is replaced
+ * when it is full. The old directory is freed after an RCU grace period.
+ *
+ * num_chunks - number of valid pointers in chunks[]
+ * max_chunks - size of chunks[]
+ */
+struct hmgrdir {
+	struct rcu_head		rcu;
+	u32			num_chunks;
+	u32			max_chunks;
+	struct hmgrentry	*chunks[];
 };
 
-#define HMGRTABLE_SIZE_INCREMENT	1024
+#define HMGRTABLE_CHUNK_SHIFT		10
+#define HMGRTABLE_CHUNK_SIZE		(1 << HMGRTABLE_CHUNK_SHIFT)
+#define HMGRTABLE_CHUNK_MASK		(HMGRTABLE_CHUNK_SIZE - 1)
+
+#define HMGRTABLE_SIZE_INCREMENT	HMGRTABLE_CHUNK_SIZE
 #define HMGRTABLE_MIN_FREE_ENTRIES 128
 #define HMGRTABLE_INVALID_INDEX (~((1 << HMGRHANDLE_INDEX_BITS) - 1))
 #define HMGRTABLE_SIZE_MAX		0xFFFFFFF
 
 static u32 table_size_increment = HMGRTABLE_SIZE_INCREMENT;
 
+static inline struct hmgrdir *get_dir(struct hmgrtable *table)
+{
+	return rcu_dereference_protected(table->dir, true);
+}
+
+/* Returns the entry. The caller holds the table lock. */
+static inline struct hmgrentry *get_entry(struct hmgrtable *table, u32 index)
+{
+	return &get_dir(table)->chunks[index >> HMGRTABLE_CHUNK_SHIFT]
+				      [index & HMGRTABLE_CHUNK_MASK];
+}
+
+static void set_entry_state(struct hmgrentry *entry, u32 type, u32 unique,
+			    u32 instance, bool destroyed)
+{
+	struct hmgrentry tmp = { };
+
+	tmp.type = type;
+	tmp.unique = unique;
+	tmp.instance = instance;
+	tmp.destroyed = destroyed;
+	WRITE_ONCE(entry->state, tmp.state);
+}
+
 static inline u32 get_unique(struct d3dkmthandle h)
 {
 	return (h.v & HMGRHANDLE_UNIQUE_MASK) >> HMGRHANDLE_UNIQUE_SHIFT;
@@ -99,7 +154,7 @@ static bool is_handle_valid(struct hmgrtable *table, struct d3dkmthandle h,
 		return false;
 	}
 
-	entry = &table->entry_table[index];
+	entry = get_entry(table, index);
 	if (unique != entry->unique) {
 		pr_err("%s Invalid unique %x %d %d %d %p",
 			   __func__, h.v, unique, entry->unique,
@@ -147,20 +202,28 @@ inline u32 hmgrtable_get_used_entry_count(struct hmgrtable *table)
 
 bool hmgrtable_mark_destroyed(struct hmgrtable *table, struct d3dkmthandle h)
 {
+	struct hmgrentry *entry;
+
 	if (!is_handle_valid(table, h, false, HMGRENTRY_TYPE_FREE))
 		return false;
 
-	table->entry_table[get_index(h)].destroyed = true;
+	entry = get_entry(table, get_index(h));
+	set_entry_state(entry, entry->type, entry->unique, entry->instance,
+			true);
 	return true;
 }
 
 bool hmgrtable_unmark_destroyed(struct hmgrtable *table, struct d3dkmthandle h)
 {
+	struct hmgrentry *entry;
+
 	if (!is_handle_valid(table, h, true, HMGRENTRY_TYPE_FREE))
 		return true;
 
-	DXGKRNL_ASSERT(table->entry_table[get_index(h)].destroyed);
-	table->entry_table[get_index(h)].destroyed = 0;
+	entry = get_entry(table, get_index(h));
+	DXGKRNL_ASSERT(entry->destroyed);
+	set_entry_state(entry, entry->type, entry->unique, entry->instance,
+			false);
 	return true;
 }
 
@@ -176,24 +239,74 @@ void print_status(struct hmgrtable *table)
 	dev_dbg(dxgglobaldev, "hmgrtable head, tail %p %d %d\n",
 		    table, table->free_handle_list_head,
 		    table->free_handle_list_tail);
-	if (table->entry_table == NULL)
+	if (table->table_size == 0)
 		return;
 	for (i = 0; i < 3; i++) {
-		if (table->entry_table[i].type != HMGRENTRY_TYPE_FREE)
+		struct hmgrentry *entry = get_entry(table, i);
+
+		if (entry->type != HMGRENTRY_TYPE_FREE)
 			dev_dbg(dxgglobaldev, "hmgrtable entry %p %d %p\n",
-				    table, i, table->entry_table[i].object);
+				    table, i, entry->object);
 		else
 			dev_dbg(dxgglobaldev, "hmgrtable entry %p %d %d %d\n",
 				    table, i,
-				    table->entry_table[i].next_free_index,
-				    table->entry_table[i].prev_free_index);
+				    entry->next_free_index,
+				    entry->prev_free_index);
 	}
 }
 
+/*
+ * Allocates the chunks to cover new_table_size entries. The directory is
+ * reallocated when it is full. Lockless readers see either the old or the
+ * new directory, and num_chunks is published after the chunk pointers.
+ */
+static bool add_chunks(struct hmgrtable *table, u32 new_table_size)
+{
+	struct hmgrdir *dir = get_dir(table);
+	struct hmgrdir *new_dir;
+	u32 num_chunks = new_table_size >> HMGRTABLE_CHUNK_SHIFT;
+	u32 max_chunks;
+	u32 i;
+
+	if (dir == NULL || num_chunks > dir->max_chunks) {
+		max_chunks = dir ? dir->max_chunks : 1;
+		while (max_chunks < num_chunks)
+			max_chunks *= 2;
+		new_dir = kzalloc(struct_size(new_dir, chunks, max_chunks),
+				  GFP_KERNEL);
+		if (new_dir == NULL)
+			return false;
+		new_dir->max_chunks = max_chunks;
+		if (dir) {
+			memcpy(new_dir->chunks, dir->chunks,
+			       dir->num_chunks * sizeof(dir->chunks[0]));
+			new_dir->num_chunks = dir->num_chunks;
+		}
+		rcu_assign_pointer(table->dir, new_dir);
+		if (dir)
+			kfree_rcu(dir, rcu);
+		dir = new_dir;
+	}
+
+	for (i = dir->num_chunks; i < num_chunks; i++) {
+		dir->chunks[i] = vzalloc(HMGRTABLE_CHUNK_SIZE *
+					 sizeof(struct hmgrentry));
+		if (dir->chunks[i] == NULL)
+			break;
+	}
+	if (i != num_chunks) {
+		while (i-- > dir->num_chunks) {
+			vfree(dir->chunks[i]);
+			dir->chunks[i] = NULL;
+		}
+		return false;
+	}
+	return true;
+}
+
 static bool expand_table(struct hmgrtable *table, u32 NumEntries)
 {
 	u32 new_table_size;
-	struct hmgrentry *new_entry;
 	u32 table_index;
 	u32 new_free_count;
 	u32 prev_free_index;
@@ -202,7 +315,7 @@ static bool expand_table(struct hmgrtable *table, u32 NumEntries)
 	/* The tail should point to the last free element in the list */
 	if (table->free_count != 0) {
 		if (tail_index >= table->table_size ||
-		    table->entry_table[tail_index].next_free_index !=
+		    get_entry(table, tail_index)->next_free_index !=
 		    HMGRTABLE_INVALID_INDEX) {
 			pr_err("%s:corruption\n", __func__);
 			pr_err("tail_index: %x", tail_index);
@@ -213,34 +326,24 @@ static bool expand_table(struct hmgrtable *table, u32 NumEntries)
 		}
 	}
 
-	new_free_count = table_size_increment + table->free_count;
 	new_table_size = table->table_size + table_size_increment;
-	if (new_table_size < NumEntries) {
-		new_free_count += NumEntries - new_table_size;
+	if (new_table_size < NumEntries)
 		new_table_size = NumEntries;
-	}
+	new_table_size = ALIGN(new_table_size, HMGRTABLE_CHUNK_SIZE);
+	new_free_count = table->free_count + new_table_size - table->table_size;
 
-	if (new_table_size > HMGRHANDLE_INDEX_MAX) {
+	if (new_table_size > HMGRHANDLE_INDEX_MAX + 1) {
 		pr_err("%s:corruption\n", __func__);
 		return false;
 	}
 
-	new_entry = (struct hmgrentry *)
-	    vzalloc(new_table_size * sizeof(struct hmgrentry));
-	if (new_entry == NULL) {
+	if (!add_chunks(table, new_table_size)) {
 		pr_err("%s:allocation failed\n", __func__);
 		return false;
 	}
 
-	if (table->entry_table) {
-		memcpy(new_entry, table->entry_table,
-		       table->table_size * sizeof(struct hmgrentry));
-		vfree(table->entry_table);
-	} else {
+	if (table->table_size == 0)
 		table->free_handle_list_head = 0;
-	}
-
-	table->entry_table = new_entry;
 
 	/* Initialize new table entries and add to the free list */
 	table_index = table->table_size;
@@ -248,32 +351,33 @@ static bool expand_table(struct hmgrtable *table, u32 NumEntries)
 	prev_free_index = table->free_handle_list_tail;
 
 	while (table_index < new_table_size) {
-		struct hmgrentry *entry = &table->entry_table[table_index];
+		struct hmgrentry *entry = get_entry(table, table_index);
 
 		entry->prev_free_index = prev_free_index;
 		entry->next_free_index = table_index + 1;
-		entry->type = HMGRENTRY_TYPE_FREE;
-		entry->unique = 1;
-		entry->instance = 0;
+		set_entry_state(entry, HMGRENTRY_TYPE_FREE, 1, 0, false);
 		prev_free_index = table_index;
 
 		table_index++;
 	}
 
-	table->entry_table[table_index - 1].next_free_index =
+	get_entry(table, table_index - 1)->next_free_index =
 	    (u32) HMGRTABLE_INVALID_INDEX;
 
 	if (table->free_count != 0) {
 		/* Link the current free list with the new entries */
 		struct hmgrentry *entry;
 
-		entry = &table->entry_table[table->free_handle_list_tail];
+		entry = get_entry(table, table->free_handle_list_tail);
 		entry->next_free_index = table->table_size;
 	}
 	table->free_handle_list_tail = new_table_size - 1;
 	if (table->free_handle_list_head == HMGRTABLE_INVALID_INDEX)
 		table->free_handle_list_head = table->table_size;
 
+	/* Publish the new chunks to lockless readers */
+	smp_store_release(&get_dir(table)->num_chunks,
+			  new_table_size >> HMGRTABLE_CHUNK_SHIFT);
 	table->table_size = new_table_size;
 	table->free_count = new_free_count;
 
@@ -283,7 +387,7 @@ static bool expand_table(struct hmgrtable *table, u32 NumEntries)
 void hmgrtable_init(struct hmgrtable *table, struct dxgprocess *process)
 {
 	table->process = process;
-	table->entry_table = NULL;
+	RCU_INIT_POINTER(table->dir, NULL);
 	table->table_size = 0;
 	table->free_handle_list_head = HMGRTABLE_INVALID_INDEX;
 	table->free_handle_list_tail = HMGRTABLE_INVALID_INDEX;
@@ -291,12 +395,30 @@ void hmgrtable_init(struct hmgrtable *table, struct dxgprocess *process)
 	init_rwsem(&table->table_lock);
 }
 
+/*
+ * A lockless reader may still walk the directory into a chunk, so the
+ * chunks go away together with the directory, after a grace period.
+ */
+static void hmgrdir_free_rcu(struct rcu_head *rcu)
+{
+	struct hmgrdir *dir = container_of(rcu, struct hmgrdir, rcu);
+	u32 i;
+
+	for (i = 0; i < dir->num_chunks; i++)
+		vfree(dir->chunks[i]);
+	kfree(dir);
+}
+
 void hmgrtable_destroy(struct hmgrtable *table)
 {
-	if (table->entry_table) {
-		vfree(table->entry_table);
-		table->entry_table = NULL;
+	struct hmgrdir *dir = get_dir(table);
+
+	if (dir) {
+		RCU_INIT_POINTER(table->dir, NULL);
+		call_rcu(&dir->rcu, hmgrdir_free_rcu);
 	}
+	table->table_size = 0;
+	table->free_count = 0;
 }
 
 void hmgrtable_lock(struct hmgrtable *table, enum dxglockstate state)
@@ -340,7 +462,7 @@ struct d3dkmthandle hmgrtable_alloc_handle(struct hmgrtable *table,
 	}
 
 	index = table->free_handle_list_head;
-	entry = &table->entry_table[index];
+	entry = get_entry(table, index);
 
 	if (entry->type != HMGRENTRY_TYPE_FREE) {
 		pr_err("hmgrtable expected free handle\n");
@@ -354,20 +476,20 @@ struct d3dkmthandle hmgrtable_alloc_handle(struct hmgrtable *table,
 			pr_err("hmgrtable invalid next free index\n");
 			return zerohandle;
 		}
-		table->entry_table[entry->next_free_index].prev_free_index =
+		get_entry(table, entry->next_free_index)->prev_free_index =
 		    HMGRTABLE_INVALID_INDEX;
 	}
 
-	unique = table->entry_table[index].unique;
+	unique = entry->unique;
 
-	table->entry_table[index].object = object;
-	table->entry_table[index].type = type;
-	table->entry_table[index].instance = 0;
-	table->entry_table[index].destroyed = !make_valid;
+	entry->object = object;
+	/* The object must be visible before the entry becomes valid */
+	smp_wmb();
+	set_entry_state(entry, type, unique, 0, !make_valid);
 	table->free_count--;
 	DXGKRNL_ASSERT(table->free_count <= table->table_size);
 
-	return build_handle(index, unique, table->entry_table[index].instance);
+	return build_handle(index, unique, entry->instance);
 }
 
 int hmgrtable_assign_handle_safe(struct hmgrtable *table,
@@ -409,7 +531,7 @@ int hmgrtable_assign_handle(struct hmgrtable *table, void *object,
 		}
 	}
 
-	entry = &table->entry_table[index];
+	entry = get_entry(table, index);
 
 	if (entry->type != HMGRENTRY_TYPE_FREE) {
 		pr_err("the entry is already busy: %d %x",
@@ -424,7 +546,7 @@ int hmgrtable_assign_handle(struct hmgrtable *table, void *object,
 				   entry->next_free_index);
 			return -EINVAL;
 		}
-		table->entry_table[entry->next_free_index].prev_free_index =
+		get_entry(table, entry->next_free_index)->prev_free_index =
 		    entry->prev_free_index;
 	} else {
 		table->free_handle_list_tail = entry->prev_free_index;
@@ -436,19 +558,15 @@ int hmgrtable_assign_handle(struct hmgrtable *table, void *object,
 				   entry->prev_free_index);
 			return -EINVAL;
 		}
-		table->entry_table[entry->prev_free_index].next_free_index =
+		get_entry(table, entry->prev_free_index)->next_free_index =
 		    entry->next_free_index;
 	} else {
 		table->free_handle_list_head = entry->next_free_index;
 	}
 
-	entry->prev_free_index = HMGRTABLE_INVALID_INDEX;
-	entry->next_free_index = HMGRTABLE_INVALID_INDEX;
 	entry->object = object;
-	entry->type = type;
-	entry->instance = 0;
-	entry->unique = unique;
-	entry->destroyed = false;
+	smp_wmb();
+	set_entry_state(entry, type, unique, 0, false);
 
 	table->free_count--;
 	DXGKRNL_ASSERT(table->free_count <= table->table_size);
@@ -479,14 +597,15 @@ void hmgrtable_free_handle(struct hmgrtable *table, enum hmgrentry_type t,
 	/* Ignore the destroyed flag when checking the handle */
 	if (is_handle_valid(table, h, true, t)) {
 		DXGKRNL_ASSERT(table->free_count < table->table_size);
-		entry = &table->entry_table[i];
-		entry->unique = 1;
-		entry->type = HMGRENTRY_TYPE_FREE;
-		entry->destroyed = 0;
-		if (entry->unique != HMGRHANDLE_UNIQUE_MAX)
-			entry->unique += 1;
-		else
-			entry->unique = 1;
+		entry = get_entry(table, i);
+		set_entry_state(entry, HMGRENTRY_TYPE_FREE,
+				entry->unique != HMGRHANDLE_UNIQUE_MAX ?
+				entry->unique + 1 : 1, 0, false);
+		/*
+		 * The free list links overlap the object pointer. Lockless
+		 * readers must see the free state before the links.
+		 */
+		smp_wmb();
 
 		table->free_count++;
 		DXGKRNL_ASSERT(table->free_count <= table->table_size);
@@ -496,7 +615,7 @@ void hmgrtable_free_handle(struct hmgrtable *table, enum hmgrentry_type t,
 		 */
 		entry->next_free_index = HMGRTABLE_INVALID_INDEX;
 		entry->prev_free_index = table->free_handle_list_tail;
-		entry = &table->entry_table[table->free_handle_list_tail];
+		entry = get_entry(table, table->free_handle_list_tail);
 		entry->next_free_index = i;
 		table->free_handle_list_tail = i;
 	} else {
@@ -515,10 +634,12 @@ void hmgrtable_free_handle_safe(struct hmgrtable *table, enum hmgrentry_type t,
 struct d3dkmthandle hmgrtable_build_entry_handle(struct hmgrtable *table,
 						 u32 index)
 {
+	struct hmgrentry *entry;
+
 	DXGKRNL_ASSERT(index < table->table_size);
 
-	return build_handle(index, table->entry_table[index].unique,
-			    table->entry_table[index].instance);
+	entry = get_entry(table, index);
+	return build_handle(index, entry->unique, entry->instance);
 }
 
 void *hmgrtable_get_object(struct hmgrtable *table, struct d3dkmthandle h)
@@ -526,7 +647,7 @@ void *hmgrtable_get_object(struct hmgrtable *table, struct d3dkmthandle h)
 	if (!is_handle_valid(table, h, false, HMGRENTRY_TYPE_FREE))
 		return NULL;
 
-	return table->entry_table[get_index(h)].object;
+	return get_entry(table, get_index(h))->object;
 }
 
 void *hmgrtable_get_object_by_type(struct hmgrtable *table,
@@ -537,22 +658,61 @@ void *hmgrtable_get_object_by_type(struct hmgrtable *table,
 		pr_err("%s invalid handle %x\n", __func__, h.v);
 		return NULL;
 	}
-	return table->entry_table[get_index(h)].object;
+	return get_entry(table, get_index(h))->object;
+}
+
+/*
+ * Looks up the object without the table lock. The caller must hold
+ * rcu_read_lock() and the object memory must be freed after an RCU grace
+ * period. The object is not referenced, so the caller should use
+ * kref_get_unless_zero() before leaving the RCU read side section.
+ */
+void *hmgrtable_get_object_by_type_rcu(struct hmgrtable *table,
+				       enum hmgrentry_type type,
+				       struct d3dkmthandle h)
+{
+	u32 index = get_index(h);
+	struct hmgrdir *dir;
+	struct hmgrentry *entry;
+	struct hmgrentry snapshot;
+	void *object;
+
+	dir = rcu_dereference(table->dir);
+	if (dir == NULL ||
+	    index >= smp_load_acquire(&dir->num_chunks) <<
+		     HMGRTABLE_CHUNK_SHIFT)
+		return NULL;
+
+	entry = &dir->chunks[index >> HMGRTABLE_CHUNK_SHIFT]
+			    [index & HMGRTABLE_CHUNK_MASK];
+	do {
+		snapshot.state = READ_ONCE(entry->state);
+		smp_rmb();
+		object = READ_ONCE(entry->object);
+		smp_rmb();
+	} while (READ_ONCE(entry->state) != snapshot.state);
+
+	if (snapshot.type == HMGRENTRY_TYPE_FREE ||
+	    snapshot.type != type ||
+	    snapshot.unique != get_unique(h) ||
+	    snapshot.destroyed)
+		return NULL;
+	return object;
 }
 
 void *hmgrtable_get_entry_object(struct hmgrtable *table, u32 index)
 {
 	DXGKRNL_ASSERT(index < table->table_size);
-	DXGKRNL_ASSERT(table->entry_table[index].type != HMGRENTRY_TYPE_FREE);
+	DXGKRNL_ASSERT(get_entry(table, index)->type != HMGRENTRY_TYPE_FREE);
 
-	return table->entry_table[index].object;
+	return get_entry(table, index)->object;
 }
 
 enum hmgrentry_type hmgrtable_get_entry_type(struct hmgrtable *table,
 					     u32 index)
 {
 	DXGKRNL_ASSERT(index < table->table_size);
-	return (enum hmgrentry_type)table->entry_table[index].type;
+	return (enum hmgrentry_type)get_entry(table, index)->type;
 }
 
 enum hmgrentry_type hmgrtable_get_object_type(struct hmgrtable *table,
@@ -570,7 +730,7 @@ void *hmgrtable_get_object_ignore_destroyed(struct hmgrtable *table,
 {
 	if (!is_handle_valid(table, h, true, type))
 		return NULL;
-	return table->entry_table[get_index(h)].object;
+	return get_entry(table, get_index(h))->object;
 }
 
 bool hmgrtable_next_entry(struct hmgrtable *tbl,
@@ -583,7 +743,7 @@ bool hmgrtable_next_entry(struct hmgrtable *tbl,
 	struct hmgrentry *entry;
 
 	for (i = *index; i < tbl->table_size; i++) {
-		entry = &tbl->entry_table[i];
+		entry = get_entry(tbl, i);
 		if (entry->type != HMGRENTRY_TYPE_FREE) {
 			*index = i + 1;
 			*object = entry->object;
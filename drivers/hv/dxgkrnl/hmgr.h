@@ -17,6 +17,7 @@
 #include "misc.h"
 
 struct hmgrentry;
+struct hmgrdir;
 
 /*
  * Handle manager table.
@@ -31,10 +32,15 @@ struct hmgrentry;
  *   Handles are allocated from the start of the list and free handles are
  *   inserted after the tail of the list.
  *
+ *   The entries are stored in fixed size chunks, referenced by dir, so
+ *   entries do not move when the table grows. Modifications require
+ *   table_lock held exclusively. hmgrtable_get_object_by_type_rcu() can
+ *   be used under rcu_read_lock() without the table lock.
+ *
  */
 struct hmgrtable {
 	struct dxgprocess	*process;
-	struct hmgrentry	*entry_table;
+	struct hmgrdir __rcu	*dir;
 	u32			free_handle_list_head;
 	u32			free_handle_list_tail;
 	u32			table_size;
@@ -97,6 +103,9 @@ enum hmgrentry_type hmgrtable_get_object_type(struct hmgrtable *tbl,
 void *hmgrtable_get_object(struct hmgrtable *tbl, struct d3dkmthandle h);
 void *hmgrtable_get_object_by_type(struct hmgrtable *tbl, enum hmgrentry_type t,
 				   struct d3dkmthandle h);
+void *hmgrtable_get_object_by_type_rcu(struct hmgrtable *tbl,
+				       enum hmgrentry_type t,
+				       struct d3dkmthandle h);
 void *hmgrtable_get_object_ignore_destroyed(struct hmgrtable *tbl,
 					    struct d3dkmthandle h,
 					    enum hmgrentry_type t);
@@ -0,0 +1,511 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * Copyright (c) 2019, Microsoft Corporation.
+ *
+ * Dxgkrnl Graphics Driver
+ * KUnit tests
+ *
+ */
+
+#include <kunit/test.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/bitmap.h>
+#include <linux/rcupdate.h>
+#include "dxgkrnl.h"
+#include "dxgvmbus.h"
+
+/*
+ * A fake host, which replaces the VM bus channel. Every command is a
+ * struct test_command. The host acknowledges a command by returning
+ * struct test_reply with the NTSTATUS, which is passed in the command.
+ */
+struct test_command {
+	u32			index;
+	struct ntstatus		status;
+};
+
+struct test_reply {
+	struct ntstatus		status;
+	u32			index;
+};
+
+struct test_host {
+	struct dxgvmbuschannel	channel;
+	/* Commands are completed from the send callback */
+	bool			ack_immediately;
+	/* -EAGAIN is returned when this number of commands is pending */
+	u32			ring_capacity;
+	u32			num_received;
+	u32			num_pending;
+	u32			max_pending;
+	/* The size of request_id and command arrays */
+	u32			capacity;
+	u64			*request_id;
+	struct test_command	*command;
+};
+
+static void test_host_complete(struct test_host *host, u64 request_id,
+			       const struct test_command *cmd)
+{
+	struct {
+		struct vmpacket_descriptor desc;
+		struct test_reply reply;
+	} pkt = { };
+
+	pkt.reply.status = cmd->status;
+	pkt.reply.index = cmd->index;
+	pkt.desc.type = VM_PKT_COMP;
+	pkt.desc.offset8 = sizeof(pkt.desc) >> 3;
+	pkt.desc.len8 = sizeof(pkt) >> 3;
+	pkt.desc.trans_id = request_id;
+	process_completion_packet(&host->channel, &pkt.desc);
+}
+
+static void test_host_ack(struct test_host *host, u32 i)
+{
+	test_host_complete(host, host->request_id[i], &host->command[i]);
+}
+
+/* Completes the oldest pending command */
+static void test_host_ack_oldest(struct test_host *host)
+{
+	struct test_command cmd = host->command[0];
+	u64 request_id = host->request_id[0];
+
+	host->num_pending--;
+	memmove(&host->command[0], &host->command[1],
+		host->num_pending * sizeof(host->command[0]));
+	memmove(&host->request_id[0], &host->request_id[1],
+		host->num_pending * sizeof(host->request_id[0]));
+	test_host_complete(host, request_id, &cmd);
+}
+
+static int test_host_send(struct dxgvmbuschannel *ch, void *command,
+			  u32 command_size, u64 request_id)
+{
+	struct test_host *host = container_of(ch, struct test_host, channel);
+	u32 i;
+
+	if (command_size != sizeof(struct test_command))
+		return -EINVAL;
+	if (host->ring_capacity && host->num_pending >= host->ring_capacity) {
+		/* The host drains one command while the guest backs off */
+		test_host_ack_oldest(host);
+		return -EAGAIN;
+	}
+	if (host->num_pending >= host->capacity)
+		return -EAGAIN;
+
+	i = host->num_pending++;
+	host->num_received++;
+	host->command[i] = *(struct test_command *)command;
+	host->request_id[i] = request_id;
+	host->max_pending = max(host->max_pending, host->num_pending);
+	if (host->ack_immediately) {
+		test_host_ack(host, i);
+		host->num_pending--;
+	}
+	return 0;
+}
+
+static struct test_host *test_host_create(struct kunit *test, u32 capacity)
+{
+	struct test_host *host;
+
+	host = kunit_kzalloc(test, sizeof(*host), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, host);
+	host->capacity = capacity;
+	host->request_id = kunit_kcalloc(test, capacity,
+					 sizeof(host->request_id[0]),
+					 GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, host->request_id);
+	host->command = kunit_kcalloc(test, capacity, sizeof(host->command[0]),
+				      GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, host->command);
+
+	KUNIT_ASSERT_EQ(test, dxgvmbuschannel_init_packets(&host->channel), 0);
+	host->channel.test_send = test_host_send;
+	return host;
+}
+
+static void test_host_destroy(struct kunit *test, struct test_host *host)
+{
+	/* All slots of the completion table are released */
+	KUNIT_EXPECT_TRUE(test, bitmap_empty(host->channel.slot_bitmap,
+					     DXGVMBUS_NUM_SLOTS));
+	dxgvmbuschannel_destroy_packets(&host->channel);
+}
+
+static void dxgk_test_batch_ordering(struct kunit *test)
+{
+	struct test_host *host = test_host_create(test, 128);
+	struct dxgvmbusbatch batch;
+	struct test_command cmd = { };
+	int status[8];
+	int i;
+
+	dxgvmb_batch_init(&batch, &host->channel);
+	for (i = 0; i < ARRAY_SIZE(status); i++) {
+		cmd.index = i;
+		KUNIT_EXPECT_EQ(test, dxgvmb_batch_add_ntstatus(&batch, &cmd,
+					sizeof(cmd), &status[i]), 0);
+	}
+
+	/* All commands reach the host before any of them is completed */
+	KUNIT_EXPECT_EQ(test, host->num_pending, (u32)ARRAY_SIZE(status));
+	for (i = 0; i < ARRAY_SIZE(status); i++) {
+		KUNIT_EXPECT_EQ(test, host->command[i].index, (u32)i);
+		if (i)
+			KUNIT_EXPECT_GT(test, host->request_id[i],
+					host->request_id[i - 1]);
+	}
+
+	/* The host is free to complete the commands in any order */
+	for (i = ARRAY_SIZE(status) - 1; i >= 0; i--)
+		test_host_ack(host, i);
+	host->num_pending = 0;
+
+	KUNIT_EXPECT_EQ(test, dxgvmb_batch_wait(&batch), 0);
+	for (i = 0; i < ARRAY_SIZE(status); i++)
+		KUNIT_EXPECT_EQ(test, status[i], 0);
+	test_host_destroy(test, host);
+}
+
+static void dxgk_test_batch_status(struct kunit *test)
+{
+	struct test_host *host = test_host_create(test, 128);
+	struct dxgvmbusbatch batch;
+	struct test_command cmd = { };
+	struct test_reply result[8];
+	int status[8];
+	int i;
+
+	host->ack_immediately = true;
+	dxgvmb_batch_init(&batch, &host->channel);
+	for (i = 0; i < ARRAY_SIZE(status); i++) {
+		cmd.index = i;
+		cmd.status.v = (i & 1) ? STATUS_INVALID_PARAMETER :
+					 STATUS_SUCCESS;
+		if (i < ARRAY_SIZE(status) / 2)
+			dxgvmb_batch_add_ntstatus(&batch, &cmd, sizeof(cmd),
+						  &status[i]);
+		else
+			dxgvmb_batch_add(&batch, &cmd, sizeof(cmd),
+					 &result[i], sizeof(result[i]),
+					 &status[i]);
+	}
+	KUNIT_EXPECT_EQ(test, dxgvmb_batch_wait(&batch), -EINVAL);
+
+	for (i = 0; i < ARRAY_SIZE(status) / 2; i++)
+		KUNIT_EXPECT_EQ(test, status[i], (i & 1) ? -EINVAL : 0);
+	/* Raw results are returned to the caller without translation */
+	for (; i < ARRAY_SIZE(status); i++) {
+		KUNIT_EXPECT_EQ(test, status[i], 0);
+		KUNIT_EXPECT_EQ(test, result[i].status.v,
+				(i & 1) ? STATUS_INVALID_PARAMETER :
+					  STATUS_SUCCESS);
+		KUNIT_EXPECT_EQ(test, result[i].index, (u32)i);
+	}
+	test_host_destroy(test, host);
+}
+
+static void dxgk_test_batch_inflight_limit(struct kunit *test)
+{
+	struct test_host *host = test_host_create(test, 128);
+	struct dxgvmbusbatch batch;
+	struct test_command cmd = { };
+	int count = 3 * DXGVMBUSBATCH_MAX_INFLIGHT;
+	int i;
+
+	host->ack_immediately = true;
+	dxgvmb_batch_init(&batch, &host->channel);
+	for (i = 0; i < count; i++) {
+		cmd.index = i;
+		KUNIT_EXPECT_EQ(test, dxgvmb_batch_add_ntstatus(&batch, &cmd,
+					sizeof(cmd), NULL), 0);
+		KUNIT_EXPECT_LE(test, batch.inflight,
+				(u32)DXGVMBUSBATCH_MAX_INFLIGHT);
+	}
+	KUNIT_EXPECT_EQ(test, dxgvmb_batch_wait(&batch), 0);
+	KUNIT_EXPECT_EQ(test, host->num_received, (u32)count);
+	KUNIT_EXPECT_EQ(test, batch.inflight, 0U);
+	test_host_destroy(test, host);
+}
+
+static void dxgk_test_batch_ring_full(struct kunit *test)
+{
+	struct test_host *host = test_host_create(test, 128);
+	struct dxgvmbusbatch batch;
+	struct test_command cmd = { };
+	int status[16];
+	int i;
+
+	host->ring_capacity = 4;
+	dxgvmb_batch_init(&batch, &host->channel);
+	for (i = 0; i < ARRAY_SIZE(status); i++) {
+		cmd.index = i;
+		KUNIT_EXPECT_EQ(test, dxgvmb_batch_add_ntstatus(&batch, &cmd,
+					sizeof(cmd), &status[i]), 0);
+	}
+	KUNIT_EXPECT_EQ(test, host->max_pending, 4U);
+	while (host->num_pending)
+		test_host_ack_oldest(host);
+	KUNIT_EXPECT_EQ(test, dxgvmb_batch_wait(&batch), 0);
+	KUNIT_EXPECT_EQ(test, host->num_received, (u32)ARRAY_SIZE(status));
+	for (i = 0; i < ARRAY_SIZE(status); i++)
+		KUNIT_EXPECT_EQ(test, status[i], 0);
+	test_host_destroy(test, host);
+}
+
+static void dxgk_test_completion_stale(struct kunit *test)
+{
+	struct test_host *host = test_host_create(test, 128);
+	struct dxgvmbusbatch batch;
+	struct test_command cmd = { };
+	u64 request_id;
+	int status;
+
+	dxgvmb_batch_init(&batch, &host->channel);
+	KUNIT_EXPECT_EQ(test, dxgvmb_batch_add_ntstatus(&batch, &cmd,
+				sizeof(cmd), &status), 0);
+	KUNIT_ASSERT_EQ(test, host->num_pending, 1U);
+	request_id = host->request_id[0];
+
+	/* The same slot with a different generation does not match */
+	test_host_complete(host, request_id + DXGVMBUS_NUM_SLOTS, &cmd);
+	test_host_complete(host, 0, &cmd);
+	KUNIT_EXPECT_EQ(test, bitmap_weight(host->channel.slot_bitmap,
+					    DXGVMBUS_NUM_SLOTS), 1);
+
+	test_host_complete(host, request_id, &cmd);
+	/* The second completion of the same request is ignored */
+	test_host_complete(host, request_id, &cmd);
+	host->num_pending = 0;
+	KUNIT_EXPECT_EQ(test, dxgvmb_batch_wait(&batch), 0);
+	test_host_destroy(test, host);
+}
+
+/*
+ * Fills the whole completion table and measures the rate at which
+ * the receive callback completes the outstanding requests.
+ */
+static void dxgk_test_completion_throughput(struct kunit *test)
+{
+	const u32 num_batches = DXGVMBUS_NUM_SLOTS / DXGVMBUSBATCH_MAX_INFLIGHT;
+	const u32 count = num_batches * DXGVMBUSBATCH_MAX_INFLIGHT;
+	struct test_host *host = test_host_create(test, count);
+	struct dxgvmbusbatch *batch;
+	struct test_command cmd = { };
+	u64 start, elapsed;
+	u32 i;
+
+	batch = kunit_kcalloc(test, num_batches, sizeof(*batch), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, batch);
+
+	for (i = 0; i < num_batches; i++)
+		dxgvmb_batch_init(&batch[i], &host->channel);
+	for (i = 0; i < count; i++) {
+		cmd.index = i;
+		KUNIT_ASSERT_EQ(test, dxgvmb_batch_add_ntstatus(
+				&batch[i / DXGVMBUSBATCH_MAX_INFLIGHT],
+				&cmd, sizeof(cmd), NULL), 0);
+	}
+	KUNIT_ASSERT_EQ(test, host->num_pending, count);
+	KUNIT_EXPECT_EQ(test, bitmap_weight(host->channel.slot_bitmap,
+					    DXGVMBUS_NUM_SLOTS), (int)count);
+
+	/* Complete in the reverse order, the worst case for a list */
+	start = ktime_get_ns();
+	for (i = count; i > 0; i--)
+		test_host_ack(host, i - 1);
+	elapsed = ktime_get_ns() - start;
+	host->num_pending = 0;
+
+	kunit_info(test, "%u completions in %llu ns (%llu ns each)\n",
+		   count, elapsed, div_u64(elapsed, count));
+
+	for (i = 0; i < num_batches; i++)
+		KUNIT_EXPECT_EQ(test, dxgvmb_batch_wait(&batch[i]), 0);
+	test_host_destroy(test, host);
+}
+
+static struct kunit_case dxgk_vmbus_test_cases[] = {
+	KUNIT_CASE(dxgk_test_batch_ordering),
+	KUNIT_CASE(dxgk_test_batch_status),
+	KUNIT_CASE(dxgk_test_batch_inflight_limit),
+	KUNIT_CASE(dxgk_test_batch_ring_full),
+	KUNIT_CASE(dxgk_test_completion_stale),
+	KUNIT_CASE(dxgk_test_completion_throughput),
+	{ }
+};
+
+static struct kunit_suite dxgk_vmbus_test_suite = {
+	.name = "dxgkrnl-vmbus",
+	.test_cases = dxgk_vmbus_test_cases,
+};
+
+#define TEST_HMGR_COUNT		16384
+
+static void *test_hmgr_object(u32 i)
+{
+	return (void *)(unsigned long)((i + 1) * sizeof(u64));
+}
+
+static void dxgk_test_hmgr_grow(struct kunit *test)
+{
+	u32 count = 3 * 1024 + 5;
+	struct hmgrtable table;
+	struct d3dkmthandle *h;
+	u32 i;
+
+	h = kunit_kcalloc(test, count, sizeof(*h), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, h);
+
+	hmgrtable_init(&table, NULL);
+	hmgrtable_lock(&table, DXGLOCK_EXCL);
+	for (i = 0; i < count; i++) {
+		h[i] = hmgrtable_alloc_handle(&table, test_hmgr_object(i),
+					      HMGRENTRY_TYPE_DXGDEVICE, true);
+		KUNIT_ASSERT_NE(test, h[i].v, 0U);
+	}
+	hmgrtable_unlock(&table, DXGLOCK_EXCL);
+
+	/* Entries allocated before the table grew are still found */
+	rcu_read_lock();
+	for (i = 0; i < count; i++) {
+		KUNIT_EXPECT_PTR_EQ(test, test_hmgr_object(i),
+			hmgrtable_get_object_by_type_rcu(&table,
+					HMGRENTRY_TYPE_DXGDEVICE, h[i]));
+		KUNIT_EXPECT_PTR_EQ(test, (void *)NULL,
+			hmgrtable_get_object_by_type_rcu(&table,
+					HMGRENTRY_TYPE_DXGCONTEXT, h[i]));
+	}
+	rcu_read_unlock();
+
+	hmgrtable_lock(&table, DXGLOCK_EXCL);
+	for (i = 0; i < count; i += 2)
+		hmgrtable_free_handle(&table, HMGRENTRY_TYPE_DXGDEVICE, h[i]);
+	hmgrtable_unlock(&table, DXGLOCK_EXCL);
+
+	rcu_read_lock();
+	for (i = 0; i < count; i++) {
+		void *obj = hmgrtable_get_object_by_type_rcu(&table,
+					HMGRENTRY_TYPE_DXGDEVICE, h[i]);
+
+		if (i & 1)
+			KUNIT_EXPECT_PTR_EQ(test, test_hmgr_object(i), obj);
+		else
+			KUNIT_EXPECT_PTR_EQ(test, (void *)NULL, obj);
+	}
+	rcu_read_unlock();
+
+	hmgrtable_destroy(&table);
+}
+
+static void dxgk_test_hmgr_assign(struct kunit *test)
+{
+	struct hmgrtable table;
+	struct d3dkmthandle h;
+	u32 index = 100000;
+
+	/* Host handles: index in bits 6..29 and unique in bits 30..31 */
+	h.v = (index << 6) | (1U << 30);
+
+	hmgrtable_init(&table, NULL);
+	hmgrtable_lock(&table, DXGLOCK_EXCL);
+	KUNIT_EXPECT_EQ(test, hmgrtable_assign_handle(&table,
+			test_hmgr_object(index), HMGRENTRY_TYPE_DXGALLOCATION,
+			h), 0);
+	KUNIT_EXPECT_PTR_EQ(test, test_hmgr_object(index),
+			    hmgrtable_get_object_by_type(&table,
+					HMGRENTRY_TYPE_DXGALLOCATION, h));
+	hmgrtable_unlock(&table, DXGLOCK_EXCL);
+
+	rcu_read_lock();
+	KUNIT_EXPECT_PTR_EQ(test, test_hmgr_object(index),
+			    hmgrtable_get_object_by_type_rcu(&table,
+					HMGRENTRY_TYPE_DXGALLOCATION, h));
+	rcu_read_unlock();
+
+	hmgrtable_lock(&table, DXGLOCK_EXCL);
+	KUNIT_EXPECT_TRUE(test, hmgrtable_mark_destroyed(&table, h));
+	hmgrtable_unlock(&table, DXGLOCK_EXCL);
+
+	/* Destroyed objects are not returned by lookups */
+	rcu_read_lock();
+	KUNIT_EXPECT_PTR_EQ(test, (void *)NULL,
+			    hmgrtable_get_object_by_type_rcu(&table,
+					HMGRENTRY_TYPE_DXGALLOCATION, h));
+	rcu_read_unlock();
+
+	hmgrtable_destroy(&table);
+}
+
+/*
+ * Measures the alloc, lookup and free rate of the handle table.
+ */
+static void dxgk_test_hmgr_benchmark(struct kunit *test)
+{
+	struct hmgrtable table;
+	struct d3dkmthandle *h;
+	u64 start, alloc_ns, lookup_ns, locked_lookup_ns, free_ns;
+	u32 i;
+
+	h = kunit_kcalloc(test, TEST_HMGR_COUNT, sizeof(*h), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, h);
+	hmgrtable_init(&table, NULL);
+
+	start = ktime_get_ns();
+	for (i = 0; i < TEST_HMGR_COUNT; i++)
+		h[i] = hmgrtable_alloc_handle_safe(&table, test_hmgr_object(i),
+						   HMGRENTRY_TYPE_DXGCONTEXT,
+						   true);
+	alloc_ns = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < TEST_HMGR_COUNT; i++) {
+		rcu_read_lock();
+		if (!hmgrtable_get_object_by_type_rcu(&table,
+					HMGRENTRY_TYPE_DXGCONTEXT, h[i]))
+			KUNIT_FAIL(test, "lookup failed %x", h[i].v);
+		rcu_read_unlock();
+	}
+	lookup_ns = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < TEST_HMGR_COUNT; i++) {
+		hmgrtable_lock(&table, DXGLOCK_SHARED);
+		if (!hmgrtable_get_object_by_type(&table,
+					HMGRENTRY_TYPE_DXGCONTEXT, h[i]))
+			KUNIT_FAIL(test, "lookup failed %x", h[i].v);
+		hmgrtable_unlock(&table, DXGLOCK_SHARED);
+	}
+	locked_lookup_ns = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < TEST_HMGR_COUNT; i++)
+		hmgrtable_free_handle_safe(&table, HMGRENTRY_TYPE_DXGCONTEXT,
+					   h[i]);
+	free_ns = ktime_get_ns() - start;
+
+	kunit_info(test, "%u handles: alloc %llu ns, lookup %llu ns, locked lookup %llu ns, free %llu ns\n",
+		   TEST_HMGR_COUNT, alloc_ns, lookup_ns, locked_lookup_ns,
+		   free_ns);
+	hmgrtable_destroy(&table);
+}
+
+static struct kunit_case dxgk_hmgr_test_cases[] = {
+	KUNIT_CASE(dxgk_test_hmgr_grow),
+	KUNIT_CASE(dxgk_test_hmgr_assign),
+	KUNIT_CASE(dxgk_test_hmgr_benchmark),
+	{ }
+};
+
+static struct kunit_suite dxgk_hmgr_test_suite = {
+	.name = "dxgkrnl-hmgr",
+	.test_cases = dxgk_hmgr_test_cases,
+};
+
+kunit_test_suites(&dxgk_vmbus_test_suite, &dxgk_hmgr_test_suite);
@@ -669,32 +669,81 @@ static struct notifier_block hv_memory_nb = {
 	.priority = 0
 };
 
-/* Check if the particular page is backed and can be onlined and online it. */
-static void hv_page_online_one(struct hv_hotadd_state *has, struct page *pg)
+/*
+ * Return the number of consecutive backed pages starting at pfn, up to
+ * end_pfn. Returns 0 if pfn itself is not backed.
+ */
+static unsigned long has_pfn_backed_run(struct hv_hotadd_state *has,
+					unsigned long pfn,
+					unsigned long end_pfn)
 {
-	if (!has_pfn_is_backed(has, page_to_pfn(pg))) {
-		if (!PageOffline(pg))
-			__SetPageOffline(pg);
-		return;
+	struct hv_hotadd_gap *gap;
+
+	if (!has_pfn_is_backed(has, pfn))
+		return 0;
+
+	end_pfn = min(end_pfn, has->covered_end_pfn);
+
+	/* pfn is backed, so no gap contains it; stop at the next one. */
+	list_for_each_entry(gap, &has->gap_list, list) {
+		if (gap->start_pfn > pfn && gap->start_pfn < end_pfn)
+			end_pfn = gap->start_pfn;
 	}
-	if (PageOffline(pg))
-		__ClearPageOffline(pg);
 
-	/* This frame is currently backed; online the page. */
-	generic_online_page(pg, 0);
+	return end_pfn - pfn;
+}
+
+/* Online a naturally aligned block of 2^order backed pages. */
+static void hv_page_online_block(struct page *pg, unsigned int order)
+{
+	unsigned long i;
+
+	for (i = 0; i < (1UL << order); i++) {
+		if (PageOffline(pg + i))
+			__ClearPageOffline(pg + i);
+	}
+
+	/* These frames are currently backed; online the pages. */
+	generic_online_page(pg, order);
 
 	lockdep_assert_held(&dm_device.ha_lock);
-	dm_device.num_pages_onlined++;
+	dm_device.num_pages_onlined += 1UL << order;
 }
 
+/*
+ * Online the backed pages in the range and mark the others offline.
+ * Backed pages are handed to the buddy allocator in the largest aligned
+ * blocks possible rather than one page at a time; besides being faster,
+ * this keeps freshly hot-added memory in whole pageblocks.
+ */
 static void hv_bring_pgs_online(struct hv_hotadd_state *has,
 				unsigned long start_pfn, unsigned long size)
 {
-	int i;
+	unsigned long pfn = start_pfn, end_pfn = start_pfn + size;
+	unsigned long nr;
+	unsigned int order;
+	struct page *pg;
 
 	pr_debug("Online %lu pages starting at pfn 0x%lx\n", size, start_pfn);
-	for (i = 0; i < size; i++)
-		hv_page_online_one(has, pfn_to_page(start_pfn + i));
+	while (pfn < end_pfn) {
+		nr = has_pfn_backed_run(has, pfn, end_pfn);
+		if (!nr) {
+			pg = pfn_to_page(pfn++);
+			if (!PageOffline(pg))
+				__SetPageOffline(pg);
+			continue;
+		}
+
+		while (nr) {
+			order = min_t(unsigned int, MAX_ORDER - 1, ilog2(nr));
+			if (pfn)
+				order = min_t(unsigned int, order, __ffs(pfn));
+
+			hv_page_online_block(pfn_to_page(pfn), order);
+			pfn += 1UL << order;
+			nr -= 1UL << order;
+		}
+	}
 }
 
 static void hv_mem_hot_add(unsigned long start, unsigned long size,
@@ -759,8 +808,10 @@ static void hv_mem_hot_add(unsigned long start, unsigned long size,
 		 * not onlined in time.
 		 */
 		wait_for_completion_timeout(&dm_device.ol_waitevent, 5 * HZ);
-		post_status(&dm_device);
 	}
+
+	/* Report the new memory once the whole range has been added. */
+	post_status(&dm_device);
 }
 
 static void hv_online_page(struct page *pg, unsigned int order)
@@ -1187,20 +1238,76 @@ static void post_status(struct hv_dynmem_device *dm)
 
 }
 
+/*
+ * Ballooned 2M blocks are kept as single high-order allocations, so they
+ * can go back to the buddy allocator in one piece. The head page of an
+ * intact block records the block's order in page_private, and its tail
+ * pages have a zero refcount. A block is only split when the host returns
+ * part of it.
+ */
+static void split_balloon_block(struct page *head)
+{
+	unsigned int order = page_private(head);
+	unsigned long i;
+
+	split_page(head, order);
+
+	/* Nothing wrote the tails' page_private; every page is order 0 now. */
+	for (i = 0; i < (1UL << order); i++)
+		set_page_private(head + i, 0);
+}
+
+/*
+ * Find the head of the intact block that @pfn is a tail page of. Blocks are
+ * naturally aligned to their order, and every page between a tail and its
+ * head is a tail too, so the first aligned page that isn't a tail is the
+ * head.
+ */
+static struct page *balloon_block_head(unsigned long pfn)
+{
+	unsigned long head_pfn = pfn;
+	unsigned int order;
+
+	for (order = 1; order < MAX_ORDER; order++) {
+		head_pfn = ALIGN_DOWN(pfn, 1UL << order);
+		if (page_ref_count(pfn_to_page(head_pfn)))
+			break;
+	}
+
+	WARN_ON(pfn >= head_pfn + (1UL << page_private(pfn_to_page(head_pfn))));
+	return pfn_to_page(head_pfn);
+}
+
 static void free_balloon_pages(struct hv_dynmem_device *dm,
 			 union dm_mem_page_range *range_array)
 {
-	int num_pages = range_array->finfo.page_cnt;
-	__u64 start_frame = range_array->finfo.start_page;
+	unsigned long start_frame = range_array->finfo.start_page;
+	unsigned long end_frame = start_frame + range_array->finfo.page_cnt;
+	unsigned long pfn, nr, i;
+	unsigned int order;
 	struct page *pg;
-	int i;
 
-	for (i = 0; i < num_pages; i++) {
-		pg = pfn_to_page(i + start_frame);
-		__ClearPageOffline(pg);
-		__free_page(pg);
-		dm->num_pages_ballooned--;
-		adjust_managed_page_count(pg, 1);
+	for (pfn = start_frame; pfn < end_frame; pfn += nr) {
+		pg = pfn_to_page(pfn);
+
+		/* A tail page of an intact block; split the block. */
+		if (!page_ref_count(pg))
+			split_balloon_block(balloon_block_head(pfn));
+
+		order = page_private(pg);
+		nr = 1UL << order;
+		if (pfn + nr > end_frame) {
+			split_balloon_block(pg);
+			order = 0;
+			nr = 1;
+		}
+
+		for (i = 0; i < nr; i++)
+			__ClearPageOffline(pg + i);
+		set_page_private(pg, 0);
+		adjust_managed_page_count(pg, nr);
+		__free_pages(pg, order);
+		dm->num_pages_ballooned -= nr;
 	}
 }
 
@@ -1211,6 +1318,7 @@ static unsigned int alloc_balloon_pages(struct hv_dynmem_device *dm,
 					struct dm_balloon_response *bl_resp,
 					int alloc_unit)
 {
+	unsigned int order = get_order(alloc_unit << PAGE_SHIFT);
 	unsigned int i, j;
 	struct page *pg;
 
@@ -1224,8 +1332,7 @@ static unsigned int alloc_balloon_pages(struct hv_dynmem_device *dm,
 		 * we don't want the kernel to try too hard.
 		 */
 		pg = alloc_pages(GFP_HIGHUSER | __GFP_NORETRY |
-				__GFP_NOMEMALLOC | __GFP_NOWARN,
-				get_order(alloc_unit << PAGE_SHIFT));
+				__GFP_NOMEMALLOC | __GFP_NOWARN, order);
 
 		if (!pg)
 			return i * alloc_unit;
@@ -1233,18 +1340,15 @@ static unsigned int alloc_balloon_pages(struct hv_dynmem_device *dm,
 		dm->num_pages_ballooned += alloc_unit;
 
 		/*
-		 * If we allocatted 2M pages; split them so we
-		 * can free them in any order we get.
+		 * Don't split 2M allocations; free_balloon_pages() splits
+		 * a block only if the host gives back part of it.
 		 */
-
-		if (alloc_unit != 1)
-			split_page(pg, get_order(alloc_unit << PAGE_SHIFT));
+		set_page_private(pg, order);
 
 		/* mark all pages offline */
-		for (j = 0; j < alloc_unit; j++) {
+		for (j = 0; j < alloc_unit; j++)
 			__SetPageOffline(pg + j);
-			adjust_managed_page_count(pg + j, -1);
-		}
+		adjust_managed_page_count(pg, -alloc_unit);
 
 		bl_resp->range_count++;
 		bl_resp->range_array[i].finfo.start_page =
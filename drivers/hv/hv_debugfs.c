@@ -98,6 +98,34 @@ static int hv_debug_set_test_state(struct hv_device *dev, struct dentry *root)
 	return 0;
 }
 
+/*
+ * Report how many signals vmbus_sendpacket_batch() saved on the primary
+ * channel, next to the signals that were sent.
+ */
+static int hv_debug_stat_files(struct hv_device *dev, struct dentry *root)
+{
+	struct vmbus_channel *channel = dev->channel;
+	char *stats_name = "ring_stats";
+	struct dentry *stats;
+
+	stats = debugfs_create_dir(stats_name, root);
+	if (IS_ERR(stats)) {
+		pr_debug("debugfs_hyperv: %s/ not created\n", stats_name);
+		return PTR_ERR(stats);
+	}
+
+	debugfs_create_u64("intr_out_empty", 0444, stats,
+			   &channel->intr_out_empty);
+	debugfs_create_u64("intr_in_full", 0444, stats,
+			   &channel->intr_in_full);
+	debugfs_create_u64("out_batch_pkts", 0444, stats,
+			   &channel->out_batch_pkts);
+	debugfs_create_u64("out_batch_signals_saved", 0444, stats,
+			   &channel->out_batch_signals_saved);
+
+	return 0;
+}
+
 /* Bind hv device to a dentry for debugfs */
 static void hv_debug_set_dir_dentry(struct hv_device *dev, struct dentry *root)
 {
@@ -122,6 +150,7 @@ int hv_debug_add_dev_dir(struct hv_device *dev)
 		}
 		hv_debug_set_test_state(dev, dev_root);
 		hv_debug_set_dir_dentry(dev, dev_root);
+		hv_debug_stat_files(dev, dev_root);
 		delay = debugfs_create_dir(delay_name, dev_root);
 
 		if (IS_ERR(delay)) {
@@ -183,6 +183,10 @@ int hv_ringbuffer_write(struct vmbus_channel *channel,
 			const struct kvec *kv_list, u32 kv_count,
 			u64 requestid);
 
+int hv_ringbuffer_write_batch(struct vmbus_channel *channel,
+			      const struct vmbus_batch_packet *pkts,
+			      u32 count);
+
 int hv_ringbuffer_read(struct vmbus_channel *channel,
 		       void *buffer, u32 buflen, u32 *buffer_actual_len,
 		       u64 *requestid, bool raw);
@@ -472,4 +476,10 @@ static inline int hv_debug_add_dev_dir(struct hv_device *dev)
 
 #endif /* CONFIG_HYPERV_TESTING */
 
+#if IS_ENABLED(CONFIG_HYPERV_RING_BUFFER_KUNIT_TEST)
+
+extern void (*hv_ringbuffer_test_setevent)(struct vmbus_channel *channel);
+
+#endif
+
 #endif /* _HYPERV_VMBUS_H */
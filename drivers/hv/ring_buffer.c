@@ -49,6 +49,22 @@
  * host logic is fixed.
  */
 
+#if IS_ENABLED(CONFIG_HYPERV_RING_BUFFER_KUNIT_TEST)
+void (*hv_ringbuffer_test_setevent)(struct vmbus_channel *channel);
+#endif
+
+/* Signal the host, or the unit test standing in for it. */
+static void hv_ringbuffer_setevent(struct vmbus_channel *channel)
+{
+#if IS_ENABLED(CONFIG_HYPERV_RING_BUFFER_KUNIT_TEST)
+	if (hv_ringbuffer_test_setevent) {
+		hv_ringbuffer_test_setevent(channel);
+		return;
+	}
+#endif
+	vmbus_setevent(channel);
+}
+
 static void hv_signal_on_write(u32 old_write, struct vmbus_channel *channel)
 {
 	struct hv_ring_buffer_info *rbi = &channel->outbound;
@@ -65,7 +81,7 @@ static void hv_signal_on_write(u32 old_write, struct vmbus_channel *channel)
 	 */
 	if (old_write == READ_ONCE(rbi->ring_buffer->read_index)) {
 		++channel->intr_out_empty;
-		vmbus_setevent(channel);
+		hv_ringbuffer_setevent(channel);
 	}
 }
 
@@ -280,21 +296,84 @@ void hv_ringbuffer_cleanup(struct hv_ring_buffer_info *ring_info)
 	ring_info->pkt_buffer_size = 0;
 }
 
+/*
+ * Copy one packet to the ring buffer at *write_loc and advance *write_loc
+ * past it. The caller holds the ring lock and has checked that there is
+ * room. The write index is not updated, so the host can't see the packet
+ * until the caller publishes it.
+ */
+static int hv_ringbuffer_put(struct vmbus_channel *channel,
+			     const struct kvec *kv_list, u32 kv_count,
+			     u64 requestid, u32 *write_loc, u64 *rqst_id)
+{
+	struct hv_ring_buffer_info *outring_info = &channel->outbound;
+	struct vmpacket_descriptor *desc = kv_list[0].iov_base;
+	u32 next_write_location = *write_loc;
+	u64 prev_indices;
+	int i;
+
+	*rqst_id = VMBUS_NO_RQSTOR;
+
+	for (i = 0; i < kv_count; i++) {
+		next_write_location = hv_copyto_ringbuffer(outring_info,
+						     next_write_location,
+						     kv_list[i].iov_base,
+						     kv_list[i].iov_len);
+	}
+
+	/*
+	 * Allocate the request ID after the data has been copied into the
+	 * ring buffer.  Once this request ID is allocated, the completion
+	 * path could find the data and free it.
+	 */
+
+	if (desc->flags == VMBUS_DATA_PACKET_FLAG_COMPLETION_REQUESTED) {
+		if (channel->next_request_id_callback != NULL) {
+			*rqst_id = channel->next_request_id_callback(channel, requestid);
+			if (*rqst_id == VMBUS_RQST_ERROR) {
+				*rqst_id = VMBUS_NO_RQSTOR;
+				return -EAGAIN;
+			}
+		}
+	}
+	desc = hv_get_ring_buffer(outring_info) + *write_loc;
+	desc->trans_id = (*rqst_id == VMBUS_NO_RQSTOR) ? requestid : *rqst_id;
+
+	/* Set previous packet start */
+	prev_indices = hv_get_ring_bufferindices(outring_info);
+
+	*write_loc = hv_copyto_ringbuffer(outring_info,
+					  next_write_location,
+					  &prev_indices,
+					  sizeof(u64));
+
+	return 0;
+}
+
+/* Account for a write that found the outbound ring buffer full. */
+static void hv_ringbuffer_mark_full(struct vmbus_channel *channel)
+{
+	++channel->out_full_total;
+
+	if (!channel->out_full_flag) {
+		++channel->out_full_first;
+		channel->out_full_flag = true;
+	}
+}
+
 /* Write to the ring buffer. */
 int hv_ringbuffer_write(struct vmbus_channel *channel,
 			const struct kvec *kv_list, u32 kv_count,
 			u64 requestid)
 {
-	int i;
+	int i, ret;
 	u32 bytes_avail_towrite;
 	u32 totalbytes_towrite = sizeof(u64);
 	u32 next_write_location;
 	u32 old_write;
-	u64 prev_indices;
 	unsigned long flags;
 	struct hv_ring_buffer_info *outring_info = &channel->outbound;
-	struct vmpacket_descriptor *desc = kv_list[0].iov_base;
-	u64 rqst_id = VMBUS_NO_RQSTOR;
+	u64 rqst_id;
 
 	if (channel->rescind)
 		return -ENODEV;
@@ -312,13 +391,7 @@ int hv_ringbuffer_write(struct vmbus_channel *channel,
 	 * is empty since the read index == write index.
 	 */
 	if (bytes_avail_towrite <= totalbytes_towrite) {
-		++channel->out_full_total;
-
-		if (!channel->out_full_flag) {
-			++channel->out_full_first;
-			channel->out_full_flag = true;
-		}
-
+		hv_ringbuffer_mark_full(channel);
 		spin_unlock_irqrestore(&outring_info->ring_lock, flags);
 		return -EAGAIN;
 	}
@@ -330,38 +403,12 @@ int hv_ringbuffer_write(struct vmbus_channel *channel,
 
 	old_write = next_write_location;
 
-	for (i = 0; i < kv_count; i++) {
-		next_write_location = hv_copyto_ringbuffer(outring_info,
-						     next_write_location,
-						     kv_list[i].iov_base,
-						     kv_list[i].iov_len);
-	}
-
-	/*
-	 * Allocate the request ID after the data has been copied into the
-	 * ring buffer.  Once this request ID is allocated, the completion
-	 * path could find the data and free it.
-	 */
-
-	if (desc->flags == VMBUS_DATA_PACKET_FLAG_COMPLETION_REQUESTED) {
-		if (channel->next_request_id_callback != NULL) {
-			rqst_id = channel->next_request_id_callback(channel, requestid);
-			if (rqst_id == VMBUS_RQST_ERROR) {
-				spin_unlock_irqrestore(&outring_info->ring_lock, flags);
-				return -EAGAIN;
-			}
-		}
+	ret = hv_ringbuffer_put(channel, kv_list, kv_count, requestid,
+				&next_write_location, &rqst_id);
+	if (ret) {
+		spin_unlock_irqrestore(&outring_info->ring_lock, flags);
+		return ret;
 	}
-	desc = hv_get_ring_buffer(outring_info) + old_write;
-	desc->trans_id = (rqst_id == VMBUS_NO_RQSTOR) ? requestid : rqst_id;
-
-	/* Set previous packet start */
-	prev_indices = hv_get_ring_bufferindices(outring_info);
-
-	next_write_location = hv_copyto_ringbuffer(outring_info,
-					     next_write_location,
-					     &prev_indices,
-					     sizeof(u64));
 
 	/* Issue a full memory barrier before updating the write index */
 	virt_mb();
@@ -386,6 +433,108 @@ int hv_ringbuffer_write(struct vmbus_channel *channel,
 	return 0;
 }
 
+/*
+ * Write a batch of in-band packets to the ring buffer.
+ *
+ * All packets are copied under a single acquisition of the ring lock and
+ * made visible to the host with a single update of the write index, so the
+ * host is signaled at most once for the whole batch. Packets are written in
+ * order until one doesn't fit; the number of packets written is returned.
+ * -EAGAIN is returned if not even the first packet fits.
+ */
+int hv_ringbuffer_write_batch(struct vmbus_channel *channel,
+			      const struct vmbus_batch_packet *pkts,
+			      u32 count)
+{
+	struct hv_ring_buffer_info *outring_info = &channel->outbound;
+	struct vmpacket_descriptor desc;
+	struct kvec bufferlist[3];
+	u64 aligned_data = 0;
+	u32 bytes_avail_towrite, packetlen, packetlen_aligned;
+	u32 next_write_location, old_write;
+	unsigned long flags;
+	u64 rqst_id;
+	u32 written = 0;
+	bool full = false;
+	int ret = 0;
+
+	if (channel->rescind)
+		return -ENODEV;
+
+	if (count == 0)
+		return 0;
+
+	spin_lock_irqsave(&outring_info->ring_lock, flags);
+
+	bytes_avail_towrite = hv_get_bytes_to_write(outring_info);
+	next_write_location = hv_get_next_write_location(outring_info);
+	old_write = next_write_location;
+
+	for (; written < count; written++) {
+		const struct vmbus_batch_packet *pkt = &pkts[written];
+
+		packetlen = sizeof(struct vmpacket_descriptor) + pkt->bufferlen;
+		packetlen_aligned = ALIGN(packetlen, sizeof(u64));
+
+		/* See hv_ringbuffer_write() for why this isn't "<" */
+		if (bytes_avail_towrite <= packetlen_aligned + sizeof(u64)) {
+			full = true;
+			break;
+		}
+
+		desc.type = pkt->type;
+		desc.flags = pkt->flags;
+		desc.offset8 = sizeof(struct vmpacket_descriptor) >> 3;
+		desc.len8 = (u16)(packetlen_aligned >> 3);
+		desc.trans_id = VMBUS_RQST_ERROR;
+
+		bufferlist[0].iov_base = &desc;
+		bufferlist[0].iov_len = sizeof(struct vmpacket_descriptor);
+		bufferlist[1].iov_base = pkt->buffer;
+		bufferlist[1].iov_len = pkt->bufferlen;
+		bufferlist[2].iov_base = &aligned_data;
+		bufferlist[2].iov_len = packetlen_aligned - packetlen;
+
+		ret = hv_ringbuffer_put(channel, bufferlist,
+					pkt->bufferlen ? 3 : 1,
+					pkt->requestid,
+					&next_write_location, &rqst_id);
+		if (ret)
+			break;
+
+		bytes_avail_towrite -= packetlen_aligned + sizeof(u64);
+	}
+
+	if (full)
+		hv_ringbuffer_mark_full(channel);
+	else if (written)
+		channel->out_full_flag = false;
+
+	if (written == 0) {
+		spin_unlock_irqrestore(&outring_info->ring_lock, flags);
+		return full ? -EAGAIN : ret;
+	}
+
+	/* Issue a full memory barrier before updating the write index */
+	virt_mb();
+
+	hv_set_next_write_location(outring_info, next_write_location);
+
+	channel->out_batch_pkts += written;
+	channel->out_batch_signals_saved += written - 1;
+
+	spin_unlock_irqrestore(&outring_info->ring_lock, flags);
+
+	hv_signal_on_write(old_write, channel);
+
+	/*
+	 * Unlike hv_ringbuffer_write(), a racing rescind is not reported
+	 * here: the packets are already queued, and their request IDs go
+	 * away with the requestor when the channel is torn down.
+	 */
+	return written;
+}
+
 int hv_ringbuffer_read(struct vmbus_channel *channel,
 		       void *buffer, u32 buflen, u32 *buffer_actual_len,
 		       u64 *requestid, bool raw)
@@ -655,6 +804,6 @@ void hv_pkt_iter_close(struct vmbus_channel *channel)
 		return;
 
 	++channel->intr_in_full;
-	vmbus_setevent(channel);
+	hv_ringbuffer_setevent(channel);
 }
 EXPORT_SYMBOL_GPL(hv_pkt_iter_close);
@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * KUnit tests for the VMBus ring buffer
+ *
+ * The tests run against an in-memory ring: the channel's outbound and
+ * inbound ring buffers are two mappings of the same pages, so whatever
+ * the producer side writes, the consumer side reads. Host signals are
+ * counted instead of being sent to Hyper-V.
+ */
+
+#include <kunit/test.h>
+#include <linux/hyperv.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+
+#include "hyperv_vmbus.h"
+
+#define TEST_RING_PAGES		5
+#define TEST_PKT_TYPE		VM_PKT_DATA_INBAND
+
+struct test_ring {
+	struct vmbus_channel *channel;
+	struct page *pages;
+};
+
+static unsigned int test_signals;
+
+static void test_setevent(struct vmbus_channel *channel)
+{
+	test_signals++;
+}
+
+static struct vmbus_channel *test_ring_create(struct kunit *test,
+					      struct test_ring *ring)
+{
+	struct vmbus_channel *channel;
+	int ret;
+
+	channel = kunit_kzalloc(test, sizeof(*channel), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, channel);
+
+	ring->pages = alloc_pages(GFP_KERNEL | __GFP_ZERO,
+				  get_order(TEST_RING_PAGES << PAGE_SHIFT));
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ring->pages);
+
+	hv_ringbuffer_pre_init(channel);
+	ret = hv_ringbuffer_init(&channel->outbound, ring->pages,
+				 TEST_RING_PAGES, 0);
+	KUNIT_ASSERT_EQ(test, ret, 0);
+	ret = hv_ringbuffer_init(&channel->inbound, ring->pages,
+				 TEST_RING_PAGES, VMBUS_DEFAULT_MAX_PKT_SIZE);
+	KUNIT_ASSERT_EQ(test, ret, 0);
+
+	ring->channel = channel;
+	test_signals = 0;
+	hv_ringbuffer_test_setevent = test_setevent;
+
+	return channel;
+}
+
+static void test_ring_destroy(struct test_ring *ring)
+{
+	hv_ringbuffer_test_setevent = NULL;
+	hv_ringbuffer_cleanup(&ring->channel->inbound);
+	hv_ringbuffer_cleanup(&ring->channel->outbound);
+	__free_pages(ring->pages, get_order(TEST_RING_PAGES << PAGE_SHIFT));
+}
+
+/* Ring buffer space one packet with a @len byte payload takes up */
+static u32 test_pkt_size(u32 len)
+{
+	return ALIGN(sizeof(struct vmpacket_descriptor) + len, sizeof(u64)) +
+	       sizeof(u64);
+}
+
+static void test_fill_batch(struct vmbus_batch_packet *pkts, u8 *data,
+			    u32 count, u32 len)
+{
+	u32 i;
+
+	for (i = 0; i < count; i++) {
+		memset(data + i * len, i + 1, len);
+		pkts[i].buffer = data + i * len;
+		pkts[i].bufferlen = len;
+		pkts[i].requestid = 0x1000 + i;
+		pkts[i].type = TEST_PKT_TYPE;
+		pkts[i].flags = 0;
+	}
+}
+
+/*
+ * Read up to @count packets one at a time, back to back and 8 byte aligned
+ * in @buffer, as a channel callback draining the ring would.
+ */
+static int test_read(struct vmbus_channel *channel, u8 *buffer, u32 buflen,
+		     struct vmbus_batch_packet *out, u32 count)
+{
+	u32 i, len, used = 0;
+
+	for (i = 0; i < count && used < buflen; i++) {
+		if (hv_ringbuffer_read(channel, buffer + used, buflen - used,
+				       &len, &out[i].requestid, false) || !len)
+			break;
+		out[i].buffer = buffer + used;
+		out[i].bufferlen = len;
+		used = ALIGN(used + len, sizeof(u64));
+	}
+
+	return i;
+}
+
+static void hv_test_ring_batch_roundtrip(struct kunit *test)
+{
+	struct vmbus_batch_packet in[8], out[8];
+	struct vmbus_channel *channel;
+	struct test_ring ring;
+	u8 *data, *buffer;
+	u32 i, len;
+	int ret;
+
+	channel = test_ring_create(test, &ring);
+
+	data = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, data);
+	buffer = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buffer);
+
+	/* Odd sizes so that padding and alignment are exercised */
+	for (i = 0, len = 0; i < ARRAY_SIZE(in); len += 13 + i * 7, i++) {
+		memset(data + len, 0xa0 + i, 13 + i * 7);
+		in[i].buffer = data + len;
+		in[i].bufferlen = 13 + i * 7;
+		in[i].requestid = 0x100 + i;
+		in[i].type = TEST_PKT_TYPE;
+		in[i].flags = 0;
+	}
+
+	ret = hv_ringbuffer_write_batch(channel, in, ARRAY_SIZE(in));
+	KUNIT_EXPECT_EQ(test, ret, (int)ARRAY_SIZE(in));
+	KUNIT_EXPECT_EQ(test, test_signals, 1U);
+
+	ret = test_read(channel, buffer, PAGE_SIZE, out, ARRAY_SIZE(out));
+	KUNIT_ASSERT_EQ(test, ret, (int)ARRAY_SIZE(out));
+
+	for (i = 0; i < ARRAY_SIZE(in); i++) {
+		/* The payload is padded to 8 bytes in the ring */
+		KUNIT_EXPECT_EQ(test, out[i].bufferlen,
+				ALIGN(in[i].bufferlen, sizeof(u64)));
+		KUNIT_EXPECT_EQ(test, out[i].requestid, in[i].requestid);
+		KUNIT_EXPECT_EQ(test, memcmp(out[i].buffer, in[i].buffer,
+					     in[i].bufferlen), 0);
+		KUNIT_EXPECT_EQ(test, (unsigned long)out[i].buffer %
+				sizeof(u64), 0UL);
+	}
+
+	KUNIT_EXPECT_EQ(test, channel->out_batch_pkts, (u64)ARRAY_SIZE(in));
+	KUNIT_EXPECT_PTR_EQ(test, (void *)hv_pkt_iter_first(channel),
+			    (void *)NULL);
+
+	test_ring_destroy(&ring);
+}
+
+/*
+ * When the consumer keeps up with the producer, each single packet write
+ * finds the ring empty and signals the host. A batch signals once.
+ */
+static void hv_test_ring_batch_signals(struct kunit *test)
+{
+	struct vmbus_batch_packet pkts[16], out[16];
+	struct vmbus_channel *channel;
+	struct test_ring ring;
+	u8 *data, *buffer;
+	u32 i, len = 64;
+	int ret;
+
+	channel = test_ring_create(test, &ring);
+
+	data = kunit_kzalloc(test, ARRAY_SIZE(pkts) * len, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, data);
+	buffer = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buffer);
+
+	test_fill_batch(pkts, data, ARRAY_SIZE(pkts), len);
+
+	for (i = 0; i < ARRAY_SIZE(pkts); i++) {
+		ret = hv_ringbuffer_write_batch(channel, &pkts[i], 1);
+		KUNIT_ASSERT_EQ(test, ret, 1);
+		ret = test_read(channel, buffer, PAGE_SIZE, out, 1);
+		KUNIT_ASSERT_EQ(test, ret, 1);
+	}
+	KUNIT_EXPECT_EQ(test, test_signals, (unsigned int)ARRAY_SIZE(pkts));
+	KUNIT_EXPECT_EQ(test, channel->out_batch_signals_saved, 0ULL);
+
+	test_signals = 0;
+	ret = hv_ringbuffer_write_batch(channel, pkts, ARRAY_SIZE(pkts));
+	KUNIT_EXPECT_EQ(test, ret, (int)ARRAY_SIZE(pkts));
+	ret = test_read(channel, buffer, PAGE_SIZE, out, ARRAY_SIZE(out));
+	KUNIT_EXPECT_EQ(test, ret, (int)ARRAY_SIZE(out));
+	KUNIT_EXPECT_EQ(test, test_signals, 1U);
+	KUNIT_EXPECT_EQ(test, channel->intr_out_empty,
+			(u64)ARRAY_SIZE(pkts) + 1);
+	KUNIT_EXPECT_EQ(test, channel->out_batch_signals_saved,
+			(u64)ARRAY_SIZE(pkts) - 1);
+
+	/* No signal while the host masks interrupts */
+	test_signals = 0;
+	channel->outbound.ring_buffer->interrupt_mask = 1;
+	ret = hv_ringbuffer_write_batch(channel, pkts, 4);
+	KUNIT_EXPECT_EQ(test, ret, 4);
+	KUNIT_EXPECT_EQ(test, test_signals, 0U);
+
+	test_ring_destroy(&ring);
+}
+
+/* A batch stops at the first packet that doesn't fit */
+static void hv_test_ring_batch_full(struct kunit *test)
+{
+	struct vmbus_batch_packet pkts[32];
+	struct vmbus_channel *channel;
+	struct test_ring ring;
+	u32 avail, fit = 0, len = 1024;
+	u8 *data;
+	int ret;
+
+	channel = test_ring_create(test, &ring);
+
+	data = kunit_kzalloc(test, ARRAY_SIZE(pkts) * len, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, data);
+	test_fill_batch(pkts, data, ARRAY_SIZE(pkts), len);
+
+	/* The ring must keep at least one byte free */
+	for (avail = channel->outbound.ring_datasize;
+	     avail > test_pkt_size(len); avail -= test_pkt_size(len))
+		fit++;
+	KUNIT_ASSERT_LT(test, fit, (u32)ARRAY_SIZE(pkts));
+
+	ret = hv_ringbuffer_write_batch(channel, pkts, ARRAY_SIZE(pkts));
+	KUNIT_EXPECT_EQ(test, ret, (int)fit);
+	KUNIT_EXPECT_EQ(test, channel->out_full_total, 1ULL);
+	KUNIT_EXPECT_EQ(test, channel->out_full_first, 1ULL);
+
+	ret = hv_ringbuffer_write_batch(channel, pkts, ARRAY_SIZE(pkts));
+	KUNIT_EXPECT_EQ(test, ret, -EAGAIN);
+	KUNIT_EXPECT_EQ(test, channel->out_full_total, 2ULL);
+	KUNIT_EXPECT_EQ(test, channel->out_full_first, 1ULL);
+	KUNIT_EXPECT_EQ(test, test_signals, 1U);
+
+	test_ring_destroy(&ring);
+}
+
+static struct kunit_case hv_ring_test_cases[] = {
+	KUNIT_CASE(hv_test_ring_batch_roundtrip),
+	KUNIT_CASE(hv_test_ring_batch_signals),
+	KUNIT_CASE(hv_test_ring_batch_full),
+	{ }
+};
+
+static struct kunit_suite hv_ring_test_suite = {
+	.name = "hv-ring-buffer",
+	.test_cases = hv_ring_test_cases,
+};
+
+kunit_test_suite(hv_ring_test_suite);
@@ -977,6 +977,8 @@ static inline blk_status_t nvme_setup_rw(struct nvme_ns *ns,
 
 void nvme_cleanup_cmd(struct request *req)
 {
+	nvme_mpath_end_request(req);
+
 	if (req->rq_flags & RQF_SPECIAL_PAYLOAD) {
 		struct nvme_ctrl *ctrl = nvme_req(req)->ctrl;
 
@@ -1038,6 +1040,8 @@ blk_status_t nvme_setup_cmd(struct nvme_ns *ns, struct request *req)
 	}
 
 	cmd->common.command_id = nvme_cid(req);
+	if (likely(!ret))
+		nvme_mpath_start_request(req);
 	trace_nvme_setup_cmd(req, cmd);
 	return ret;
 }
@@ -16,6 +16,8 @@ MODULE_PARM_DESC(multipath,
 static const char *nvme_iopolicy_names[] = {
 	[NVME_IOPOLICY_NUMA]	= "numa",
 	[NVME_IOPOLICY_RR]	= "round-robin",
+	[NVME_IOPOLICY_QD]	= "queue-depth",
+	[NVME_IOPOLICY_ST]	= "service-time",
 };
 
 static int iopolicy = NVME_IOPOLICY_NUMA;
@@ -28,6 +30,10 @@ static int nvme_set_iopolicy(const char *val, const struct kernel_param *kp)
 		iopolicy = NVME_IOPOLICY_NUMA;
 	else if (!strncmp(val, "round-robin", 11))
 		iopolicy = NVME_IOPOLICY_RR;
+	else if (!strncmp(val, "queue-depth", 11))
+		iopolicy = NVME_IOPOLICY_QD;
+	else if (!strncmp(val, "service-time", 12))
+		iopolicy = NVME_IOPOLICY_ST;
 	else
 		return -EINVAL;
 
@@ -42,7 +48,7 @@ static int nvme_get_iopolicy(char *buf, const struct kernel_param *kp)
 module_param_call(iopolicy, nvme_set_iopolicy, nvme_get_iopolicy,
 	&iopolicy, 0644);
 MODULE_PARM_DESC(iopolicy,
-	"Default multipath I/O policy; 'numa' (default) or 'round-robin'");
+	"Default multipath I/O policy; 'numa' (default), 'round-robin', 'queue-depth' or 'service-time'");
 
 void nvme_mpath_default_iopolicy(struct nvme_subsystem *subsys)
 {
@@ -313,6 +319,65 @@ static struct nvme_ns *nvme_round_robin_path(struct nvme_ns_head *head,
 	return found;
 }
 
+/*
+ * Expected cost of sending one more I/O down the path of @ns.  For
+ * queue-depth that is simply the number of I/Os in flight on the
+ * controller; for service-time it is the time to drain them plus the new
+ * one, based on the controller's recent completion latency.  An idle path
+ * always costs nothing, so a path that was slow once keeps getting the
+ * occasional I/O and its latency estimate can't go stale.
+ */
+static u64 nvme_path_cost(struct nvme_ns *ns, int policy)
+{
+	unsigned int depth = atomic_read(&ns->ctrl->nr_active);
+
+	if (policy == NVME_IOPOLICY_QD || !depth)
+		return depth;
+	return (u64)(depth + 1) * atomic64_read(&ns->ctrl->lat_ewma_ns);
+}
+
+/*
+ * Pick the cheapest usable path, preferring optimized paths over
+ * non-optimized ones.  This only reads per-controller counters, so
+ * concurrent submitters never contend on a shared lock or cacheline
+ * beyond those counters.
+ */
+static struct nvme_ns *nvme_least_loaded_path(struct nvme_ns_head *head,
+		int policy)
+{
+	struct nvme_ns *best_opt = NULL, *best_nonopt = NULL, *ns;
+	u64 min_opt = U64_MAX, min_nonopt = U64_MAX, cost;
+
+	list_for_each_entry_rcu(ns, &head->list, siblings) {
+		if (nvme_path_is_disabled(ns))
+			continue;
+
+		cost = nvme_path_cost(ns, policy);
+
+		switch (ns->ana_state) {
+		case NVME_ANA_OPTIMIZED:
+			if (cost < min_opt) {
+				min_opt = cost;
+				best_opt = ns;
+			}
+			break;
+		case NVME_ANA_NONOPTIMIZED:
+			if (cost < min_nonopt) {
+				min_nonopt = cost;
+				best_nonopt = ns;
+			}
+			break;
+		default:
+			break;
+		}
+
+		if (best_opt && !min_opt)
+			break;
+	}
+
+	return best_opt ? best_opt : best_nonopt;
+}
+
 static inline bool nvme_path_is_optimized(struct nvme_ns *ns)
 {
 	return ns->ctrl->state == NVME_CTRL_LIVE &&
@@ -321,14 +386,18 @@ static inline bool nvme_path_is_optimized(struct nvme_ns *ns)
 
 inline struct nvme_ns *nvme_find_path(struct nvme_ns_head *head)
 {
+	int policy = READ_ONCE(head->subsys->iopolicy);
 	int node = numa_node_id();
 	struct nvme_ns *ns;
 
+	if (policy == NVME_IOPOLICY_QD || policy == NVME_IOPOLICY_ST)
+		return nvme_least_loaded_path(head, policy);
+
 	ns = srcu_dereference(head->current_path[node], &head->srcu);
 	if (unlikely(!ns))
 		return __nvme_find_path(head, node);
 
-	if (READ_ONCE(head->subsys->iopolicy) == NVME_IOPOLICY_RR)
+	if (policy == NVME_IOPOLICY_RR)
 		return nvme_round_robin_path(head, node, ns);
 	if (unlikely(!nvme_path_is_optimized(ns)))
 		return __nvme_find_path(head, node);
@@ -855,8 +924,61 @@ void nvme_mpath_remove_disk(struct nvme_ns_head *head)
 	blk_cleanup_disk(head->disk);
 }
 
+/*
+ * Account a multipath I/O against its controller for the load-based
+ * iopolicies.  Called once the command has been set up for submission;
+ * the matching nvme_mpath_end_request() comes from nvme_cleanup_cmd().
+ */
+void nvme_mpath_start_request(struct request *rq)
+{
+	struct nvme_ns *ns = rq->q->queuedata;
+	int policy;
+
+	if (!(rq->cmd_flags & REQ_NVME_MPATH) ||
+	    (nvme_req(rq)->flags & NVME_MPATH_CNT_ACTIVE))
+		return;
+
+	policy = READ_ONCE(ns->head->subsys->iopolicy);
+	if (policy != NVME_IOPOLICY_QD && policy != NVME_IOPOLICY_ST)
+		return;
+
+	atomic_inc(&ns->ctrl->nr_active);
+	nvme_req(rq)->flags |= NVME_MPATH_CNT_ACTIVE;
+	nvme_req(rq)->start_ns = policy == NVME_IOPOLICY_ST ? ktime_get_ns() : 0;
+}
+
+/* Weight of a new sample in the latency average, as a power of two */
+#define NVME_MPATH_LAT_EWMA_SHIFT	3
+
+void nvme_mpath_end_request(struct request *rq)
+{
+	struct nvme_request *nreq = nvme_req(rq);
+	struct nvme_ctrl *ctrl = nreq->ctrl;
+	s64 ewma, lat;
+
+	if (!(nreq->flags & NVME_MPATH_CNT_ACTIVE))
+		return;
+	nreq->flags &= ~NVME_MPATH_CNT_ACTIVE;
+	atomic_dec(&ctrl->nr_active);
+
+	/* only let successfully completed commands feed the latency average */
+	if (!nreq->start_ns || nreq->status || !blk_mq_request_started(rq))
+		return;
+
+	/*
+	 * Racing updates from other CPUs may overwrite each other, which
+	 * only loses samples; not worth an atomic read-modify-write here.
+	 */
+	lat = ktime_get_ns() - nreq->start_ns;
+	ewma = atomic64_read(&ctrl->lat_ewma_ns);
+	ewma += (lat - ewma) >> NVME_MPATH_LAT_EWMA_SHIFT;
+	atomic64_set(&ctrl->lat_ewma_ns, ewma);
+}
+
 void nvme_mpath_init_ctrl(struct nvme_ctrl *ctrl)
 {
+	atomic_set(&ctrl->nr_active, 0);
+	atomic64_set(&ctrl->lat_ewma_ns, 0);
 	mutex_init(&ctrl->ana_lock);
 	timer_setup(&ctrl->anatt_timer, nvme_anatt_timeout, 0);
 	INIT_WORK(&ctrl->ana_work, nvme_ana_work);
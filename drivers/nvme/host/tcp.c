@@ -14,6 +14,7 @@
 #include <linux/blk-mq.h>
 #include <crypto/hash.h>
 #include <net/busy_poll.h>
+#include <linux/debugfs.h>
 
 #include "nvme.h"
 #include "fabrics.h"
@@ -30,6 +31,23 @@ static int so_priority;
 module_param(so_priority, int, 0644);
 MODULE_PARM_DESC(so_priority, "nvme tcp socket optimize priority");
 
+/*
+ * Busy poll budget set on the sockets of dedicated poll queues, so polled
+ * I/O can spin on the NIC queue even when the net.core.busy_read sysctl
+ * is left at zero.  Zero keeps the socket default.
+ */
+static unsigned int poll_busy_usecs = 50;
+module_param(poll_busy_usecs, uint, 0644);
+MODULE_PARM_DESC(poll_busy_usecs,
+		 "socket busy poll time in usecs for poll queues (0 = socket default)");
+
+static bool latency_stats;
+module_param(latency_stats, bool, 0644);
+MODULE_PARM_DESC(latency_stats,
+		 "collect per-queue command latency, shown in debugfs");
+
+static struct dentry *nvme_tcp_debugfs;
+
 enum nvme_tcp_send_state {
 	NVME_TCP_SEND_CMD_PDU = 0,
 	NVME_TCP_SEND_H2C_PDU,
@@ -49,6 +67,7 @@ struct nvme_tcp_request {
 	struct list_head	entry;
 	struct llist_node	lentry;
 	__le32			ddgst;
+	u64			start_ns;
 
 	struct bio		*curr_bio;
 	struct iov_iter		iter;
@@ -71,6 +90,12 @@ enum nvme_tcp_recv_state {
 	NVME_TCP_RECV_DDGST,
 };
 
+struct nvme_tcp_queue_stats {
+	u64			nr_completed;
+	u64			lat_total_ns;
+	u64			lat_max_ns;
+};
+
 struct nvme_tcp_ctrl;
 struct nvme_tcp_queue {
 	struct socket		*sock;
@@ -109,6 +134,9 @@ struct nvme_tcp_queue {
 
 	struct page_frag_cache	pf_cache;
 
+	/* only updated from the receive path, under the socket lock */
+	struct nvme_tcp_queue_stats stats;
+
 	void (*state_change)(struct sock *);
 	void (*data_ready)(struct sock *);
 	void (*write_space)(struct sock *);
@@ -130,6 +158,7 @@ struct nvme_tcp_ctrl {
 	struct delayed_work	connect_work;
 	struct nvme_tcp_request async_req;
 	u32			io_queues[HCTX_MAX_TYPES];
+	struct dentry		*debugfs_stats;
 };
 
 static LIST_HEAD(nvme_tcp_ctrl_list);
@@ -490,6 +519,23 @@ static void nvme_tcp_error_recovery(struct nvme_ctrl *ctrl)
 	queue_work(nvme_reset_wq, &to_tcp_ctrl(ctrl)->err_work);
 }
 
+static void nvme_tcp_account_rq(struct nvme_tcp_queue *queue,
+		struct request *rq)
+{
+	struct nvme_tcp_request *req = blk_mq_rq_to_pdu(rq);
+	u64 lat;
+
+	if (!req->start_ns)
+		return;
+
+	lat = ktime_get_ns() - req->start_ns;
+	req->start_ns = 0;
+	queue->stats.nr_completed++;
+	queue->stats.lat_total_ns += lat;
+	if (lat > queue->stats.lat_max_ns)
+		queue->stats.lat_max_ns = lat;
+}
+
 static int nvme_tcp_process_nvme_cqe(struct nvme_tcp_queue *queue,
 		struct nvme_completion *cqe)
 {
@@ -509,6 +555,7 @@ static int nvme_tcp_process_nvme_cqe(struct nvme_tcp_queue *queue,
 	if (req->status == cpu_to_le16(NVME_SC_SUCCESS))
 		req->status = cqe->status;
 
+	nvme_tcp_account_rq(queue, rq);
 	if (!nvme_try_complete_req(rq, req->status, cqe->result))
 		nvme_complete_rq(rq);
 	queue->nr_cqe++;
@@ -764,6 +811,7 @@ static int nvme_tcp_recv_data(struct nvme_tcp_queue *queue, struct sk_buff *skb,
 			queue->ddgst_remaining = NVME_TCP_DIGEST_LENGTH;
 		} else {
 			if (pdu->hdr.flags & NVME_TCP_F_DATA_SUCCESS) {
+				nvme_tcp_account_rq(queue, rq);
 				nvme_tcp_end_request(rq,
 						le16_to_cpu(req->status));
 				queue->nr_cqe++;
@@ -812,6 +860,7 @@ static int nvme_tcp_recv_ddgst(struct nvme_tcp_queue *queue,
 					pdu->command_id);
 		struct nvme_tcp_request *req = blk_mq_rq_to_pdu(rq);
 
+		nvme_tcp_account_rq(queue, rq);
 		nvme_tcp_end_request(rq, le16_to_cpu(req->status));
 		queue->nr_cqe++;
 	}
@@ -1398,6 +1447,37 @@ static void nvme_tcp_set_queue_io_cpu(struct nvme_tcp_queue *queue)
 	queue->io_cpu = cpumask_next_wrap(n - 1, cpu_online_mask, -1, false);
 }
 
+/*
+ * Once the I/O tag set is mapped, move io_work to a CPU that actually
+ * submits to this queue, so sending and completion processing stay local
+ * to the submitter instead of bouncing to whichever CPU the queue index
+ * happened to land on.
+ */
+static void nvme_tcp_set_queue_io_cpu_mapped(struct nvme_tcp_queue *queue)
+{
+	struct nvme_tcp_ctrl *ctrl = queue->ctrl;
+	int qid = nvme_tcp_queue_id(queue);
+	struct blk_mq_queue_map *map;
+	int cpu;
+
+	if (nvme_tcp_poll_queue(queue))
+		map = &ctrl->tag_set.map[HCTX_TYPE_POLL];
+	else if (nvme_tcp_read_queue(queue))
+		map = &ctrl->tag_set.map[HCTX_TYPE_READ];
+	else
+		map = &ctrl->tag_set.map[HCTX_TYPE_DEFAULT];
+
+	if (!map->mq_map)
+		return;
+
+	for_each_online_cpu(cpu) {
+		if (map->mq_map[cpu] == qid - 1) {
+			queue->io_cpu = cpu;
+			return;
+		}
+	}
+}
+
 static int nvme_tcp_alloc_queue(struct nvme_ctrl *nctrl,
 		int qid, size_t queue_size)
 {
@@ -1594,7 +1674,21 @@ static int nvme_tcp_start_queue(struct nvme_ctrl *nctrl, int idx)
 		ret = nvmf_connect_admin_queue(nctrl);
 
 	if (!ret) {
-		set_bit(NVME_TCP_Q_LIVE, &ctrl->queues[idx].flags);
+		struct nvme_tcp_queue *queue = &ctrl->queues[idx];
+
+		if (idx) {
+			nvme_tcp_set_queue_io_cpu_mapped(queue);
+#ifdef CONFIG_NET_RX_BUSY_POLL
+			if (nvme_tcp_poll_queue(queue) && poll_busy_usecs) {
+				lock_sock(queue->sock->sk);
+				if (!queue->sock->sk->sk_ll_usec)
+					WRITE_ONCE(queue->sock->sk->sk_ll_usec,
+						   poll_busy_usecs);
+				release_sock(queue->sock->sk);
+			}
+#endif
+		}
+		set_bit(NVME_TCP_Q_LIVE, &queue->flags);
 	} else {
 		if (test_bit(NVME_TCP_Q_ALLOCATED, &ctrl->queues[idx].flags))
 			__nvme_tcp_stop_queue(&ctrl->queues[idx]);
@@ -2156,10 +2250,31 @@ static void nvme_reset_ctrl_work(struct work_struct *work)
 	nvme_tcp_reconnect_or_remove(ctrl);
 }
 
+static int nvme_tcp_stats_show(struct seq_file *m, void *unused)
+{
+	struct nvme_tcp_ctrl *ctrl = m->private;
+	int i;
+
+	seq_puts(m, "qid io_cpu completed avg_lat_ns max_lat_ns\n");
+	for (i = 0; i < ctrl->ctrl.queue_count; i++) {
+		struct nvme_tcp_queue *queue = &ctrl->queues[i];
+		u64 nr = READ_ONCE(queue->stats.nr_completed);
+		u64 total = READ_ONCE(queue->stats.lat_total_ns);
+
+		seq_printf(m, "%d %d %llu %llu %llu\n", i, queue->io_cpu, nr,
+			   nr ? div64_u64(total, nr) : 0,
+			   READ_ONCE(queue->stats.lat_max_ns));
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(nvme_tcp_stats);
+
 static void nvme_tcp_free_ctrl(struct nvme_ctrl *nctrl)
 {
 	struct nvme_tcp_ctrl *ctrl = to_tcp_ctrl(nctrl);
 
+	debugfs_remove(ctrl->debugfs_stats);
+
 	if (list_empty(&ctrl->list))
 		goto free_ctrl;
 
@@ -2381,6 +2496,7 @@ static blk_status_t nvme_tcp_queue_rq(struct blk_mq_hw_ctx *hctx,
 
 	blk_mq_start_request(rq);
 
+	req->start_ns = READ_ONCE(latency_stats) ? ktime_get_ns() : 0;
 	nvme_tcp_queue_request(req, true, bd->last);
 
 	return BLK_STS_OK;
@@ -2590,6 +2706,9 @@ static struct nvme_ctrl *nvme_tcp_create_ctrl(struct device *dev,
 	list_add_tail(&ctrl->list, &nvme_tcp_ctrl_list);
 	mutex_unlock(&nvme_tcp_ctrl_mutex);
 
+	ctrl->debugfs_stats = debugfs_create_file(dev_name(ctrl->ctrl.device),
+			0400, nvme_tcp_debugfs, ctrl, &nvme_tcp_stats_fops);
+
 	return &ctrl->ctrl;
 
 out_uninit_ctrl:
@@ -2624,6 +2743,7 @@ static int __init nvme_tcp_init_module(void)
 	if (!nvme_tcp_wq)
 		return -ENOMEM;
 
+	nvme_tcp_debugfs = debugfs_create_dir("nvme_tcp", NULL);
 	nvmf_register_transport(&nvme_tcp_transport);
 	return 0;
 }
@@ -2640,6 +2760,7 @@ static void __exit nvme_tcp_cleanup_module(void)
 	mutex_unlock(&nvme_tcp_ctrl_mutex);
 	flush_workqueue(nvme_delete_wq);
 
+	debugfs_remove_recursive(nvme_tcp_debugfs);
 	destroy_workqueue(nvme_tcp_wq);
 }
 
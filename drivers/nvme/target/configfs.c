@@ -248,6 +248,41 @@ static ssize_t nvmet_param_inline_data_size_store(struct config_item *item,
 
 CONFIGFS_ATTR(nvmet_, param_inline_data_size);
 
+static ssize_t nvmet_param_io_cpus_show(struct config_item *item,
+		char *page)
+{
+	struct nvmet_port *port = to_nvmet_port(item);
+
+	return cpumap_print_to_pagebuf(true, page, port->io_cpus);
+}
+
+static ssize_t nvmet_param_io_cpus_store(struct config_item *item,
+		const char *page, size_t count)
+{
+	struct nvmet_port *port = to_nvmet_port(item);
+	cpumask_var_t mask;
+	int ret;
+
+	if (nvmet_is_port_enabled(port, __func__))
+		return -EACCES;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = cpulist_parse(page, mask);
+	if (ret || !cpumask_subset(mask, cpu_possible_mask)) {
+		pr_err("Invalid value '%s' for io_cpus\n", page);
+		free_cpumask_var(mask);
+		return -EINVAL;
+	}
+
+	cpumask_copy(port->io_cpus, mask);
+	free_cpumask_var(mask);
+	return count;
+}
+
+CONFIGFS_ATTR(nvmet_, param_io_cpus);
+
 #ifdef CONFIG_BLK_DEV_INTEGRITY
 static ssize_t nvmet_param_pi_enable_show(struct config_item *item,
 		char *page)
@@ -554,14 +589,25 @@ static ssize_t nvmet_ns_buffered_io_store(struct config_item *item,
 	if (strtobool(page, &val))
 		return -EINVAL;
 
+	/*
+	 * File backed namespaces pick buffered or direct I/O per command, so
+	 * they can be switched while enabled as long as the file supports
+	 * direct I/O.
+	 */
 	mutex_lock(&ns->subsys->lock);
-	if (ns->enabled) {
+	if (ns->enabled && !ns->file) {
 		pr_err("disable ns before setting buffered_io value.\n");
 		mutex_unlock(&ns->subsys->lock);
 		return -EINVAL;
 	}
+	if (ns->enabled && !val && !nvmet_file_ns_can_direct(ns)) {
+		pr_err("file %s does not support direct I/O\n",
+			ns->device_path);
+		mutex_unlock(&ns->subsys->lock);
+		return -EINVAL;
+	}
 
-	ns->buffered_io = val;
+	WRITE_ONCE(ns->buffered_io, val);
 	mutex_unlock(&ns->subsys->lock);
 	return count;
 }
@@ -1596,6 +1642,7 @@ static void nvmet_port_release(struct config_item *item)
 	flush_scheduled_work();
 	list_del(&port->global_entry);
 
+	free_cpumask_var(port->io_cpus);
 	kfree(port->ana_state);
 	kfree(port);
 }
@@ -1607,6 +1654,7 @@ static struct configfs_attribute *nvmet_port_attrs[] = {
 	&nvmet_attr_addr_trsvcid,
 	&nvmet_attr_addr_trtype,
 	&nvmet_attr_param_inline_data_size,
+	&nvmet_attr_param_io_cpus,
 #ifdef CONFIG_BLK_DEV_INTEGRITY
 	&nvmet_attr_param_pi_enable,
 #endif
@@ -1644,6 +1692,12 @@ static struct config_group *nvmet_ports_make(struct config_group *group,
 		return ERR_PTR(-ENOMEM);
 	}
 
+	if (!zalloc_cpumask_var(&port->io_cpus, GFP_KERNEL)) {
+		kfree(port->ana_state);
+		kfree(port);
+		return ERR_PTR(-ENOMEM);
+	}
+
 	for (i = 1; i <= NVMET_MAX_ANAGRPS; i++) {
 		if (i == NVMET_DEFAULT_ANA_GRPID)
 			port->ana_state[1] = NVME_ANA_OPTIMIZED;
@@ -11,7 +11,7 @@
 #include <linux/fs.h>
 #include "nvmet.h"
 
-#define NVMET_MAX_MPOOL_BVEC		16
+#define NVMET_MAX_MPOOL_BVEC		64
 #define NVMET_MIN_MPOOL_OBJ		16
 
 int nvmet_file_ns_revalidate(struct nvmet_ns *ns)
@@ -26,11 +26,18 @@ int nvmet_file_ns_revalidate(struct nvmet_ns *ns)
 	return ret;
 }
 
+bool nvmet_file_ns_can_direct(struct nvmet_ns *ns)
+{
+	struct address_space *mapping = ns->file->f_mapping;
+
+	return mapping->a_ops && mapping->a_ops->direct_IO;
+}
+
 void nvmet_file_ns_disable(struct nvmet_ns *ns)
 {
 	if (ns->file) {
-		if (ns->buffered_io)
-			flush_workqueue(buffered_io_wq);
+		/* buffered_io may have been toggled while enabled */
+		flush_workqueue(buffered_io_wq);
 		mempool_destroy(ns->bvec_pool);
 		ns->bvec_pool = NULL;
 		kmem_cache_destroy(ns->bvec_cache);
@@ -45,9 +52,11 @@ int nvmet_file_ns_enable(struct nvmet_ns *ns)
 	int flags = O_RDWR | O_LARGEFILE;
 	int ret;
 
-	if (!ns->buffered_io)
-		flags |= O_DIRECT;
-
+	/*
+	 * The file is never opened with O_DIRECT: direct I/O is requested per
+	 * command with IOCB_DIRECT, so buffered_io can be switched while the
+	 * namespace is enabled.
+	 */
 	ns->file = filp_open(ns->device_path, flags, 0);
 	if (IS_ERR(ns->file)) {
 		ret = PTR_ERR(ns->file);
@@ -57,6 +66,13 @@ int nvmet_file_ns_enable(struct nvmet_ns *ns)
 		return ret;
 	}
 
+	if (!ns->buffered_io && !nvmet_file_ns_can_direct(ns)) {
+		pr_err("file %s does not support direct I/O\n",
+			ns->device_path);
+		ret = -EINVAL;
+		goto err;
+	}
+
 	ret = nvmet_file_ns_revalidate(ns);
 	if (ret)
 		goto err;
@@ -174,7 +190,8 @@ static bool nvmet_file_execute_io(struct nvmet_req *req, int ki_flags)
 
 		if (unlikely(is_sync) &&
 		    (nr_bvec - 1 == 0 || bv_cnt == NVMET_MAX_MPOOL_BVEC)) {
-			ret = nvmet_file_submit_bvec(req, pos, bv_cnt, len, 0);
+			ret = nvmet_file_submit_bvec(req, pos, bv_cnt, len,
+					ki_flags & IOCB_DIRECT);
 			if (ret < 0)
 				goto complete;
 
@@ -252,27 +269,39 @@ static void nvmet_file_execute_rw(struct nvmet_req *req)
 		return;
 	}
 
-	if (nr_bvec > NVMET_MAX_INLINE_BIOVEC)
-		req->f.bvec = kmalloc_array(nr_bvec, sizeof(struct bio_vec),
-				GFP_KERNEL);
-	else
+	/*
+	 * Commands that fit the per-namespace bvec cache take their array
+	 * from it rather than from kmalloc, its mempool guaranteeing forward
+	 * progress.  Only larger commands hit kmalloc, falling back to the
+	 * pool and chunked synchronous I/O under memory pressure.
+	 */
+	if (nr_bvec <= NVMET_MAX_INLINE_BIOVEC) {
 		req->f.bvec = req->inline_bvec;
-
-	if (unlikely(!req->f.bvec)) {
-		/* fallback under memory pressure */
+		req->f.mpool_alloc = false;
+	} else if (nr_bvec <= NVMET_MAX_MPOOL_BVEC) {
 		req->f.bvec = mempool_alloc(req->ns->bvec_pool, GFP_KERNEL);
 		req->f.mpool_alloc = true;
-	} else
+	} else {
+		req->f.bvec = kmalloc_array(nr_bvec, sizeof(struct bio_vec),
+				GFP_KERNEL);
 		req->f.mpool_alloc = false;
+		if (unlikely(!req->f.bvec)) {
+			/* fallback under memory pressure */
+			req->f.bvec = mempool_alloc(req->ns->bvec_pool,
+					GFP_KERNEL);
+			req->f.mpool_alloc = true;
+		}
+	}
 
-	if (req->ns->buffered_io) {
-		if (likely(!req->f.mpool_alloc) &&
+	if (READ_ONCE(req->ns->buffered_io)) {
+		if (likely(!req->f.mpool_alloc ||
+			   nr_bvec <= NVMET_MAX_MPOOL_BVEC) &&
 		    (req->ns->file->f_mode & FMODE_NOWAIT) &&
 		    nvmet_file_execute_io(req, IOCB_NOWAIT))
 			return;
 		nvmet_file_submit_buffered_io(req);
 	} else
-		nvmet_file_execute_io(req, 0);
+		nvmet_file_execute_io(req, IOCB_DIRECT);
 }
 
 u16 nvmet_file_flush(struct nvmet_req *req)
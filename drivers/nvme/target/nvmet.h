@@ -150,6 +150,8 @@ struct nvmet_port {
 	int				inline_data_size;
 	const struct nvmet_fabrics_ops	*tr_ops;
 	bool				pi_enable;
+	/* CPUs the transport may run per-queue work on, empty = its choice */
+	cpumask_var_t			io_cpus;
 };
 
 static inline struct nvmet_port *to_nvmet_port(struct config_item *item)
@@ -542,6 +544,7 @@ u16 nvmet_file_flush(struct nvmet_req *req);
 void nvmet_ns_changed(struct nvmet_subsys *subsys, u32 nsid);
 void nvmet_bdev_ns_revalidate(struct nvmet_ns *ns);
 int nvmet_file_ns_revalidate(struct nvmet_ns *ns);
+bool nvmet_file_ns_can_direct(struct nvmet_ns *ns);
 void nvmet_ns_revalidate(struct nvmet_ns *ns);
 u16 blk_to_nvme_status(struct nvmet_req *req, blk_status_t blk_sts);
 
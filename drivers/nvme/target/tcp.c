@@ -39,6 +39,16 @@ module_param(idle_poll_period_usecs, int, 0644);
 MODULE_PARM_DESC(idle_poll_period_usecs,
 		"nvmet tcp io_work poll till idle time period in usecs");
 
+/* Set a socket busy poll budget (in usecs) on every queue, so that receives
+ * in io_work spin on the NIC queue instead of waiting for an interrupt.
+ * Most useful together with idle_poll_period_usecs.  Zero keeps the socket
+ * default.
+ */
+static int busy_poll_usecs;
+module_param(busy_poll_usecs, int, 0644);
+MODULE_PARM_DESC(busy_poll_usecs,
+		"nvmet tcp socket busy poll time in usecs (0 = socket default)");
+
 #define NVMET_TCP_RECV_BUDGET		8
 #define NVMET_TCP_SEND_BUDGET		8
 #define NVMET_TCP_IO_WORK_BUDGET	64
@@ -130,6 +140,7 @@ struct nvmet_tcp_queue {
 	struct ahash_request	*rcv_hash;
 
 	unsigned long           poll_end;
+	int			io_cpu;
 
 	spinlock_t		state_lock;
 	enum nvmet_tcp_queue_state state;
@@ -155,6 +166,7 @@ struct nvmet_tcp_port {
 	struct work_struct	accept_work;
 	struct nvmet_port	*nport;
 	struct sockaddr_storage addr;
+	int			last_cpu;
 	void (*data_ready)(struct sock *);
 };
 
@@ -233,9 +245,44 @@ static inline void nvmet_tcp_put_cmd(struct nvmet_tcp_cmd *cmd)
 
 static inline int queue_cpu(struct nvmet_tcp_queue *queue)
 {
+	if (queue->io_cpu >= 0)
+		return queue->io_cpu;
 	return queue->sock->sk->sk_incoming_cpu;
 }
 
+/*
+ * Spread queues round-robin over the port's io_cpus.  Called from the
+ * port's accept work only, and io_cpus can't change while the port is
+ * enabled, so no locking is needed.
+ */
+static int nvmet_tcp_pick_io_cpu(struct nvmet_tcp_port *port)
+{
+	const struct cpumask *mask = port->nport->io_cpus;
+	int cpu;
+
+	if (cpumask_empty(mask))
+		return -1;
+
+	cpu = cpumask_next_and(port->last_cpu, mask, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first_and(mask, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		return -1;
+
+	port->last_cpu = cpu;
+	return cpu;
+}
+
+/*
+ * Whether more PDUs are queued behind the current one, so it can be sent
+ * with MSG_MORE and coalesced with them.  Responses still sitting on the
+ * lockless resp_list count as well.
+ */
+static inline bool nvmet_tcp_more_to_send(struct nvmet_tcp_queue *queue)
+{
+	return queue->send_list_len || !llist_empty(&queue->resp_list);
+}
+
 static inline u8 nvmet_tcp_hdgst_len(struct nvmet_tcp_queue *queue)
 {
 	return queue->hdr_digest ? NVME_TCP_DIGEST_LENGTH : 0;
@@ -614,7 +661,7 @@ static int nvmet_try_send_data(struct nvmet_tcp_cmd *cmd, bool last_in_batch)
 		u32 left = cmd->cur_sg->length - cmd->offset;
 		int flags = MSG_DONTWAIT;
 
-		if ((!last_in_batch && cmd->queue->send_list_len) ||
+		if ((!last_in_batch && nvmet_tcp_more_to_send(queue)) ||
 		    cmd->wbytes_done + left < cmd->req.transfer_len ||
 		    queue->data_digest || !queue->nvme_sq.sqhd_disabled)
 			flags |= MSG_MORE | MSG_SENDPAGE_NOTLAST;
@@ -661,7 +708,7 @@ static int nvmet_try_send_response(struct nvmet_tcp_cmd *cmd,
 	int flags = MSG_DONTWAIT;
 	int ret;
 
-	if (!last_in_batch && cmd->queue->send_list_len)
+	if (!last_in_batch && nvmet_tcp_more_to_send(cmd->queue))
 		flags |= MSG_MORE | MSG_SENDPAGE_NOTLAST;
 	else
 		flags |= MSG_EOR;
@@ -689,7 +736,7 @@ static int nvmet_try_send_r2t(struct nvmet_tcp_cmd *cmd, bool last_in_batch)
 	int flags = MSG_DONTWAIT;
 	int ret;
 
-	if (!last_in_batch && cmd->queue->send_list_len)
+	if (!last_in_batch && nvmet_tcp_more_to_send(cmd->queue))
 		flags |= MSG_MORE | MSG_SENDPAGE_NOTLAST;
 	else
 		flags |= MSG_EOR;
@@ -719,7 +766,7 @@ static int nvmet_try_send_ddgst(struct nvmet_tcp_cmd *cmd, bool last_in_batch)
 	};
 	int ret;
 
-	if (!last_in_batch && cmd->queue->send_list_len)
+	if (!last_in_batch && nvmet_tcp_more_to_send(queue))
 		msg.msg_flags |= MSG_MORE;
 	else
 		msg.msg_flags |= MSG_EOR;
@@ -1295,13 +1342,20 @@ static void nvmet_tcp_io_work(struct work_struct *w)
 {
 	struct nvmet_tcp_queue *queue =
 		container_of(w, struct nvmet_tcp_queue, io_work);
+	struct blk_plug plug;
 	bool pending;
 	int ret, ops = 0;
 
 	do {
 		pending = false;
 
+		/*
+		 * Commands are executed as they are received; plug so that the
+		 * backend I/O of a whole receive batch is submitted together.
+		 */
+		blk_start_plug(&plug);
 		ret = nvmet_tcp_try_recv(queue, NVMET_TCP_RECV_BUDGET, &ops);
+		blk_finish_plug(&plug);
 		if (ret > 0)
 			pending = true;
 		else if (ret < 0)
@@ -1567,6 +1621,14 @@ static int nvmet_tcp_set_queue_sock(struct nvmet_tcp_queue *queue)
 	if (inet->rcv_tos > 0)
 		ip_sock_set_tos(sock->sk, inet->rcv_tos);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	if (busy_poll_usecs > 0) {
+		lock_sock(sock->sk);
+		WRITE_ONCE(sock->sk->sk_ll_usec, busy_poll_usecs);
+		release_sock(sock->sk);
+	}
+#endif
+
 	ret = 0;
 	write_lock_bh(&sock->sk->sk_callback_lock);
 	if (sock->sk->sk_state != TCP_ESTABLISHED) {
@@ -1606,6 +1668,7 @@ static int nvmet_tcp_alloc_queue(struct nvmet_tcp_port *port,
 	INIT_WORK(&queue->io_work, nvmet_tcp_io_work);
 	queue->sock = newsock;
 	queue->port = port;
+	queue->io_cpu = nvmet_tcp_pick_io_cpu(port);
 	queue->nr_cmds = 0;
 	spin_lock_init(&queue->state_lock);
 	queue->state = NVMET_TCP_Q_CONNECTING;
@@ -1722,6 +1785,7 @@ static int nvmet_tcp_add_port(struct nvmet_port *nport)
 	}
 
 	port->nport = nport;
+	port->last_cpu = -1;
 	INIT_WORK(&port->accept_work, nvmet_tcp_accept_work);
 	if (port->nport->inline_data_size < 0)
 		port->nport->inline_data_size = NVMET_TCP_DEF_INLINE_DATA_SIZE;
@@ -19,9 +19,15 @@
 #include "v9fs_vfs.h"
 #include "fid.h"
 
+/*
+ * The fid lists hanging off dentries and inodes are modified under
+ * d_lock and i_lock respectively, but searched under RCU: fids are freed
+ * after a grace period, and a fid whose last reference is being dropped
+ * is skipped.
+ */
 static inline void __add_fid(struct dentry *dentry, struct p9_fid *fid)
 {
-	hlist_add_head(&fid->dlist, (struct hlist_head *)&dentry->d_fsdata);
+	hlist_add_head_rcu(&fid->dlist, (struct hlist_head *)&dentry->d_fsdata);
 }
 
 
@@ -52,16 +58,16 @@ static struct p9_fid *v9fs_fid_find_inode(struct inode *inode, kuid_t uid)
 
 	p9_debug(P9_DEBUG_VFS, " inode: %p\n", inode);
 
-	spin_lock(&inode->i_lock);
+	rcu_read_lock();
 	h = (struct hlist_head *)&inode->i_private;
-	hlist_for_each_entry(fid, h, ilist) {
-		if (uid_eq(fid->uid, uid)) {
-			refcount_inc(&fid->count);
+	hlist_for_each_entry_rcu(fid, h, ilist) {
+		if (uid_eq(fid->uid, uid) &&
+		    refcount_inc_not_zero(&fid->count)) {
 			ret = fid;
 			break;
 		}
 	}
-	spin_unlock(&inode->i_lock);
+	rcu_read_unlock();
 	return ret;
 }
 
@@ -75,7 +81,7 @@ static struct p9_fid *v9fs_fid_find_inode(struct inode *inode, kuid_t uid)
 void v9fs_open_fid_add(struct inode *inode, struct p9_fid *fid)
 {
 	spin_lock(&inode->i_lock);
-	hlist_add_head(&fid->ilist, (struct hlist_head *)&inode->i_private);
+	hlist_add_head_rcu(&fid->ilist, (struct hlist_head *)&inode->i_private);
 	spin_unlock(&inode->i_lock);
 }
 
@@ -100,19 +106,18 @@ static struct p9_fid *v9fs_fid_find(struct dentry *dentry, kuid_t uid, int any)
 	if (d_inode(dentry))
 		ret = v9fs_fid_find_inode(d_inode(dentry), uid);
 
-	/* we'll recheck under lock if there's anything to look in */
 	if (!ret && dentry->d_fsdata) {
 		struct hlist_head *h = (struct hlist_head *)&dentry->d_fsdata;
 
-		spin_lock(&dentry->d_lock);
-		hlist_for_each_entry(fid, h, dlist) {
-			if (any || uid_eq(fid->uid, uid)) {
+		rcu_read_lock();
+		hlist_for_each_entry_rcu(fid, h, dlist) {
+			if ((any || uid_eq(fid->uid, uid)) &&
+			    refcount_inc_not_zero(&fid->count)) {
 				ret = fid;
-				refcount_inc(&ret->count);
 				break;
 			}
 		}
-		spin_unlock(&dentry->d_lock);
+		rcu_read_unlock();
 	}
 
 	return ret;
@@ -17,6 +17,7 @@
 #include <linux/idr.h>
 #include <linux/slab.h>
 #include <linux/seq_file.h>
+#include <linux/workqueue.h>
 #include <net/9p/9p.h>
 #include <net/9p/client.h>
 #include <net/9p/transport.h>
@@ -27,6 +28,8 @@
 static DEFINE_SPINLOCK(v9fs_sessionlist_lock);
 static LIST_HEAD(v9fs_sessionlist);
 struct kmem_cache *v9fs_inode_cache;
+/* Runs asynchronous reads and writeback RPCs */
+struct workqueue_struct *v9fs_io_wq;
 
 /*
  * Option Parsing (code inspired by NFS code)
@@ -46,6 +49,8 @@ enum {
 	Opt_access, Opt_posixacl,
 	/* Lock timeout option */
 	Opt_locktimeout,
+	/* Attribute and negative dentry lifetime */
+	Opt_cache_ttl,
 	/* Error token */
 	Opt_err
 };
@@ -66,6 +71,7 @@ static const match_table_t tokens = {
 	{Opt_access, "access=%s"},
 	{Opt_posixacl, "posixacl"},
 	{Opt_locktimeout, "locktimeout=%u"},
+	{Opt_cache_ttl, "cache_ttl=%u"},
 	{Opt_err, NULL}
 };
 
@@ -127,6 +133,9 @@ int v9fs_show_options(struct seq_file *m, struct dentry *root)
 	if (v9ses->cachetag && v9ses->cache == CACHE_FSCACHE)
 		seq_printf(m, ",cachetag=%s", v9ses->cachetag);
 #endif
+	if (v9ses->cache_ttl)
+		seq_printf(m, ",cache_ttl=%u",
+			   jiffies_to_msecs(v9ses->cache_ttl));
 
 	switch (v9ses->flags & V9FS_ACCESS_MASK) {
 	case V9FS_ACCESS_USER:
@@ -367,6 +376,23 @@ static int v9fs_parse_options(struct v9fs_session_info *v9ses, char *opts)
 			v9ses->session_lock_timeout = (long)option * HZ;
 			break;
 
+		case Opt_cache_ttl:
+			r = match_int(&args[0], &option);
+			if (r < 0) {
+				p9_debug(P9_DEBUG_ERROR,
+					 "integer field, but no integer?\n");
+				ret = r;
+				continue;
+			}
+			if (option < 0) {
+				p9_debug(P9_DEBUG_ERROR,
+					 "cache_ttl must be a non-negative number of milliseconds.\n");
+				ret = -EINVAL;
+				continue;
+			}
+			v9ses->cache_ttl = msecs_to_jiffies(option);
+			break;
+
 		default:
 			continue;
 		}
@@ -694,10 +720,16 @@ static int __init init_v9fs(void)
 		return err;
 	}
 
+	v9fs_io_wq = alloc_workqueue("v9fs_io", WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+	if (!v9fs_io_wq) {
+		err = -ENOMEM;
+		goto out_cache;
+	}
+
 	err = v9fs_sysfs_init();
 	if (err < 0) {
 		pr_err("Failed to register with sysfs\n");
-		goto out_cache;
+		goto out_wq;
 	}
 	err = register_filesystem(&v9fs_fs_type);
 	if (err < 0) {
@@ -710,6 +742,9 @@ static int __init init_v9fs(void)
 out_sysfs_cleanup:
 	v9fs_sysfs_cleanup();
 
+out_wq:
+	destroy_workqueue(v9fs_io_wq);
+
 out_cache:
 	v9fs_cache_unregister();
 
@@ -726,6 +761,7 @@ static void __exit exit_v9fs(void)
 	v9fs_sysfs_cleanup();
 	v9fs_cache_unregister();
 	unregister_filesystem(&v9fs_fs_type);
+	destroy_workqueue(v9fs_io_wq);
 }
 
 module_init(init_v9fs)
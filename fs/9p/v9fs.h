@@ -38,6 +38,26 @@ enum p9_session_flags {
 	V9FS_POSIX_ACL		= 0x20
 };
 
+/**
+ * struct v9fs_cache_stats - cache_ttl counters, reported in mountstats
+ * @dentry_hit: positive dentries trusted without a round trip
+ * @dentry_miss: positive dentries revalidated with the server
+ * @neg_hit: negative dentries trusted without a round trip
+ * @neg_miss: negative dentries dropped and looked up again
+ * @dir_revalidate: negative dentries renewed by one getattr of their parent
+ * @attr_hit: getattr answered from the inode
+ * @attr_miss: getattr sent to the server
+ */
+struct v9fs_cache_stats {
+	atomic64_t dentry_hit;
+	atomic64_t dentry_miss;
+	atomic64_t neg_hit;
+	atomic64_t neg_miss;
+	atomic64_t dir_revalidate;
+	atomic64_t attr_hit;
+	atomic64_t attr_miss;
+};
+
 /* possible values of ->cache */
 /**
  * enum p9_cache_modes - user specified cache preferences
@@ -72,6 +92,9 @@ enum p9_cache_modes {
  * @uid: if %V9FS_ACCESS_SINGLE, the numeric uid which mounted the hierarchy
  * @clnt: reference to 9P network client instantiated for this session
  * @slist: reference to list of registered 9p sessions
+ * @cache_ttl: jiffies for which attributes and negative dentries are trusted
+ *             without asking the server, 0 if disabled
+ * @stats: hit/miss counters for @cache_ttl
  *
  * This structure holds state for each session instance established during
  * a sys_mount() .
@@ -102,8 +125,12 @@ struct v9fs_session_info {
 	struct list_head slist; /* list of sessions registered with v9fs */
 	struct rw_semaphore rename_sem;
 	long session_lock_timeout; /* retry interval for blocking locks */
+	unsigned long cache_ttl;
+	struct v9fs_cache_stats stats;
 };
 
+#define v9fs_stat_inc(v9ses, field) atomic64_inc(&(v9ses)->stats.field)
+
 /* cache_validity flags */
 #define V9FS_INO_INVALID_ATTR 0x01
 
@@ -113,8 +140,12 @@ struct v9fs_inode {
 #endif
 	struct p9_qid qid;
 	unsigned int cache_validity;
+	unsigned long attr_time;	/* jiffies of the last attribute fetch */
+	unsigned long dir_changed;	/* jiffies a directory was seen to change */
+	u32 dir_version;		/* qid.version seen by that fetch */
 	struct p9_fid *writeback_fid;
 	struct mutex v_mutex;
+	atomic_t writeback_inflight;
 	struct inode vfs_inode;
 };
 
@@ -184,6 +215,16 @@ static inline struct v9fs_session_info *v9fs_dentry2v9ses(struct dentry *dentry)
 	return dentry->d_sb->s_fs_info;
 }
 
+/*
+ * cache_ttl only applies to the modes that otherwise ask the server on
+ * every lookup and stat; loose and fscache already trust the client.
+ */
+static inline bool v9fs_ttl_enabled(struct v9fs_session_info *v9ses)
+{
+	return v9ses->cache_ttl &&
+	       v9ses->cache != CACHE_LOOSE && v9ses->cache != CACHE_FSCACHE;
+}
+
 static inline int v9fs_proto_dotu(struct v9fs_session_info *v9ses)
 {
 	return v9ses->flags & V9FS_PROTO_2000U;
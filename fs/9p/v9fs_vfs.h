@@ -36,11 +36,13 @@ extern const struct file_operations v9fs_dir_operations;
 extern const struct file_operations v9fs_dir_operations_dotl;
 extern const struct dentry_operations v9fs_dentry_operations;
 extern const struct dentry_operations v9fs_cached_dentry_operations;
+extern const struct dentry_operations v9fs_ttl_dentry_operations;
 extern const struct file_operations v9fs_cached_file_operations;
 extern const struct file_operations v9fs_cached_file_operations_dotl;
 extern const struct file_operations v9fs_mmap_file_operations;
 extern const struct file_operations v9fs_mmap_file_operations_dotl;
 extern struct kmem_cache *v9fs_inode_cache;
+extern struct workqueue_struct *v9fs_io_wq;
 
 struct inode *v9fs_alloc_inode(struct super_block *sb);
 void v9fs_free_inode(struct inode *inode);
@@ -66,6 +68,9 @@ int v9fs_file_fsync_dotl(struct file *filp, loff_t start, loff_t end,
 			 int datasync);
 int v9fs_refresh_inode(struct p9_fid *fid, struct inode *inode);
 int v9fs_refresh_inode_dotl(struct p9_fid *fid, struct inode *inode);
+void v9fs_attr_refreshed(struct inode *inode, u32 version,
+			 const struct timespec64 *mtime,
+			 const struct timespec64 *ctime);
 static inline void v9fs_invalidate_inode_attr(struct inode *inode)
 {
 	struct v9fs_inode *v9inode;
@@ -74,6 +79,19 @@ static inline void v9fs_invalidate_inode_attr(struct inode *inode)
 	v9inode->cache_validity |= V9FS_INO_INVALID_ATTR;
 }
 
+/*
+ * Under cache_ttl, attributes fetched less than cache_ttl ago and not
+ * invalidated by a local change can be used without a round trip.
+ */
+static inline bool v9fs_attr_fresh(struct v9fs_session_info *v9ses,
+				   struct inode *inode)
+{
+	struct v9fs_inode *v9inode = V9FS_I(inode);
+
+	return !(v9inode->cache_validity & V9FS_INO_INVALID_ATTR) &&
+	       time_before(jiffies, v9inode->attr_time + v9ses->cache_ttl);
+}
+
 int v9fs_open_to_dotl_flags(int flags);
 
 static inline void v9fs_i_size_write(struct inode *inode, loff_t i_size)
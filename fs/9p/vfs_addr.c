@@ -19,6 +19,8 @@
 #include <linux/swap.h>
 #include <linux/uio.h>
 #include <linux/netfs.h>
+#include <linux/workqueue.h>
+#include <linux/writeback.h>
 #include <net/9p/9p.h>
 #include <net/9p/client.h>
 
@@ -27,11 +29,47 @@
 #include "cache.h"
 #include "fid.h"
 
+/* Maximum number of writeback Twrites kept in flight per inode */
+#define V9FS_WRITEBACK_MAX_INFLIGHT	4
+
 /**
- * v9fs_req_issue_op - Issue a read from 9P
+ * struct v9fs_read_work - asynchronous read of one netfs subrequest
+ * @work: work item queued on v9fs_io_wq
+ * @subreq: the subrequest to fill
+ */
+struct v9fs_read_work {
+	struct work_struct work;
+	struct netfs_read_subrequest *subreq;
+};
+
+/**
+ * v9fs_clamp_length - Limit a subrequest to what fits in a single Tread
+ * @subreq: The subrequest to clamp
+ *
+ * Keeping each subrequest within one RPC lets netfs split a large read
+ * into several subrequests that we then issue in parallel, each on its
+ * own tag.
+ */
+static bool v9fs_clamp_length(struct netfs_read_subrequest *subreq)
+{
+	struct p9_fid *fid = subreq->rreq->netfs_priv;
+	size_t max = fid->clnt->msize - P9_IOHDRSZ;
+
+	if (fid->iounit && fid->iounit < max)
+		max = fid->iounit;
+	if (max >= PAGE_SIZE)
+		max = round_down(max, PAGE_SIZE);
+
+	subreq->len = min_t(size_t, subreq->len, max);
+	return true;
+}
+
+/**
+ * v9fs_req_read - Read a subrequest from 9P and complete it
  * @subreq: The read to make
+ * @was_async: True if called from a worker rather than the issuer
  */
-static void v9fs_req_issue_op(struct netfs_read_subrequest *subreq)
+static void v9fs_req_read(struct netfs_read_subrequest *subreq, bool was_async)
 {
 	struct netfs_read_request *rreq = subreq->rreq;
 	struct p9_fid *fid = rreq->netfs_priv;
@@ -48,7 +86,39 @@ static void v9fs_req_issue_op(struct netfs_read_subrequest *subreq)
 	 * cache won't be on server and is zeroes */
 	__set_bit(NETFS_SREQ_CLEAR_TAIL, &subreq->flags);
 
-	netfs_subreq_terminated(subreq, err ?: total, false);
+	netfs_subreq_terminated(subreq, err ?: total, was_async);
+}
+
+static void v9fs_req_read_work(struct work_struct *work)
+{
+	struct v9fs_read_work *rw = container_of(work, struct v9fs_read_work,
+						 work);
+
+	v9fs_req_read(rw->subreq, true);
+	kfree(rw);
+}
+
+/**
+ * v9fs_req_issue_op - Issue a read from 9P
+ * @subreq: The read to make
+ *
+ * The Tread is sent from v9fs_io_wq so that the subrequests of one
+ * netfs read are outstanding concurrently.  If we cannot allocate the
+ * work item, fall back to reading synchronously.
+ */
+static void v9fs_req_issue_op(struct netfs_read_subrequest *subreq)
+{
+	struct v9fs_read_work *rw;
+
+	rw = kmalloc(sizeof(*rw), GFP_NOFS);
+	if (!rw) {
+		v9fs_req_read(subreq, false);
+		return;
+	}
+
+	INIT_WORK(&rw->work, v9fs_req_read_work);
+	rw->subreq = subreq;
+	queue_work(v9fs_io_wq, &rw->work);
 }
 
 /**
@@ -106,6 +176,7 @@ static const struct netfs_read_request_ops v9fs_req_ops = {
 	.init_rreq		= v9fs_init_rreq,
 	.is_cache_enabled	= v9fs_is_cache_enabled,
 	.begin_cache_operation	= v9fs_begin_cache_operation,
+	.clamp_length		= v9fs_clamp_length,
 	.issue_op		= v9fs_req_issue_op,
 	.cleanup		= v9fs_req_cleanup,
 };
@@ -249,6 +320,281 @@ static int v9fs_vfs_writepage(struct page *page, struct writeback_control *wbc)
 	return retval;
 }
 
+/**
+ * struct v9fs_wb_req - one coalesced writeback Twrite
+ * @work: work item queued on v9fs_io_wq
+ * @mapping: mapping the folios belong to
+ * @fid: writeback fid, referenced for the lifetime of the request
+ * @start: file offset of the first byte to write
+ * @len: number of bytes to write, zero if the range now lies beyond EOF
+ * @first: index of the first page under writeback
+ * @last: index of the last page under writeback
+ */
+struct v9fs_wb_req {
+	struct work_struct work;
+	struct address_space *mapping;
+	struct p9_fid *fid;
+	loff_t start;
+	size_t len;
+	pgoff_t first;
+	pgoff_t last;
+};
+
+static int v9fs_wb_req_write(struct v9fs_wb_req *req)
+{
+	struct iov_iter from;
+	int err = 0;
+
+	if (req->len) {
+		iov_iter_xarray(&from, WRITE, &req->mapping->i_pages,
+				req->start, req->len);
+		p9_client_write(req->fid, req->start, &from, &err);
+	}
+	p9_client_clunk(req->fid);
+	return err;
+}
+
+/*
+ * End writeback on every folio of a request.  Once the last folio is
+ * released the inode may be evicted, so nothing but the mapping's xarray
+ * may be touched from here on.
+ */
+static void v9fs_wb_req_complete(struct v9fs_wb_req *req, int err)
+{
+	XA_STATE(xas, &req->mapping->i_pages, req->first);
+	struct folio *folio;
+
+	p9_debug(P9_DEBUG_VFS, "pages %lu-%lu err %d\n",
+		 req->first, req->last, err);
+
+	if (err)
+		mapping_set_error(req->mapping, err);
+
+	rcu_read_lock();
+	xas_for_each(&xas, folio, req->last) {
+		if (xas_retry(&xas, folio))
+			continue;
+		WARN_ON(!folio_test_writeback(folio));
+		folio_end_writeback(folio);
+	}
+	rcu_read_unlock();
+}
+
+static void v9fs_wb_req_work(struct work_struct *work)
+{
+	struct v9fs_wb_req *req = container_of(work, struct v9fs_wb_req, work);
+	struct v9fs_inode *v9inode = V9FS_I(req->mapping->host);
+	int err;
+
+	err = v9fs_wb_req_write(req);
+
+	atomic_dec(&v9inode->writeback_inflight);
+	wake_up_var(&v9inode->writeback_inflight);
+
+	v9fs_wb_req_complete(req, err);
+	kfree(req);
+}
+
+/*
+ * Send a range of folios that are already under writeback.  Up to
+ * V9FS_WRITEBACK_MAX_INFLIGHT requests per inode are handed to
+ * v9fs_io_wq; beyond that we throttle until one of them completes.
+ */
+static void v9fs_wb_submit(struct address_space *mapping, loff_t start,
+			   size_t len, pgoff_t first, pgoff_t last)
+{
+	struct v9fs_inode *v9inode = V9FS_I(mapping->host);
+	struct v9fs_wb_req *req, sync_req;
+
+	/* We should have writeback_fid always set */
+	BUG_ON(!v9inode->writeback_fid);
+
+	req = kmalloc(sizeof(*req), GFP_NOFS);
+	if (!req)
+		req = &sync_req;
+
+	req->mapping = mapping;
+	req->fid = v9inode->writeback_fid;
+	req->start = start;
+	req->len = len;
+	req->first = first;
+	req->last = last;
+	refcount_inc(&req->fid->count);
+
+	if (req == &sync_req) {
+		v9fs_wb_req_complete(req, v9fs_wb_req_write(req));
+		return;
+	}
+
+	wait_var_event(&v9inode->writeback_inflight,
+		       atomic_add_unless(&v9inode->writeback_inflight, 1,
+					 V9FS_WRITEBACK_MAX_INFLIGHT));
+	INIT_WORK(&req->work, v9fs_wb_req_work);
+	queue_work(v9fs_io_wq, &req->work);
+}
+
+/*
+ * Start writeback on a locked dirty folio and on as many contiguous dirty
+ * folios after it as fit in one Twrite, then send them.  The folio is
+ * unlocked on return; *_next is set to the first index not covered.
+ */
+static void v9fs_write_back_from_locked_folio(struct address_space *mapping,
+					      struct writeback_control *wbc,
+					      struct folio *folio,
+					      pgoff_t end, pgoff_t *_next)
+{
+	struct inode *inode = mapping->host;
+	struct v9fs_session_info *v9ses = v9fs_inode2v9ses(inode);
+	size_t max_len = v9ses->clnt->msize - P9_IOHDRSZ;
+	loff_t start = folio_pos(folio);
+	loff_t i_size = i_size_read(inode);
+	pgoff_t first = folio_index(folio);
+	pgoff_t last = first + folio_nr_pages(folio) - 1;
+	size_t len = folio_size(folio);
+	long count = folio_nr_pages(folio);
+	struct folio *next;
+
+	folio_clear_dirty_for_io(folio);
+	folio_start_writeback(folio);
+	folio_unlock(folio);
+
+	while (last < end && len < max_len && start + len < i_size) {
+		next = __filemap_get_folio(mapping, last + 1, 0, 0);
+		if (!next)
+			break;
+		if (!folio_trylock(next)) {
+			folio_put(next);
+			break;
+		}
+		if (next->mapping != mapping || !folio_test_dirty(next) ||
+		    folio_test_writeback(next) ||
+		    len + folio_size(next) > max_len) {
+			folio_unlock(next);
+			folio_put(next);
+			break;
+		}
+
+		folio_clear_dirty_for_io(next);
+		folio_start_writeback(next);
+		folio_unlock(next);
+
+		last += folio_nr_pages(next);
+		len += folio_size(next);
+		count += folio_nr_pages(next);
+		folio_put(next);
+	}
+
+	*_next = last + 1;
+	wbc->nr_to_write -= count;
+
+	if (start >= i_size)
+		len = 0; /* Simultaneous truncation occurred */
+	else
+		len = min_t(loff_t, i_size - start, len);
+
+	v9fs_wb_submit(mapping, start, len, first, last);
+}
+
+/*
+ * Write back the dirty folios in [index, end].  *_next is set to where a
+ * cyclic writeback should resume.
+ */
+static int v9fs_writepages_region(struct address_space *mapping,
+				  struct writeback_control *wbc,
+				  pgoff_t index, pgoff_t end, pgoff_t *_next)
+{
+	struct folio *folio;
+	struct page *head_page;
+	int ret;
+
+	do {
+		if (!find_get_pages_range_tag(mapping, &index, end,
+					      PAGECACHE_TAG_DIRTY, 1,
+					      &head_page))
+			break;
+		folio = page_folio(head_page);
+
+		if (wbc->sync_mode != WB_SYNC_NONE) {
+			ret = folio_lock_killable(folio);
+			if (ret < 0) {
+				folio_put(folio);
+				return ret;
+			}
+		} else if (!folio_trylock(folio)) {
+			folio_put(folio);
+			continue;
+		}
+
+		if (folio_mapping(folio) != mapping ||
+		    !folio_test_dirty(folio)) {
+			folio_unlock(folio);
+			folio_put(folio);
+			continue;
+		}
+
+		if (folio_test_writeback(folio)) {
+			folio_unlock(folio);
+			if (wbc->sync_mode != WB_SYNC_NONE) {
+				folio_wait_writeback(folio);
+				/* Still dirty: look at it again */
+				index = folio_index(folio);
+			}
+			folio_put(folio);
+			continue;
+		}
+
+		v9fs_write_back_from_locked_folio(mapping, wbc, folio, end,
+						  &index);
+		folio_put(folio);
+	} while (index <= end &&
+		 (wbc->nr_to_write > 0 || wbc->sync_mode == WB_SYNC_ALL));
+
+	*_next = index;
+	return 0;
+}
+
+/**
+ * v9fs_writepages - Write back dirty folios of a mapping
+ * @mapping: The mapping to write back
+ * @wbc: The writeback control
+ *
+ * Contiguous dirty folios are coalesced into Twrites of up to msize, and
+ * several of those are kept in flight per inode.  When the inode is
+ * cached by fscache, fall back to writing one folio at a time so that
+ * each one is also written to the cache.
+ */
+static int v9fs_writepages(struct address_space *mapping,
+			   struct writeback_control *wbc)
+{
+	pgoff_t start, next;
+	int ret;
+
+	if (v9fs_is_cache_enabled(mapping->host))
+		return generic_writepages(mapping, wbc);
+
+	if (wbc->range_cyclic) {
+		start = mapping->writeback_index;
+		next = start;
+		ret = v9fs_writepages_region(mapping, wbc, start, ULONG_MAX,
+					     &next);
+		if (ret == 0 && start > 0 && wbc->nr_to_write > 0)
+			ret = v9fs_writepages_region(mapping, wbc, 0, start - 1,
+						     &next);
+		mapping->writeback_index = next;
+	} else if (wbc->range_start == 0 && wbc->range_end == LLONG_MAX) {
+		ret = v9fs_writepages_region(mapping, wbc, 0, ULONG_MAX, &next);
+		if (wbc->nr_to_write > 0)
+			mapping->writeback_index = next;
+	} else {
+		ret = v9fs_writepages_region(mapping, wbc,
+					     wbc->range_start >> PAGE_SHIFT,
+					     wbc->range_end >> PAGE_SHIFT,
+					     &next);
+	}
+
+	return ret;
+}
+
 /**
  * v9fs_launder_page - Writeback a dirty page
  * @page: The page to be cleaned up
@@ -391,6 +737,7 @@ const struct address_space_operations v9fs_addr_operations = {
 	.readahead = v9fs_vfs_readahead,
 	.set_page_dirty = v9fs_set_page_dirty,
 	.writepage = v9fs_vfs_writepage,
+	.writepages = v9fs_writepages,
 	.write_begin = v9fs_write_begin,
 	.write_end = v9fs_write_end,
 	.releasepage = v9fs_release_page,
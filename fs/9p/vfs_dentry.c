@@ -58,9 +58,40 @@ static void v9fs_dentry_release(struct dentry *dentry)
 	dentry->d_fsdata = NULL;
 }
 
-static int v9fs_lookup_revalidate(struct dentry *dentry, unsigned int flags)
+/**
+ * v9fs_refresh_dentry - fetch the attributes of a positive dentry
+ * @dentry: dentry to refresh
+ * @inode: its inode
+ *
+ * Returns 1 if the dentry is still valid, 0 if the file is gone on the
+ * server, or a negative error.
+ */
+static int v9fs_refresh_dentry(struct dentry *dentry, struct inode *inode)
 {
+	struct v9fs_session_info *v9ses;
 	struct p9_fid *fid;
+	int retval;
+
+	fid = v9fs_fid_lookup(dentry);
+	if (IS_ERR(fid))
+		return PTR_ERR(fid);
+
+	v9ses = v9fs_inode2v9ses(inode);
+	if (v9fs_proto_dotl(v9ses))
+		retval = v9fs_refresh_inode_dotl(fid, inode);
+	else
+		retval = v9fs_refresh_inode(fid, inode);
+	p9_client_clunk(fid);
+
+	if (retval == -ENOENT)
+		return 0;
+	if (retval < 0)
+		return retval;
+	return 1;
+}
+
+static int v9fs_lookup_revalidate(struct dentry *dentry, unsigned int flags)
+{
 	struct inode *inode;
 	struct v9fs_inode *v9inode;
 
@@ -72,30 +103,80 @@ static int v9fs_lookup_revalidate(struct dentry *dentry, unsigned int flags)
 		goto out_valid;
 
 	v9inode = V9FS_I(inode);
-	if (v9inode->cache_validity & V9FS_INO_INVALID_ATTR) {
-		int retval;
-		struct v9fs_session_info *v9ses;
-
-		fid = v9fs_fid_lookup(dentry);
-		if (IS_ERR(fid))
-			return PTR_ERR(fid);
-
-		v9ses = v9fs_inode2v9ses(inode);
-		if (v9fs_proto_dotl(v9ses))
-			retval = v9fs_refresh_inode_dotl(fid, inode);
-		else
-			retval = v9fs_refresh_inode(fid, inode);
-		p9_client_clunk(fid);
-
-		if (retval == -ENOENT)
-			return 0;
-		if (retval < 0)
-			return retval;
-	}
+	if (v9inode->cache_validity & V9FS_INO_INVALID_ATTR)
+		return v9fs_refresh_dentry(dentry, inode);
 out_valid:
 	return 1;
 }
 
+/**
+ * v9fs_ttl_revalidate_negative - revalidate an expired negative dentry
+ * @v9ses: session the dentry belongs to
+ * @dentry: negative dentry whose cache_ttl has run out
+ *
+ * Rather than walking to the name again, refresh the parent directory
+ * (at most once per cache_ttl, however many negative children it has).
+ * If the directory has not changed since the dentry was looked up, the
+ * name still does not exist and the dentry gets a new lease.
+ */
+static int v9fs_ttl_revalidate_negative(struct v9fs_session_info *v9ses,
+					struct dentry *dentry)
+{
+	struct dentry *parent;
+	struct inode *dir;
+	int ret = 1;
+
+	parent = dget_parent(dentry);
+	dir = d_inode(parent);
+	if (!v9fs_attr_fresh(v9ses, dir))
+		ret = v9fs_refresh_dentry(parent, dir);
+
+	if (ret > 0 && time_after(dentry->d_time, V9FS_I(dir)->dir_changed)) {
+		v9fs_stat_inc(v9ses, dir_revalidate);
+		dentry->d_time = jiffies;
+	} else {
+		v9fs_stat_inc(v9ses, neg_miss);
+		ret = 0;
+	}
+	dput(parent);
+	return ret;
+}
+
+/**
+ * v9fs_ttl_revalidate - revalidate a dentry under cache_ttl
+ * @dentry: dentry in question
+ * @flags: lookup flags
+ *
+ * Dentries are trusted for cache_ttl after the attributes of their inode,
+ * or for negative dentries the lookup, came from the server.
+ */
+static int v9fs_ttl_revalidate(struct dentry *dentry, unsigned int flags)
+{
+	struct v9fs_session_info *v9ses = v9fs_dentry2v9ses(dentry);
+	struct inode *inode;
+
+	inode = d_inode_rcu(dentry);
+	if (!inode) {
+		if (time_before(jiffies, dentry->d_time + v9ses->cache_ttl)) {
+			v9fs_stat_inc(v9ses, neg_hit);
+			return 1;
+		}
+		if (flags & LOOKUP_RCU)
+			return -ECHILD;
+		return v9fs_ttl_revalidate_negative(v9ses, dentry);
+	}
+
+	if (v9fs_attr_fresh(v9ses, inode)) {
+		v9fs_stat_inc(v9ses, dentry_hit);
+		return 1;
+	}
+	if (flags & LOOKUP_RCU)
+		return -ECHILD;
+
+	v9fs_stat_inc(v9ses, dentry_miss);
+	return v9fs_refresh_dentry(dentry, inode);
+}
+
 const struct dentry_operations v9fs_cached_dentry_operations = {
 	.d_revalidate = v9fs_lookup_revalidate,
 	.d_weak_revalidate = v9fs_lookup_revalidate,
@@ -107,3 +188,10 @@ const struct dentry_operations v9fs_dentry_operations = {
 	.d_delete = always_delete_dentry,
 	.d_release = v9fs_dentry_release,
 };
+
+/* Keep dentries, negative ones included, for v9fs_ttl_revalidate() */
+const struct dentry_operations v9fs_ttl_dentry_operations = {
+	.d_revalidate = v9fs_ttl_revalidate,
+	.d_weak_revalidate = v9fs_ttl_revalidate,
+	.d_release = v9fs_dentry_release,
+};
@@ -216,7 +216,7 @@ int v9fs_dir_release(struct inode *inode, struct file *filp)
 		 inode, filp, fid ? fid->fid : -1);
 	if (fid) {
 		spin_lock(&inode->i_lock);
-		hlist_del(&fid->ilist);
+		hlist_del_rcu(&fid->ilist);
 		spin_unlock(&inode->i_lock);
 		p9_client_clunk(fid);
 	}
@@ -412,6 +412,7 @@ v9fs_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
 			invalidate_inode_pages2_range(inode->i_mapping,
 						      pg_start, pg_end);
 		iocb->ki_pos += retval;
+		v9fs_invalidate_inode_attr(inode);
 		i_size = i_size_read(inode);
 		if (iocb->ki_pos > i_size) {
 			inode_add_bytes(inode, iocb->ki_pos - i_size);
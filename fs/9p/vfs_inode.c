@@ -226,6 +226,7 @@ v9fs_blank_wstat(struct p9_wstat *wstat)
  */
 struct inode *v9fs_alloc_inode(struct super_block *sb)
 {
+	struct v9fs_session_info *v9ses = sb->s_fs_info;
 	struct v9fs_inode *v9inode;
 
 	v9inode = kmem_cache_alloc(v9fs_inode_cache, GFP_KERNEL);
@@ -237,6 +238,11 @@ struct inode *v9fs_alloc_inode(struct super_block *sb)
 	v9inode->writeback_fid = NULL;
 	v9inode->cache_validity = 0;
 	mutex_init(&v9inode->v_mutex);
+	atomic_set(&v9inode->writeback_inflight, 0);
+	/* Not fresh until the first attribute fetch */
+	v9inode->attr_time = jiffies - v9ses->cache_ttl - 1;
+	v9inode->dir_changed = jiffies;
+	v9inode->dir_version = 0;
 	return &v9inode->vfs_inode;
 }
 
@@ -765,6 +771,11 @@ struct dentry *v9fs_vfs_lookup(struct inode *dir, struct dentry *dentry,
 		return ERR_PTR(-ENAMETOOLONG);
 
 	v9ses = v9fs_inode2v9ses(dir);
+	/*
+	 * Stamp the dentry before the walk: a directory change seen after
+	 * this point must invalidate a negative result under cache_ttl.
+	 */
+	dentry->d_time = jiffies;
 	/* We can walk d_parent because we hold the dir->i_mutex */
 	dfid = v9fs_parent_fid(dentry);
 	if (IS_ERR(dfid))
@@ -1047,6 +1058,14 @@ v9fs_vfs_getattr(struct user_namespace *mnt_userns, const struct path *path,
 		generic_fillattr(&init_user_ns, d_inode(dentry), stat);
 		return 0;
 	}
+	if (v9fs_ttl_enabled(v9ses)) {
+		if (v9fs_attr_fresh(v9ses, d_inode(dentry))) {
+			v9fs_stat_inc(v9ses, attr_hit);
+			generic_fillattr(&init_user_ns, d_inode(dentry), stat);
+			return 0;
+		}
+		v9fs_stat_inc(v9ses, attr_miss);
+	}
 	fid = v9fs_fid_lookup(dentry);
 	if (IS_ERR(fid))
 		return PTR_ERR(fid);
@@ -1162,6 +1181,7 @@ v9fs_stat2inode(struct p9_wstat *stat, struct inode *inode,
 	umode_t mode;
 	struct v9fs_session_info *v9ses = sb->s_fs_info;
 	struct v9fs_inode *v9inode = V9FS_I(inode);
+	struct timespec64 mtime = inode->i_mtime, ctime = inode->i_ctime;
 
 	set_nlink(inode, 1);
 
@@ -1201,6 +1221,34 @@ v9fs_stat2inode(struct p9_wstat *stat, struct inode *inode,
 	/* not real number of blocks, but 512 byte ones ... */
 	inode->i_blocks = (stat->length + 512 - 1) >> 9;
 	v9inode->cache_validity &= ~V9FS_INO_INVALID_ATTR;
+	v9fs_attr_refreshed(inode, stat->qid.version, &mtime, &ctime);
+}
+
+/**
+ * v9fs_attr_refreshed - note that an inode's attributes came from the server
+ * @inode: inode that was updated
+ * @version: qid.version returned with the attributes
+ * @mtime: i_mtime before the update
+ * @ctime: i_ctime before the update
+ *
+ * Starts a new cache_ttl period for the attributes.  For a directory, a
+ * change in version or timestamps also records when it was seen to
+ * change, which invalidates every negative dentry looked up before then.
+ */
+void v9fs_attr_refreshed(struct inode *inode, u32 version,
+			 const struct timespec64 *mtime,
+			 const struct timespec64 *ctime)
+{
+	struct v9fs_inode *v9inode = V9FS_I(inode);
+
+	if (S_ISDIR(inode->i_mode) &&
+	    (version != v9inode->dir_version ||
+	     !timespec64_equal(&inode->i_mtime, mtime) ||
+	     !timespec64_equal(&inode->i_ctime, ctime))) {
+		v9inode->dir_version = version;
+		v9inode->dir_changed = jiffies;
+	}
+	v9inode->attr_time = jiffies;
 }
 
 /**
@@ -477,6 +477,14 @@ v9fs_vfs_getattr_dotl(struct user_namespace *mnt_userns,
 		generic_fillattr(&init_user_ns, d_inode(dentry), stat);
 		return 0;
 	}
+	if (v9fs_ttl_enabled(v9ses)) {
+		if (v9fs_attr_fresh(v9ses, d_inode(dentry))) {
+			v9fs_stat_inc(v9ses, attr_hit);
+			generic_fillattr(&init_user_ns, d_inode(dentry), stat);
+			return 0;
+		}
+		v9fs_stat_inc(v9ses, attr_miss);
+	}
 	fid = v9fs_fid_lookup(dentry);
 	if (IS_ERR(fid))
 		return PTR_ERR(fid);
@@ -640,6 +648,7 @@ v9fs_stat2inode_dotl(struct p9_stat_dotl *stat, struct inode *inode,
 {
 	umode_t mode;
 	struct v9fs_inode *v9inode = V9FS_I(inode);
+	struct timespec64 mtime = inode->i_mtime, ctime = inode->i_ctime;
 
 	if ((stat->st_result_mask & P9_STATS_BASIC) == P9_STATS_BASIC) {
 		inode->i_atime.tv_sec = stat->st_atime_sec;
@@ -696,6 +705,7 @@ v9fs_stat2inode_dotl(struct p9_stat_dotl *stat, struct inode *inode,
 	 * because the inode structure does not have fields for them.
 	 */
 	v9inode->cache_validity &= ~V9FS_INO_INVALID_ATTR;
+	v9fs_attr_refreshed(inode, stat->qid.version, &mtime, &ctime);
 }
 
 static int
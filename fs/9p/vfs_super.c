@@ -19,6 +19,7 @@
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/statfs.h>
+#include <linux/seq_file.h>
 #include <linux/magic.h>
 #include <linux/fscache.h>
 #include <net/9p/9p.h>
@@ -140,6 +141,8 @@ static struct dentry *v9fs_mount(struct file_system_type *fs_type, int flags,
 
 	if (v9ses->cache == CACHE_LOOSE || v9ses->cache == CACHE_FSCACHE)
 		sb->s_d_op = &v9fs_cached_dentry_operations;
+	else if (v9fs_ttl_enabled(v9ses))
+		sb->s_d_op = &v9fs_ttl_dentry_operations;
 	else
 		sb->s_d_op = &v9fs_dentry_operations;
 
@@ -279,7 +282,8 @@ static int v9fs_drop_inode(struct inode *inode)
 	struct v9fs_session_info *v9ses;
 
 	v9ses = v9fs_inode2v9ses(inode);
-	if (v9ses->cache == CACHE_LOOSE || v9ses->cache == CACHE_FSCACHE)
+	if (v9ses->cache == CACHE_LOOSE || v9ses->cache == CACHE_FSCACHE ||
+	    v9fs_ttl_enabled(v9ses))
 		return generic_drop_inode(inode);
 	/*
 	 * in case of non cached mode always drop the
@@ -338,12 +342,35 @@ static int v9fs_write_inode_dotl(struct inode *inode,
 	return 0;
 }
 
+/*
+ * Report the cache_ttl counters in /proc/self/mountstats.
+ */
+static int v9fs_show_stats(struct seq_file *m, struct dentry *root)
+{
+	struct v9fs_session_info *v9ses = root->d_sb->s_fs_info;
+	struct v9fs_cache_stats *st = &v9ses->stats;
+
+	seq_printf(m, "cache_ttl=%u", jiffies_to_msecs(v9ses->cache_ttl));
+	seq_printf(m, "\n\tdentry: hit %lld miss %lld",
+		   atomic64_read(&st->dentry_hit),
+		   atomic64_read(&st->dentry_miss));
+	seq_printf(m, "\n\tnegative: hit %lld miss %lld dir_revalidate %lld",
+		   atomic64_read(&st->neg_hit),
+		   atomic64_read(&st->neg_miss),
+		   atomic64_read(&st->dir_revalidate));
+	seq_printf(m, "\n\tattr: hit %lld miss %lld",
+		   atomic64_read(&st->attr_hit),
+		   atomic64_read(&st->attr_miss));
+	return 0;
+}
+
 static const struct super_operations v9fs_super_ops = {
 	.alloc_inode = v9fs_alloc_inode,
 	.free_inode = v9fs_free_inode,
 	.statfs = simple_statfs,
 	.evict_inode = v9fs_evict_inode,
 	.show_options = v9fs_show_options,
+	.show_stats = v9fs_show_stats,
 	.umount_begin = v9fs_umount_begin,
 	.write_inode = v9fs_write_inode,
 };
@@ -355,6 +382,7 @@ static const struct super_operations v9fs_super_ops_dotl = {
 	.drop_inode = v9fs_drop_inode,
 	.evict_inode = v9fs_evict_inode,
 	.show_options = v9fs_show_options,
+	.show_stats = v9fs_show_stats,
 	.umount_begin = v9fs_umount_begin,
 	.write_inode = v9fs_write_inode_dotl,
 };
@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#include <linux/zstd.h>
+#include <linux/module.h>
+#include "compress.h"
+
+struct z_erofs_zstd {
+	struct z_erofs_zstd *next;
+	zstd_dstream *dstream;
+	void *wksp;
+	u8 bounce[PAGE_SIZE];
+};
+
+/*
+ * As with LZMA, a bounded pool of streams is shared by all instances since
+ * each workspace takes about the window size, which can be up to 1MiB.
+ */
+static DEFINE_SPINLOCK(z_erofs_zstd_lock);
+static unsigned int z_erofs_zstd_max_windowsize;
+static unsigned int z_erofs_zstd_nstrms, z_erofs_zstd_avail_strms;
+static struct z_erofs_zstd *z_erofs_zstd_head;
+static DECLARE_WAIT_QUEUE_HEAD(z_erofs_zstd_wq);
+
+module_param_named(zstd_streams, z_erofs_zstd_nstrms, uint, 0444);
+
+void z_erofs_zstd_exit(void)
+{
+	/* there should be no running fs instance */
+	while (z_erofs_zstd_avail_strms) {
+		struct z_erofs_zstd *strm;
+
+		spin_lock(&z_erofs_zstd_lock);
+		strm = z_erofs_zstd_head;
+		if (!strm) {
+			spin_unlock(&z_erofs_zstd_lock);
+			DBG_BUGON(1);
+			return;
+		}
+		z_erofs_zstd_head = NULL;
+		spin_unlock(&z_erofs_zstd_lock);
+
+		while (strm) {
+			struct z_erofs_zstd *n = strm->next;
+
+			kvfree(strm->wksp);
+			kfree(strm);
+			--z_erofs_zstd_avail_strms;
+			strm = n;
+		}
+	}
+	z_erofs_zstd_max_windowsize = 0;
+}
+
+int z_erofs_zstd_init(void)
+{
+	unsigned int i;
+
+	/* by default, use # of online CPUs instead */
+	if (!z_erofs_zstd_nstrms)
+		z_erofs_zstd_nstrms = num_online_cpus();
+
+	for (i = 0; i < z_erofs_zstd_nstrms; ++i) {
+		struct z_erofs_zstd *strm = kzalloc(sizeof(*strm), GFP_KERNEL);
+
+		if (!strm) {
+			z_erofs_zstd_exit();
+			return -ENOMEM;
+		}
+		spin_lock(&z_erofs_zstd_lock);
+		strm->next = z_erofs_zstd_head;
+		z_erofs_zstd_head = strm;
+		spin_unlock(&z_erofs_zstd_lock);
+		++z_erofs_zstd_avail_strms;
+	}
+	return 0;
+}
+
+int z_erofs_load_zstd_config(struct super_block *sb,
+			     struct erofs_super_block *dsb,
+			     struct z_erofs_zstd_cfgs *zstd, int size)
+{
+	static DEFINE_MUTEX(zstd_resize_mutex);
+	unsigned int windowsize, i;
+	struct z_erofs_zstd *strm, *head = NULL;
+	size_t wkspsz;
+	int err;
+
+	if (!zstd || size < sizeof(struct z_erofs_zstd_cfgs)) {
+		erofs_err(sb, "invalid zstd cfgs, size=%u", size);
+		return -EINVAL;
+	}
+	if (zstd->format) {
+		erofs_err(sb, "unidentified zstd format %x, please check kernel version",
+			  zstd->format);
+		return -EINVAL;
+	}
+	if (zstd->windowlog > ilog2(Z_EROFS_ZSTD_MAX_DICT_SIZE) -
+			      Z_EROFS_ZSTD_MIN_WINDOWLOG) {
+		erofs_err(sb, "unsupported zstd window log %u",
+			  zstd->windowlog + Z_EROFS_ZSTD_MIN_WINDOWLOG);
+		return -EINVAL;
+	}
+	windowsize = 1U << (zstd->windowlog + Z_EROFS_ZSTD_MIN_WINDOWLOG);
+
+	erofs_info(sb, "EXPERIMENTAL Zstandard in use. Use at your own risk!");
+
+	/* in case 2 z_erofs_load_zstd_config() race to avoid deadlock */
+	mutex_lock(&zstd_resize_mutex);
+
+	if (z_erofs_zstd_max_windowsize >= windowsize) {
+		mutex_unlock(&zstd_resize_mutex);
+		return 0;
+	}
+
+	/* 1. collect/isolate all streams for the following check */
+	for (i = 0; i < z_erofs_zstd_avail_strms; ++i) {
+		struct z_erofs_zstd *last;
+
+again:
+		spin_lock(&z_erofs_zstd_lock);
+		strm = z_erofs_zstd_head;
+		if (!strm) {
+			spin_unlock(&z_erofs_zstd_lock);
+			wait_event(z_erofs_zstd_wq,
+				   READ_ONCE(z_erofs_zstd_head));
+			goto again;
+		}
+		z_erofs_zstd_head = NULL;
+		spin_unlock(&z_erofs_zstd_lock);
+
+		for (last = strm; last->next; last = last->next)
+			++i;
+		last->next = head;
+		head = strm;
+	}
+
+	err = 0;
+	/* 2. walk each isolated stream and grow its window if needed */
+	wkspsz = zstd_dstream_workspace_bound(windowsize);
+	for (strm = head; strm; strm = strm->next) {
+		zstd_dstream *dstream;
+		void *wksp;
+
+		wksp = kvmalloc(wkspsz, GFP_KERNEL);
+		if (!wksp) {
+			err = -ENOMEM;
+			break;
+		}
+		dstream = zstd_init_dstream(windowsize, wksp, wkspsz);
+		if (!dstream) {
+			kvfree(wksp);
+			err = -EINVAL;
+			break;
+		}
+		kvfree(strm->wksp);
+		strm->wksp = wksp;
+		strm->dstream = dstream;
+	}
+
+	/* 3. push back all to the global list and update max window size */
+	spin_lock(&z_erofs_zstd_lock);
+	DBG_BUGON(z_erofs_zstd_head);
+	z_erofs_zstd_head = head;
+	spin_unlock(&z_erofs_zstd_lock);
+	wake_up_all(&z_erofs_zstd_wq);
+
+	if (!err)
+		z_erofs_zstd_max_windowsize = windowsize;
+	mutex_unlock(&zstd_resize_mutex);
+	return err;
+}
+
+int z_erofs_zstd_decompress(struct z_erofs_decompress_req *rq,
+			    struct page **pagepool)
+{
+	const unsigned int nrpages_out =
+		PAGE_ALIGN(rq->pageofs_out + rq->outputsize) >> PAGE_SHIFT;
+	const unsigned int nrpages_in =
+		PAGE_ALIGN(rq->inputsize) >> PAGE_SHIFT;
+	zstd_in_buffer in_buf = { NULL, 0, 0 };
+	zstd_out_buffer out_buf = { NULL, 0, 0 };
+	unsigned int inlen, outlen, pageofs;
+	struct z_erofs_zstd *strm;
+	zstd_frame_header hdr;
+	size_t zerr;
+	u8 *kin;
+	bool bounced = false;
+	int no, ni, j, err = 0;
+
+	/* 1. get the exact Zstandard compressed size */
+	kin = kmap(*rq->in);
+	err = z_erofs_fixup_insize(rq, kin + rq->pageofs_in,
+				   min_t(unsigned int, rq->inputsize,
+					 EROFS_BLKSIZ - rq->pageofs_in));
+	if (err) {
+		kunmap(*rq->in);
+		return err;
+	}
+
+	/* 2. pclusters relying on an external dictionary can't be decoded */
+	in_buf.src = kin + rq->pageofs_in;
+	in_buf.size = min_t(u32, rq->inputsize, PAGE_SIZE - rq->pageofs_in);
+	zerr = zstd_get_frame_header(&hdr, in_buf.src, in_buf.size);
+	if (zstd_is_error(zerr)) {
+		erofs_err(rq->sb, "invalid zstd frame header in[%u] out[%u]",
+			  rq->inputsize, rq->outputsize);
+		kunmap(*rq->in);
+		return -EFSCORRUPTED;
+	}
+	if (!zerr && hdr.dictID) {
+		erofs_err(rq->sb, "zstd dictionary %u isn't supported",
+			  hdr.dictID);
+		kunmap(*rq->in);
+		return -EOPNOTSUPP;
+	}
+
+	/* 3. get an available zstd stream */
+again:
+	spin_lock(&z_erofs_zstd_lock);
+	strm = z_erofs_zstd_head;
+	if (!strm) {
+		spin_unlock(&z_erofs_zstd_lock);
+		wait_event(z_erofs_zstd_wq, READ_ONCE(z_erofs_zstd_head));
+		goto again;
+	}
+	z_erofs_zstd_head = strm->next;
+	spin_unlock(&z_erofs_zstd_lock);
+
+	if (!strm->dstream) {
+		DBG_BUGON(1);
+		err = -EOPNOTSUPP;
+		kunmap(*rq->in);
+		goto out;
+	}
+	zstd_reset_dstream(strm->dstream);
+
+	/* 4. multi-call decompress */
+	inlen = rq->inputsize - in_buf.size;
+	outlen = rq->outputsize;
+	pageofs = rq->pageofs_out;
+
+	for (ni = 0, no = -1;;) {
+		if (out_buf.pos == out_buf.size) {
+			if (out_buf.dst) {
+				kunmap(rq->out[no]);
+				out_buf.dst = NULL;
+			}
+			/* stop here for partial decoding as well */
+			if (!outlen)
+				break;
+
+			if (++no >= nrpages_out) {
+				erofs_err(rq->sb, "decompressed buf out of bound");
+				err = -EFSCORRUPTED;
+				break;
+			}
+			/* zstd can't skip output, so decode into a dummy page */
+			if (!rq->out[no]) {
+				rq->out[no] = erofs_allocpage(pagepool,
+						GFP_KERNEL | __GFP_NOFAIL);
+				set_page_private(rq->out[no],
+						 Z_EROFS_SHORTLIVED_PAGE);
+			}
+			out_buf.dst = kmap(rq->out[no]) + pageofs;
+			out_buf.pos = 0;
+			out_buf.size = min_t(u32, outlen, PAGE_SIZE - pageofs);
+			outlen -= out_buf.size;
+			pageofs = 0;
+		} else if (in_buf.pos == in_buf.size) {
+			kunmap(rq->in[ni]);
+			kin = NULL;
+
+			if (++ni >= nrpages_in || !inlen) {
+				erofs_err(rq->sb, "compressed buf out of bound");
+				err = -EFSCORRUPTED;
+				break;
+			}
+			kin = kmap(rq->in[ni]);
+			in_buf.src = kin;
+			in_buf.pos = 0;
+			in_buf.size = min_t(u32, inlen, PAGE_SIZE);
+			inlen -= in_buf.size;
+			bounced = false;
+		}
+
+		/*
+		 * Handle overlapping: Use bounced buffer if the compressed
+		 * data is under processing; Otherwise, Use short-lived pages
+		 * from the on-stack pagepool where pages share with the same
+		 * request.
+		 */
+		if (!bounced && rq->out[no] == rq->in[ni]) {
+			memcpy(strm->bounce, in_buf.src, in_buf.size);
+			in_buf.src = strm->bounce;
+			bounced = true;
+		}
+		for (j = ni + 1; j < nrpages_in; ++j) {
+			struct page *tmppage;
+
+			if (rq->out[no] != rq->in[j])
+				continue;
+
+			DBG_BUGON(erofs_page_is_managed(EROFS_SB(rq->sb),
+							rq->in[j]));
+			tmppage = erofs_allocpage(pagepool,
+						  GFP_KERNEL | __GFP_NOFAIL);
+			set_page_private(tmppage, Z_EROFS_SHORTLIVED_PAGE);
+			copy_highpage(tmppage, rq->in[j]);
+			rq->in[j] = tmppage;
+		}
+
+		zerr = zstd_decompress_stream(strm->dstream, &out_buf, &in_buf);
+		DBG_BUGON(out_buf.pos > out_buf.size);
+		DBG_BUGON(in_buf.pos > in_buf.size);
+
+		if (zstd_is_error(zerr)) {
+			erofs_err(rq->sb, "failed to decompress %s in[%u] out[%u]",
+				  zstd_get_error_name(zerr),
+				  rq->inputsize, rq->outputsize);
+			err = -EFSCORRUPTED;
+			break;
+		}
+		/* the frame ends before the requested output is produced */
+		if (!zerr && (outlen || out_buf.pos < out_buf.size)) {
+			erofs_err(rq->sb, "zstd frame ends early in[%u] out[%u]",
+				  rq->inputsize, rq->outputsize);
+			err = -EFSCORRUPTED;
+			break;
+		}
+	}
+	if (out_buf.dst)
+		kunmap(rq->out[no]);
+	if (kin)
+		kunmap(rq->in[ni]);
+out:
+	/* 5. push back zstd stream to the global list */
+	spin_lock(&z_erofs_zstd_lock);
+	strm->next = z_erofs_zstd_head;
+	z_erofs_zstd_head = strm;
+	spin_unlock(&z_erofs_zstd_lock);
+	wake_up(&z_erofs_zstd_wq);
+	return err;
+}
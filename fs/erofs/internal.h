@@ -72,6 +72,9 @@ struct erofs_mount_opts {
 
 	/* threshold for decompression synchronously */
 	unsigned int max_sync_decompress_pages;
+
+	/* spread pclusters of an async decompression queue over workers */
+	bool parallel_decompress;
 #endif
 	unsigned int mount_opt;
 };
@@ -113,6 +116,11 @@ struct erofs_sb_info {
 	struct inode *managed_cache;
 
 	struct erofs_sb_lz4_info lz4;
+
+	/* per-pcluster decompression statistics, shown in sysfs */
+	atomic64_t decompressed_pclusters;
+	atomic64_t decompress_time_ns;
+	atomic64_t max_decompress_time_ns;
 #endif	/* CONFIG_EROFS_FS_ZIP */
 	struct erofs_dev_context *devs;
 	struct dax_device *dax_dev;
@@ -438,7 +446,7 @@ struct erofs_map_blocks {
  * approach instead if possible since it's more metadata lightweight.)
  */
 #define EROFS_GET_BLOCKS_FIEMAP	0x0002
-/* Used to map the whole extent if non-negligible data is requested for LZMA */
+/* Map the whole extent if non-negligible data is requested for LZMA/ZSTD */
 #define EROFS_GET_BLOCKS_READMORE	0x0004
 /* Used to map tail extent for tailpacking inline pcluster */
 #define EROFS_GET_BLOCKS_FINDTAIL	0x0008
@@ -560,6 +568,8 @@ struct erofs_workgroup *erofs_insert_workgroup(struct super_block *sb,
 void erofs_workgroup_free_rcu(struct erofs_workgroup *grp);
 void erofs_shrinker_register(struct super_block *sb);
 void erofs_shrinker_unregister(struct super_block *sb);
+void z_erofs_zcache_register(struct super_block *sb);
+void z_erofs_zcache_unregister(struct super_block *sb);
 int __init erofs_init_shrinker(void);
 void erofs_exit_shrinker(void);
 int __init z_erofs_init_zip_subsystem(void);
@@ -573,6 +583,8 @@ int z_erofs_load_lz4_config(struct super_block *sb,
 #else
 static inline void erofs_shrinker_register(struct super_block *sb) {}
 static inline void erofs_shrinker_unregister(struct super_block *sb) {}
+static inline void z_erofs_zcache_register(struct super_block *sb) {}
+static inline void z_erofs_zcache_unregister(struct super_block *sb) {}
 static inline int erofs_init_shrinker(void) { return 0; }
 static inline void erofs_exit_shrinker(void) {}
 static inline int z_erofs_init_zip_subsystem(void) { return 0; }
@@ -609,6 +621,26 @@ static inline int z_erofs_load_lzma_config(struct super_block *sb,
 }
 #endif	/* !CONFIG_EROFS_FS_ZIP */
 
+#ifdef CONFIG_EROFS_FS_ZIP_ZSTD
+int z_erofs_zstd_init(void);
+void z_erofs_zstd_exit(void);
+int z_erofs_load_zstd_config(struct super_block *sb,
+			     struct erofs_super_block *dsb,
+			     struct z_erofs_zstd_cfgs *zstd, int size);
+#else
+static inline int z_erofs_zstd_init(void) { return 0; }
+static inline void z_erofs_zstd_exit(void) {}
+static inline int z_erofs_load_zstd_config(struct super_block *sb,
+			     struct erofs_super_block *dsb,
+			     struct z_erofs_zstd_cfgs *zstd, int size) {
+	if (zstd) {
+		erofs_err(sb, "zstd algorithm isn't enabled");
+		return -EINVAL;
+	}
+	return 0;
+}
+#endif	/* !CONFIG_EROFS_FS_ZIP_ZSTD */
+
 #define EFSCORRUPTED    EUCLEAN         /* Filesystem is corrupted */
 
 #endif	/* __EROFS_INTERNAL_H */
@@ -12,6 +12,9 @@ enum {
 	attr_feature,
 	attr_pointer_ui,
 	attr_pointer_bool,
+	attr_decompressed_pclusters,
+	attr_avg_decompress_latency_ns,
+	attr_max_decompress_latency_ns,
 };
 
 enum {
@@ -57,11 +60,19 @@ static struct erofs_attr erofs_attr_##_name = {			\
 
 #ifdef CONFIG_EROFS_FS_ZIP
 EROFS_ATTR_RW_UI(sync_decompress, erofs_mount_opts);
+EROFS_ATTR_RW_BOOL(parallel_decompress, erofs_mount_opts);
+EROFS_ATTR_FUNC(decompressed_pclusters, 0444);
+EROFS_ATTR_FUNC(avg_decompress_latency_ns, 0444);
+EROFS_ATTR_FUNC(max_decompress_latency_ns, 0444);
 #endif
 
 static struct attribute *erofs_attrs[] = {
 #ifdef CONFIG_EROFS_FS_ZIP
 	ATTR_LIST(sync_decompress),
+	ATTR_LIST(parallel_decompress),
+	ATTR_LIST(decompressed_pclusters),
+	ATTR_LIST(avg_decompress_latency_ns),
+	ATTR_LIST(max_decompress_latency_ns),
 #endif
 	NULL,
 };
@@ -100,6 +111,17 @@ static unsigned char *__struct_ptr(struct erofs_sb_info *sbi,
 	return NULL;
 }
 
+#ifdef CONFIG_EROFS_FS_ZIP
+static u64 erofs_avg_decompress_ns(struct erofs_sb_info *sbi)
+{
+	s64 nr = atomic64_read(&sbi->decompressed_pclusters);
+
+	if (!nr)
+		return 0;
+	return div64_u64(atomic64_read(&sbi->decompress_time_ns), nr);
+}
+#endif
+
 static ssize_t erofs_attr_show(struct kobject *kobj,
 				struct attribute *attr, char *buf)
 {
@@ -119,6 +141,16 @@ static ssize_t erofs_attr_show(struct kobject *kobj,
 		if (!ptr)
 			return 0;
 		return sysfs_emit(buf, "%d\n", *(bool *)ptr);
+#ifdef CONFIG_EROFS_FS_ZIP
+	case attr_decompressed_pclusters:
+		return sysfs_emit(buf, "%lld\n",
+				  atomic64_read(&sbi->decompressed_pclusters));
+	case attr_avg_decompress_latency_ns:
+		return sysfs_emit(buf, "%llu\n", erofs_avg_decompress_ns(sbi));
+	case attr_max_decompress_latency_ns:
+		return sysfs_emit(buf, "%lld\n",
+				  atomic64_read(&sbi->max_decompress_time_ns));
+#endif
 	}
 	return 0;
 }
@@ -0,0 +1,409 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Decompressed pcluster cache shared by all EROFS instances.
+ *
+ * Container images commonly share data blobs which are attached as extra
+ * devices to many mounts.  Since the managed cache is per-superblock, the
+ * same pclusters would be read and decompressed once per mount.  Instead,
+ * keep the decompressed data of recently used pclusters here, keyed by
+ * their physical location, so that every mount backed by the same device
+ * can reuse them without any I/O or decompression.
+ *
+ * The disk sequence number is a part of the key so that a loop device
+ * attached to another backing file never hits stale entries.  Since the
+ * contents of a device can also change by a plain write once no instance
+ * holds it any longer, all entries of a device are dropped as soon as its
+ * last EROFS instance goes away.
+ */
+#include <linux/hashtable.h>
+#include <linux/module.h>
+#include "zdata.h"
+
+struct z_erofs_zcache_entry {
+	struct hlist_node hnode;
+	struct list_head lru;
+	/* one reference is held by the hashtable */
+	refcount_t ref;
+
+	u64 diskseq;
+	dev_t dev;
+	erofs_blk_t blkaddr;
+	unsigned char alg;
+
+	/* decompressed length of the whole pcluster */
+	unsigned int len;
+	unsigned int nrpages;
+	struct page *pages[];
+};
+
+/* number of EROFS instances using a device */
+struct z_erofs_zcache_dev {
+	struct list_head list;
+	dev_t dev;
+	unsigned int users;
+};
+
+#define Z_EROFS_ZCACHE_HASH_BITS	10
+
+static DEFINE_HASHTABLE(z_erofs_zcache_hash, Z_EROFS_ZCACHE_HASH_BITS);
+/* protects the hashtable, the LRU list, the page count and the devices */
+static DEFINE_SPINLOCK(z_erofs_zcache_lock);
+static LIST_HEAD(z_erofs_zcache_lru);
+static LIST_HEAD(z_erofs_zcache_devs);
+static unsigned long z_erofs_zcache_nrpages;
+
+/* memory limit of the shared cache in MiB, 0 to disable */
+static unsigned int z_erofs_zcache_mb;
+
+module_param_named(shared_cache_mb, z_erofs_zcache_mb, uint, 0644);
+
+static unsigned long z_erofs_zcache_limit(void)
+{
+	return (unsigned long)READ_ONCE(z_erofs_zcache_mb) <<
+		(20 - PAGE_SHIFT);
+}
+
+static u64 z_erofs_zcache_hashkey(dev_t dev, erofs_blk_t blkaddr)
+{
+	return ((u64)dev << 32) ^ blkaddr;
+}
+
+static void z_erofs_zcache_free(struct z_erofs_zcache_entry *ze)
+{
+	unsigned int i;
+
+	for (i = 0; i < ze->nrpages; ++i)
+		if (ze->pages[i])
+			__free_page(ze->pages[i]);
+	kfree(ze);
+}
+
+/* drop unused entries in LRU order until @nr pages are freed */
+static unsigned long z_erofs_zcache_evict(unsigned long nr)
+{
+	struct z_erofs_zcache_entry *ze, *n;
+	unsigned long freed = 0;
+	LIST_HEAD(dispose);
+
+	spin_lock(&z_erofs_zcache_lock);
+	list_for_each_entry_safe(ze, n, &z_erofs_zcache_lru, lru) {
+		if (freed >= nr)
+			break;
+		/* only lookups take references, which hold the lock */
+		if (refcount_read(&ze->ref) != 1)
+			continue;
+		hash_del(&ze->hnode);
+		list_move(&ze->lru, &dispose);
+		freed += ze->nrpages;
+	}
+	WRITE_ONCE(z_erofs_zcache_nrpages, z_erofs_zcache_nrpages - freed);
+	spin_unlock(&z_erofs_zcache_lock);
+
+	list_for_each_entry_safe(ze, n, &dispose, lru)
+		z_erofs_zcache_free(ze);
+	return freed;
+}
+
+static bool z_erofs_zcache_map(struct super_block *sb,
+			       struct z_erofs_pcluster *pcl,
+			       struct erofs_map_dev *mdev)
+{
+	if (!z_erofs_zcache_limit() || z_erofs_is_inline_pcluster(pcl))
+		return false;
+
+	/* no device id here, thus it will always succeed */
+	*mdev = (struct erofs_map_dev) {
+		.m_pa = blknr_to_addr(pcl->obj.index),
+	};
+	(void)erofs_map_dev(sb, mdev);
+	return true;
+}
+
+static struct z_erofs_zcache_entry *
+__z_erofs_zcache_lookup(struct erofs_map_dev *mdev, unsigned char alg)
+{
+	const dev_t dev = mdev->m_bdev->bd_dev;
+	const erofs_blk_t blkaddr = erofs_blknr(mdev->m_pa);
+	struct z_erofs_zcache_entry *ze;
+
+	lockdep_assert_held(&z_erofs_zcache_lock);
+	hash_for_each_possible(z_erofs_zcache_hash, ze, hnode,
+			       z_erofs_zcache_hashkey(dev, blkaddr)) {
+		if (ze->dev == dev && ze->blkaddr == blkaddr &&
+		    ze->diskseq == mdev->m_bdev->bd_disk->diskseq &&
+		    ze->alg == alg)
+			return ze;
+	}
+	return NULL;
+}
+
+/* only devices held by a live instance can't change under the cache */
+static bool z_erofs_zcache_dev_live(dev_t dev)
+{
+	struct z_erofs_zcache_dev *zd;
+
+	lockdep_assert_held(&z_erofs_zcache_lock);
+	list_for_each_entry(zd, &z_erofs_zcache_devs, list)
+		if (zd->dev == dev)
+			return true;
+	return false;
+}
+
+/* look up a cached pcluster covering its currently known length */
+struct z_erofs_zcache_entry *z_erofs_zcache_get(struct super_block *sb,
+						struct z_erofs_pcluster *pcl)
+{
+	const unsigned int llen =
+		READ_ONCE(pcl->length) >> Z_EROFS_PCLUSTER_LENGTH_BIT;
+	struct z_erofs_zcache_entry *ze;
+	struct erofs_map_dev mdev;
+
+	if (!z_erofs_zcache_map(sb, pcl, &mdev))
+		return NULL;
+
+	spin_lock(&z_erofs_zcache_lock);
+	ze = __z_erofs_zcache_lookup(&mdev, pcl->algorithmformat);
+	if (ze && ze->len >= llen) {
+		refcount_inc(&ze->ref);
+		list_move_tail(&ze->lru, &z_erofs_zcache_lru);
+	} else {
+		ze = NULL;
+	}
+	spin_unlock(&z_erofs_zcache_lock);
+	return ze;
+}
+
+void z_erofs_zcache_put(struct z_erofs_zcache_entry *ze)
+{
+	if (refcount_dec_and_test(&ze->ref))
+		z_erofs_zcache_free(ze);
+}
+
+/*
+ * Copy @len bytes between the cached pcluster and the output pages, which
+ * start at @pageofs of out[0].  Missing output pages are skipped when
+ * filling them, but fail the operation otherwise.
+ */
+static int z_erofs_zcache_transfer(struct z_erofs_zcache_entry *ze,
+				   struct page **out, unsigned int pageofs,
+				   unsigned int len, bool fill)
+{
+	unsigned int cur, cnt;
+
+	for (cur = 0; cur < len; cur += cnt) {
+		const unsigned int pos = pageofs + cur;
+		struct page *page = out[pos >> PAGE_SHIFT];
+
+		cnt = min3(PAGE_SIZE - offset_in_page(pos),
+			   PAGE_SIZE - offset_in_page(cur), len - cur);
+		if (!page) {
+			if (!fill)
+				return -EAGAIN;
+			continue;
+		}
+		if (fill)
+			memcpy_page(page, offset_in_page(pos),
+				    ze->pages[cur >> PAGE_SHIFT],
+				    offset_in_page(cur), cnt);
+		else
+			memcpy_page(ze->pages[cur >> PAGE_SHIFT],
+				    offset_in_page(cur), page,
+				    offset_in_page(pos), cnt);
+	}
+	return 0;
+}
+
+int z_erofs_zcache_fill(struct z_erofs_zcache_entry *ze, struct page **out,
+			unsigned int pageofs, unsigned int len)
+{
+	if (len > ze->len) {
+		DBG_BUGON(1);
+		return -EIO;
+	}
+	return z_erofs_zcache_transfer(ze, out, pageofs, len, true);
+}
+
+/* add a fully decompressed pcluster to the cache */
+void z_erofs_zcache_add(struct super_block *sb, struct z_erofs_pcluster *pcl,
+			struct page **out, unsigned int pageofs,
+			unsigned int len)
+{
+	const gfp_t gfp = GFP_NOFS | __GFP_NORETRY | __GFP_NOWARN;
+	const unsigned int nrpages = PAGE_ALIGN(len) >> PAGE_SHIFT;
+	struct z_erofs_zcache_entry *ze;
+	struct erofs_map_dev mdev;
+	unsigned long limit, nr;
+	unsigned int i;
+	bool exist;
+
+	if (!z_erofs_zcache_map(sb, pcl, &mdev))
+		return;
+	limit = z_erofs_zcache_limit();
+	if (nrpages > limit)
+		return;
+
+	spin_lock(&z_erofs_zcache_lock);
+	exist = !!__z_erofs_zcache_lookup(&mdev, pcl->algorithmformat);
+	spin_unlock(&z_erofs_zcache_lock);
+	if (exist)
+		return;
+
+	ze = kzalloc(struct_size(ze, pages, nrpages), gfp);
+	if (!ze)
+		return;
+	refcount_set(&ze->ref, 1);
+	ze->diskseq = mdev.m_bdev->bd_disk->diskseq;
+	ze->dev = mdev.m_bdev->bd_dev;
+	ze->blkaddr = erofs_blknr(mdev.m_pa);
+	ze->alg = pcl->algorithmformat;
+	ze->len = len;
+	ze->nrpages = nrpages;
+	for (i = 0; i < nrpages; ++i) {
+		ze->pages[i] = alloc_page(gfp);
+		if (!ze->pages[i])
+			goto out_free;
+	}
+	if (z_erofs_zcache_transfer(ze, out, pageofs, len, false))
+		goto out_free;
+
+	spin_lock(&z_erofs_zcache_lock);
+	/* someone else may have added the same pcluster in the meantime */
+	if (!z_erofs_zcache_dev_live(ze->dev) ||
+	    __z_erofs_zcache_lookup(&mdev, ze->alg)) {
+		spin_unlock(&z_erofs_zcache_lock);
+		goto out_free;
+	}
+	hash_add(z_erofs_zcache_hash, &ze->hnode,
+		 z_erofs_zcache_hashkey(ze->dev, ze->blkaddr));
+	list_add_tail(&ze->lru, &z_erofs_zcache_lru);
+	nr = z_erofs_zcache_nrpages + nrpages;
+	WRITE_ONCE(z_erofs_zcache_nrpages, nr);
+	spin_unlock(&z_erofs_zcache_lock);
+
+	if (nr > limit)
+		z_erofs_zcache_evict(nr - limit);
+	return;
+out_free:
+	z_erofs_zcache_free(ze);
+}
+
+static void z_erofs_zcache_get_dev(dev_t dev)
+{
+	struct z_erofs_zcache_dev *zd, *new;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL | __GFP_NOFAIL);
+	spin_lock(&z_erofs_zcache_lock);
+	list_for_each_entry(zd, &z_erofs_zcache_devs, list) {
+		if (zd->dev == dev) {
+			++zd->users;
+			spin_unlock(&z_erofs_zcache_lock);
+			kfree(new);
+			return;
+		}
+	}
+	new->dev = dev;
+	new->users = 1;
+	list_add(&new->list, &z_erofs_zcache_devs);
+	spin_unlock(&z_erofs_zcache_lock);
+}
+
+/* drop all entries of @dev once its last user goes away */
+static void z_erofs_zcache_put_dev(dev_t dev)
+{
+	struct z_erofs_zcache_entry *ze, *n;
+	struct z_erofs_zcache_dev *zd;
+	unsigned long freed = 0;
+	LIST_HEAD(dispose);
+	bool found = false;
+
+	spin_lock(&z_erofs_zcache_lock);
+	list_for_each_entry(zd, &z_erofs_zcache_devs, list) {
+		if (zd->dev == dev) {
+			found = true;
+			break;
+		}
+	}
+	if (!found || --zd->users) {
+		DBG_BUGON(!found);
+		spin_unlock(&z_erofs_zcache_lock);
+		return;
+	}
+	list_del(&zd->list);
+
+	list_for_each_entry_safe(ze, n, &z_erofs_zcache_lru, lru) {
+		if (ze->dev != dev)
+			continue;
+		hash_del(&ze->hnode);
+		list_move(&ze->lru, &dispose);
+		freed += ze->nrpages;
+	}
+	WRITE_ONCE(z_erofs_zcache_nrpages, z_erofs_zcache_nrpages - freed);
+	spin_unlock(&z_erofs_zcache_lock);
+	kfree(zd);
+
+	/* entries still referenced are freed by their last user */
+	list_for_each_entry_safe(ze, n, &dispose, lru)
+		z_erofs_zcache_put(ze);
+}
+
+/* called when an instance is set up, after all its devices are opened */
+void z_erofs_zcache_register(struct super_block *sb)
+{
+	struct erofs_dev_context *devs = EROFS_SB(sb)->devs;
+	struct erofs_device_info *dif;
+	int id;
+
+	z_erofs_zcache_get_dev(sb->s_bdev->bd_dev);
+	down_read(&devs->rwsem);
+	idr_for_each_entry(&devs->tree, dif, id)
+		if (dif->bdev)
+			z_erofs_zcache_get_dev(dif->bdev->bd_dev);
+	up_read(&devs->rwsem);
+}
+
+/* called when an instance goes away, after all its I/O has completed */
+void z_erofs_zcache_unregister(struct super_block *sb)
+{
+	struct erofs_dev_context *devs = EROFS_SB(sb)->devs;
+	struct erofs_device_info *dif;
+	int id;
+
+	z_erofs_zcache_put_dev(sb->s_bdev->bd_dev);
+	down_read(&devs->rwsem);
+	idr_for_each_entry(&devs->tree, dif, id)
+		if (dif->bdev)
+			z_erofs_zcache_put_dev(dif->bdev->bd_dev);
+	up_read(&devs->rwsem);
+}
+
+static unsigned long z_erofs_zcache_count(struct shrinker *shrink,
+					  struct shrink_control *sc)
+{
+	return READ_ONCE(z_erofs_zcache_nrpages);
+}
+
+static unsigned long z_erofs_zcache_scan(struct shrinker *shrink,
+					 struct shrink_control *sc)
+{
+	return z_erofs_zcache_evict(sc->nr_to_scan);
+}
+
+static struct shrinker z_erofs_zcache_shrinker_info = {
+	.scan_objects = z_erofs_zcache_scan,
+	.count_objects = z_erofs_zcache_count,
+	.seeks = DEFAULT_SEEKS,
+};
+
+int __init z_erofs_zcache_init(void)
+{
+	return register_shrinker(&z_erofs_zcache_shrinker_info);
+}
+
+void z_erofs_zcache_exit(void)
+{
+	unregister_shrinker(&z_erofs_zcache_shrinker_info);
+	/* there should be no running fs instance */
+	z_erofs_zcache_evict(ULONG_MAX);
+	DBG_BUGON(!list_empty(&z_erofs_zcache_lru));
+	DBG_BUGON(!list_empty(&z_erofs_zcache_devs));
+}
@@ -120,6 +120,7 @@ static struct workqueue_struct *z_erofs_workqueue __read_mostly;
 
 void z_erofs_exit_zip_subsystem(void)
 {
+	z_erofs_zcache_exit();
 	destroy_workqueue(z_erofs_workqueue);
 	z_erofs_destroy_pcluster_pool();
 }
@@ -130,7 +131,8 @@ static inline int z_erofs_init_workqueue(void)
 
 	/*
 	 * no need to spawn too many threads, limiting threads could minimum
-	 * scheduling overhead, perhaps per-CPU threads should be better?
+	 * scheduling overhead.  Besides whole decompression queues, it also
+	 * runs individual pclusters handed off by z_erofs_decompress_queue().
 	 */
 	z_erofs_workqueue = alloc_workqueue("erofs_unzipd",
 					    WQ_UNBOUND | WQ_HIGHPRI,
@@ -146,7 +148,16 @@ int __init z_erofs_init_zip_subsystem(void)
 		return err;
 	err = z_erofs_init_workqueue();
 	if (err)
-		z_erofs_destroy_pcluster_pool();
+		goto out_pcluster_pool;
+	err = z_erofs_zcache_init();
+	if (err)
+		goto out_workqueue;
+	return 0;
+
+out_workqueue:
+	destroy_workqueue(z_erofs_workqueue);
+out_pcluster_pool:
+	z_erofs_destroy_pcluster_pool();
 	return err;
 }
 
@@ -815,6 +826,22 @@ static bool z_erofs_page_is_invalidated(struct page *page)
 	return !page->mapping && !z_erofs_is_shortlived_page(page);
 }
 
+static void z_erofs_account_decompress(struct erofs_sb_info *sbi, u64 ns)
+{
+	s64 max = atomic64_read(&sbi->max_decompress_time_ns);
+
+	atomic64_inc(&sbi->decompressed_pclusters);
+	atomic64_add(ns, &sbi->decompress_time_ns);
+	while (ns > max) {
+		s64 old = atomic64_cmpxchg(&sbi->max_decompress_time_ns,
+					   max, ns);
+
+		if (old == max)
+			break;
+		max = old;
+	}
+}
+
 static int z_erofs_decompress_pcluster(struct super_block *sb,
 				       struct z_erofs_pcluster *pcl,
 				       struct page **pagepool)
@@ -828,6 +855,7 @@ static int z_erofs_decompress_pcluster(struct super_block *sb,
 
 	enum z_erofs_page_type page_type;
 	bool overlapped, partial;
+	u64 start;
 	struct z_erofs_collection *cl;
 	int err;
 
@@ -918,7 +946,8 @@ static int z_erofs_decompress_pcluster(struct super_block *sb,
 		DBG_BUGON(z_erofs_page_is_invalidated(page));
 		if (!z_erofs_is_shortlived_page(page)) {
 			if (erofs_page_is_managed(sbi, page)) {
-				if (!PageUptodate(page))
+				/* not read at all if served by shared cache */
+				if (!PageUptodate(page) && !pcl->zcache)
 					err = -EIO;
 				continue;
 			}
@@ -965,6 +994,13 @@ static int z_erofs_decompress_pcluster(struct super_block *sb,
 	else
 		inputsize = pclusterpages * PAGE_SIZE;
 
+	if (pcl->zcache) {
+		err = z_erofs_zcache_fill(pcl->zcache, pages, cl->pageofs,
+					  outputsize);
+		goto out;
+	}
+
+	start = ktime_get_ns();
 	err = z_erofs_decompress(&(struct z_erofs_decompress_req) {
 					.sb = sb,
 					.in = compressed_pages,
@@ -977,8 +1013,17 @@ static int z_erofs_decompress_pcluster(struct super_block *sb,
 					.inplace_io = overlapped,
 					.partial_decoding = partial
 				 }, pagepool);
+	/* account before unlocking any page since umount can race after */
+	z_erofs_account_decompress(sbi, ktime_get_ns() - start);
+	if (!err && !partial)
+		z_erofs_zcache_add(sb, pcl, pages, cl->pageofs, outputsize);
 
 out:
+	if (pcl->zcache) {
+		z_erofs_zcache_put(pcl->zcache);
+		pcl->zcache = NULL;
+	}
+
 	/* must handle all compressed pages before actual file pages */
 	if (z_erofs_is_inline_pcluster(pcl)) {
 		page = compressed_pages[0];
@@ -1032,8 +1077,46 @@ static int z_erofs_decompress_pcluster(struct super_block *sb,
 	return err;
 }
 
+struct z_erofs_pcluster_work {
+	struct work_struct work;
+	struct super_block *sb;
+	struct z_erofs_pcluster *pcl;
+};
+
+static void z_erofs_pcluster_work(struct work_struct *work)
+{
+	struct z_erofs_pcluster_work *pw =
+		container_of(work, struct z_erofs_pcluster_work, work);
+	struct page *pagepool = NULL;
+
+	z_erofs_decompress_pcluster(pw->sb, pw->pcl, &pagepool);
+	erofs_release_pages(&pagepool);
+	kfree(pw);
+}
+
+/*
+ * Pclusters of a queue are independent of each other: in-place I/O only
+ * reuses file pages of the pcluster itself, and pages shared by two
+ * adjacent pclusters are ended by whichever finishes last.  So it's safe
+ * to decompress them concurrently without any ordering.
+ */
+static bool z_erofs_queue_pcluster(struct super_block *sb,
+				   struct z_erofs_pcluster *pcl)
+{
+	struct z_erofs_pcluster_work *pw;
+
+	pw = kmalloc(sizeof(*pw), GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY);
+	if (!pw)
+		return false;
+	INIT_WORK(&pw->work, z_erofs_pcluster_work);
+	pw->sb = sb;
+	pw->pcl = pcl;
+	queue_work(z_erofs_workqueue, &pw->work);
+	return true;
+}
+
 static void z_erofs_decompress_queue(const struct z_erofs_decompressqueue *io,
-				     struct page **pagepool)
+				     struct page **pagepool, bool parallel)
 {
 	z_erofs_next_pcluster_t owned = io->head;
 
@@ -1049,6 +1132,10 @@ static void z_erofs_decompress_queue(const struct z_erofs_decompressqueue *io,
 		pcl = container_of(owned, struct z_erofs_pcluster, next);
 		owned = READ_ONCE(pcl->next);
 
+		/* hand off all but the last pcluster, which is done here */
+		if (parallel && owned != Z_EROFS_PCLUSTER_TAIL_CLOSED &&
+		    z_erofs_queue_pcluster(io->sb, pcl))
+			continue;
 		z_erofs_decompress_pcluster(io->sb, pcl, pagepool);
 	}
 }
@@ -1060,7 +1147,8 @@ static void z_erofs_decompressqueue_work(struct work_struct *work)
 	struct page *pagepool = NULL;
 
 	DBG_BUGON(bgq->head == Z_EROFS_PCLUSTER_TAIL_CLOSED);
-	z_erofs_decompress_queue(bgq, &pagepool);
+	z_erofs_decompress_queue(bgq, &pagepool,
+				 EROFS_SB(bgq->sb)->opt.parallel_decompress);
 
 	erofs_release_pages(&pagepool);
 	kvfree(bgq);
@@ -1353,6 +1441,9 @@ static void z_erofs_submit_queue(struct super_block *sb,
 		cur = erofs_blknr(mdev.m_pa);
 		end = cur + pcl->pclusterpages;
 
+		/* the decompressed pcluster may be cached by another instance */
+		pcl->zcache = z_erofs_zcache_get(sb, pcl);
+
 		do {
 			struct page *page;
 
@@ -1362,6 +1453,13 @@ static void z_erofs_submit_queue(struct super_block *sb,
 			if (!page)
 				continue;
 
+			if (pcl->zcache) {
+				/* no need to read, unlock cached pages instead */
+				if (erofs_page_is_managed(sbi, page))
+					unlock_page(page);
+				continue;
+			}
+
 			if (bio && (cur != last_index + 1 ||
 				    last_bdev != mdev.m_bdev)) {
 submit_bio_retry:
@@ -1421,7 +1519,7 @@ static void z_erofs_runqueue(struct super_block *sb,
 	z_erofs_submit_queue(sb, f, pagepool, io, &force_fg);
 
 	/* handle bypass queue (no i/o pclusters) immediately */
-	z_erofs_decompress_queue(&io[JQ_BYPASS], pagepool);
+	z_erofs_decompress_queue(&io[JQ_BYPASS], pagepool, false);
 
 	if (!force_fg)
 		return;
@@ -1431,7 +1529,7 @@ static void z_erofs_runqueue(struct super_block *sb,
 		      !atomic_read(&io[JQ_SUBMIT].pending_bios));
 
 	/* handle synchronous decompress queue in the caller context */
-	z_erofs_decompress_queue(&io[JQ_SUBMIT], pagepool);
+	z_erofs_decompress_queue(&io[JQ_SUBMIT], pagepool, false);
 }
 
 /*
@@ -52,6 +52,8 @@ struct z_erofs_collection {
  */
 typedef void *z_erofs_next_pcluster_t;
 
+struct z_erofs_zcache_entry;
+
 struct z_erofs_pcluster {
 	struct erofs_workgroup obj;
 	struct z_erofs_collection primary_collection;
@@ -76,6 +78,9 @@ struct z_erofs_pcluster {
 	/* I: compression algorithm format */
 	unsigned char algorithmformat;
 
+	/* L: shared cache entry which serves this pcluster instead of I/O */
+	struct z_erofs_zcache_entry *zcache;
+
 	/* A: compressed pages (can be cached or inplaced pages) */
 	struct page *compressed_pages[];
 };
@@ -114,6 +119,18 @@ static inline unsigned int z_erofs_pclusterpages(struct z_erofs_pcluster *pcl)
 	return pcl->pclusterpages;
 }
 
+/* zcache.c */
+int __init z_erofs_zcache_init(void);
+void z_erofs_zcache_exit(void);
+struct z_erofs_zcache_entry *z_erofs_zcache_get(struct super_block *sb,
+						struct z_erofs_pcluster *pcl);
+void z_erofs_zcache_put(struct z_erofs_zcache_entry *ze);
+int z_erofs_zcache_fill(struct z_erofs_zcache_entry *ze, struct page **out,
+			unsigned int pageofs, unsigned int len);
+void z_erofs_zcache_add(struct super_block *sb, struct z_erofs_pcluster *pcl,
+			struct page **out, unsigned int pageofs,
+			unsigned int len);
+
 #define Z_EROFS_ONLINEPAGE_COUNT_BITS   2
 #define Z_EROFS_ONLINEPAGE_COUNT_MASK   ((1 << Z_EROFS_ONLINEPAGE_COUNT_BITS) - 1)
 #define Z_EROFS_ONLINEPAGE_INDEX_SHIFT  (Z_EROFS_ONLINEPAGE_COUNT_BITS)
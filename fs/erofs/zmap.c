@@ -75,7 +75,9 @@ static int z_erofs_fill_inode_lazy(struct inode *inode)
 
 	headnr = 0;
 	if (vi->z_algorithmtype[0] >= Z_EROFS_COMPRESSION_MAX ||
-	    vi->z_algorithmtype[++headnr] >= Z_EROFS_COMPRESSION_MAX) {
+	    vi->z_algorithmtype[0] == Z_EROFS_COMPRESSION_DEFLATE ||
+	    vi->z_algorithmtype[++headnr] >= Z_EROFS_COMPRESSION_MAX ||
+	    vi->z_algorithmtype[headnr] == Z_EROFS_COMPRESSION_DEFLATE) {
 		erofs_err(sb, "unknown HEAD%u format %u for nid %llu, please upgrade kernel",
 			  headnr + 1, vi->z_algorithmtype[headnr], vi->nid);
 		err = -EOPNOTSUPP;
@@ -682,7 +684,8 @@ static int z_erofs_do_map_blocks(struct inode *inode,
 
 	if ((flags & EROFS_GET_BLOCKS_FIEMAP) ||
 	    ((flags & EROFS_GET_BLOCKS_READMORE) &&
-	     map->m_algorithmformat == Z_EROFS_COMPRESSION_LZMA &&
+	     (map->m_algorithmformat == Z_EROFS_COMPRESSION_LZMA ||
+	      map->m_algorithmformat == Z_EROFS_COMPRESSION_ZSTD) &&
 	     map->m_llen >= EROFS_BLKSIZ)) {
 		err = z_erofs_get_extent_decompressedlen(&m);
 		if (!err)
@@ -21,6 +21,9 @@
 #include <linux/swap.h>
 #include <linux/splice.h>
 #include <linux/sched.h>
+#include <linux/vmalloc.h>
+#include <linux/bvec.h>
+#include <linux/fuse_ring.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 MODULE_ALIAS("devname:fuse");
@@ -1196,7 +1199,7 @@ __releases(fiq->lock)
  * fuse_request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
  */
-static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
+static ssize_t fuse_dev_do_read(struct fuse_dev *fud, bool nonblock,
 				struct fuse_copy_state *cs, size_t nbytes)
 {
 	ssize_t err;
@@ -1233,7 +1236,7 @@ static ssize_t fuse_dev_do_read(struct fuse_dev *fud, struct file *file,
 			break;
 		spin_unlock(&fiq->lock);
 
-		if (file->f_flags & O_NONBLOCK)
+		if (nonblock)
 			return -EAGAIN;
 		err = wait_event_interruptible_exclusive(fiq->waitq,
 				!fiq->connected || request_pending(fiq));
@@ -1359,7 +1362,8 @@ static ssize_t fuse_dev_read(struct kiocb *iocb, struct iov_iter *to)
 
 	fuse_copy_init(&cs, 1, to);
 
-	return fuse_dev_do_read(fud, file, &cs, iov_iter_count(to));
+	return fuse_dev_do_read(fud, file->f_flags & O_NONBLOCK, &cs,
+				iov_iter_count(to));
 }
 
 static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
@@ -1383,7 +1387,7 @@ static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
 	fuse_copy_init(&cs, 1, NULL);
 	cs.pipebufs = bufs;
 	cs.pipe = pipe;
-	ret = fuse_dev_do_read(fud, in, &cs, len);
+	ret = fuse_dev_do_read(fud, in->f_flags & O_NONBLOCK, &cs, len);
 	if (ret < 0)
 		goto out;
 
@@ -2049,6 +2053,299 @@ static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
 	return ret;
 }
 
+/*
+ * Shared-memory request ring, see include/uapi/linux/fuse_ring.h.
+ *
+ * Requests and replies are copied to and from the slot buffers with the
+ * same code as read() and write(), through a bvec iterator over the pages
+ * of the mapping.  The kernel keeps its own copies of the indices it owns
+ * and only trusts the daemon's indices after checking them.
+ */
+struct fuse_ring {
+	/* Serialises FUSE_DEV_IOC_RING_ENTER */
+	struct mutex lock;
+
+	/* vmalloc area shared with the daemon, and its pages */
+	void *base;
+	struct page **pages;
+	unsigned int nr_pages;
+	struct fuse_ring_hdr *hdr;
+	struct fuse_ring_ent *reqs;
+	struct fuse_ring_ent *cmpls;
+
+	/* Pages of the slot buffers */
+	struct bio_vec *bvecs;
+
+	/* Slots currently owned by the daemon */
+	unsigned long *busy;
+
+	unsigned int entries;
+	unsigned int entry_size;
+	unsigned int slot_pages;
+
+	/* Kernel side indices */
+	u32 req_head;
+	u32 cmpl_tail;
+};
+
+static void fuse_ring_free(struct fuse_ring *ring)
+{
+	if (!ring)
+		return;
+	bitmap_free(ring->busy);
+	kvfree(ring->bvecs);
+	kvfree(ring->pages);
+	vfree(ring->base);
+	kfree(ring);
+}
+
+static long fuse_ring_setup(struct fuse_dev *fud,
+			    struct fuse_ring_setup __user *uarg)
+{
+	struct fuse_ring_setup setup;
+	struct fuse_ring *ring;
+	size_t cmpl_off, buf_off, size;
+	unsigned int i, npages;
+	int err;
+
+	if (copy_from_user(&setup, uarg, sizeof(setup)))
+		return -EFAULT;
+
+	if (setup.flags || !setup.entries ||
+	    setup.entries > FUSE_RING_MAX_ENTRIES ||
+	    !is_power_of_2(setup.entries) ||
+	    setup.entry_size < FUSE_MIN_READ_BUFFER ||
+	    setup.entry_size > (FUSE_MAX_MAX_PAGES + 1) * PAGE_SIZE ||
+	    !PAGE_ALIGNED(setup.entry_size) ||
+	    (u64)setup.entries * setup.entry_size > FUSE_RING_MAX_BUF_SIZE)
+		return -EINVAL;
+
+	cmpl_off = sizeof(struct fuse_ring_hdr) +
+		   setup.entries * sizeof(struct fuse_ring_ent);
+	buf_off = PAGE_ALIGN(cmpl_off +
+			     setup.entries * sizeof(struct fuse_ring_ent));
+	size = buf_off + (size_t)setup.entries * setup.entry_size;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL_ACCOUNT);
+	if (!ring)
+		return -ENOMEM;
+
+	mutex_init(&ring->lock);
+	ring->entries = setup.entries;
+	ring->entry_size = setup.entry_size;
+	ring->slot_pages = setup.entry_size >> PAGE_SHIFT;
+
+	/*
+	 * The daemon picks the size, so charge everything to its memcg.  The
+	 * mapping is inserted page by page, so unlike vmalloc_user() memory
+	 * it needs no VM_USERMAP.
+	 */
+	err = -ENOMEM;
+	ring->base = __vmalloc(size, GFP_KERNEL_ACCOUNT | __GFP_ZERO);
+	ring->nr_pages = size >> PAGE_SHIFT;
+	ring->pages = kvmalloc_array(ring->nr_pages, sizeof(*ring->pages),
+				     GFP_KERNEL_ACCOUNT);
+	ring->busy = bitmap_zalloc(ring->entries, GFP_KERNEL_ACCOUNT);
+	npages = ring->entries * ring->slot_pages;
+	ring->bvecs = kvmalloc_array(npages, sizeof(*ring->bvecs),
+				     GFP_KERNEL_ACCOUNT);
+	if (!ring->base || !ring->pages || !ring->busy || !ring->bvecs)
+		goto out_free;
+
+	ring->hdr = ring->base;
+	ring->reqs = ring->base + sizeof(struct fuse_ring_hdr);
+	ring->cmpls = ring->base + cmpl_off;
+	ring->hdr->entries = ring->entries;
+	ring->hdr->entry_size = ring->entry_size;
+
+	for (i = 0; i < ring->nr_pages; i++)
+		ring->pages[i] = vmalloc_to_page(ring->base + i * PAGE_SIZE);
+
+	for (i = 0; i < npages; i++) {
+		ring->bvecs[i].bv_page = ring->pages[buf_off / PAGE_SIZE + i];
+		ring->bvecs[i].bv_offset = 0;
+		ring->bvecs[i].bv_len = PAGE_SIZE;
+	}
+
+	setup.req_offset = sizeof(struct fuse_ring_hdr);
+	setup.cmpl_offset = cmpl_off;
+	setup.buf_offset = buf_off;
+	setup.mmap_size = size;
+	err = -EFAULT;
+	if (copy_to_user(uarg, &setup, sizeof(setup)))
+		goto out_free;
+
+	/* Only one ring per device; pairs with smp_load_acquire() readers */
+	err = -EBUSY;
+	if (cmpxchg_release(&fud->ring, NULL, ring))
+		goto out_free;
+
+	return 0;
+
+out_free:
+	fuse_ring_free(ring);
+	return err;
+}
+
+static void fuse_ring_slot_iter(struct fuse_ring *ring, struct iov_iter *iter,
+				unsigned int dir, unsigned int slot,
+				size_t len)
+{
+	iov_iter_bvec(iter, dir, ring->bvecs + slot * ring->slot_pages,
+		      ring->slot_pages, len);
+}
+
+/* Hand the replies in the completion ring to their requests */
+static int fuse_ring_complete(struct fuse_dev *fud, struct fuse_ring *ring)
+{
+	struct fuse_copy_state cs;
+	struct iov_iter iter;
+	struct fuse_ring_ent ent;
+	u32 mask = ring->entries - 1;
+	u32 tail = ring->cmpl_tail;
+	u32 head = smp_load_acquire(&ring->hdr->cmpl_head);
+	ssize_t ret;
+	int done = 0;
+	int err = 0;
+
+	if (head - tail > ring->entries)
+		return -EINVAL;
+
+	while (tail != head) {
+		ent.slot = READ_ONCE(ring->cmpls[tail & mask].slot);
+		ent.len = READ_ONCE(ring->cmpls[tail & mask].len);
+		tail++;
+
+		if (ent.slot >= ring->entries || ent.len > ring->entry_size ||
+		    !test_and_clear_bit(ent.slot, ring->busy)) {
+			err = -EINVAL;
+			break;
+		}
+		done++;
+		if (!ent.len)
+			continue;
+
+		fuse_ring_slot_iter(ring, &iter, WRITE, ent.slot, ent.len);
+		fuse_copy_init(&cs, 0, &iter);
+		ret = fuse_dev_do_write(fud, &cs, ent.len);
+		/* As with write(), a reply to an aborted request is not fatal */
+		if (ret < 0 && ret != -ENOENT) {
+			err = ret;
+			break;
+		}
+	}
+
+	ring->cmpl_tail = tail;
+	smp_store_release(&ring->hdr->cmpl_tail, tail);
+
+	return err ?: done;
+}
+
+/*
+ * Move pending requests into free slots and publish them.  Never sleeps;
+ * returns -EAGAIN if there was a free slot but no request to put in it.
+ */
+static int fuse_ring_submit(struct fuse_dev *fud, struct fuse_ring *ring)
+{
+	struct fuse_copy_state cs;
+	struct iov_iter iter;
+	u32 mask = ring->entries - 1;
+	u32 head = ring->req_head;
+	u32 tail = smp_load_acquire(&ring->hdr->req_tail);
+	unsigned int slot;
+	ssize_t ret = 0;
+	int done = 0;
+
+	if (head - tail > ring->entries)
+		return -EINVAL;
+
+	while (head - tail < ring->entries) {
+		slot = find_first_zero_bit(ring->busy, ring->entries);
+		if (slot >= ring->entries)
+			break;
+
+		fuse_ring_slot_iter(ring, &iter, READ, slot, ring->entry_size);
+		fuse_copy_init(&cs, 1, &iter);
+		ret = fuse_dev_do_read(fud, true, &cs, ring->entry_size);
+		if (ret < 0)
+			break;
+
+		set_bit(slot, ring->busy);
+		WRITE_ONCE(ring->reqs[head & mask].slot, slot);
+		WRITE_ONCE(ring->reqs[head & mask].len, ret);
+		head++;
+		done++;
+	}
+
+	ring->req_head = head;
+	smp_store_release(&ring->hdr->req_head, head);
+
+	return done ?: ret;
+}
+
+static long fuse_ring_enter(struct fuse_dev *fud,
+			    struct fuse_ring_enter __user *uarg)
+{
+	struct fuse_ring *ring = smp_load_acquire(&fud->ring);
+	struct fuse_iqueue *fiq = &fud->fc->iq;
+	struct fuse_ring_enter enter;
+	int ret;
+
+	if (!ring)
+		return -EINVAL;
+	if (copy_from_user(&enter, uarg, sizeof(enter)))
+		return -EFAULT;
+	if (enter.flags & ~FUSE_RING_ENTER_WAIT)
+		return -EINVAL;
+
+	mutex_lock(&ring->lock);
+	ret = fuse_ring_complete(fud, ring);
+	if (ret >= 0) {
+		enter.completed = ret;
+		ret = fuse_ring_submit(fud, ring);
+	}
+	mutex_unlock(&ring->lock);
+
+	/*
+	 * Sleep without holding ring->lock, so that other threads of the
+	 * daemon can keep handing in replies in the meantime.
+	 */
+	while (ret == -EAGAIN && (enter.flags & FUSE_RING_ENTER_WAIT)) {
+		ret = wait_event_interruptible_exclusive(fiq->waitq,
+				!fiq->connected || request_pending(fiq));
+		if (ret)
+			break;
+
+		mutex_lock(&ring->lock);
+		ret = fuse_ring_submit(fud, ring);
+		mutex_unlock(&ring->lock);
+	}
+	if (ret == -EAGAIN)
+		ret = 0;
+	if (ret < 0)
+		return ret;
+
+	enter.submitted = ret;
+	if (copy_to_user(uarg, &enter, sizeof(enter)))
+		return -EFAULT;
+	return 0;
+}
+
+static int fuse_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_dev *fud = fuse_get_dev(file);
+	struct fuse_ring *ring;
+
+	if (!fud)
+		return -EPERM;
+
+	ring = smp_load_acquire(&fud->ring);
+	if (!ring)
+		return -EINVAL;
+
+	return vm_map_pages(vma, ring->pages, ring->nr_pages);
+}
+
 static __poll_t fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
@@ -2212,6 +2509,8 @@ int fuse_dev_release(struct inode *inode, struct file *file)
 			WARN_ON(fc->iq.fasync != NULL);
 			fuse_abort_conn(fc);
 		}
+		/* No mapping can be left once the file is released */
+		fuse_ring_free(fud->ring);
 		fuse_dev_free(fud);
 	}
 	return 0;
@@ -2278,6 +2577,14 @@ static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
 			}
 		}
 		break;
+	case FUSE_DEV_IOC_RING_SETUP:
+		fud = fuse_get_dev(file);
+		res = fud ? fuse_ring_setup(fud, (void __user *)arg) : -EPERM;
+		break;
+	case FUSE_DEV_IOC_RING_ENTER:
+		fud = fuse_get_dev(file);
+		res = fud ? fuse_ring_enter(fud, (void __user *)arg) : -EPERM;
+		break;
 	default:
 		res = -ENOTTY;
 		break;
@@ -2294,6 +2601,7 @@ const struct file_operations fuse_dev_operations = {
 	.write_iter	= fuse_dev_write,
 	.splice_write	= fuse_dev_splice_write,
 	.poll		= fuse_dev_poll,
+	.mmap		= fuse_dev_mmap,
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
 	.unlocked_ioctl = fuse_dev_ioctl,
@@ -133,9 +133,25 @@ void fuse_invalidate_attr(struct inode *inode)
 	fuse_invalidate_attr_mask(inode, STATX_BASIC_STATS);
 }
 
+/*
+ * Attributes of a directory that adding or removing an entry can change.
+ * Mode and ownership stay valid, so that creating many entries in one
+ * directory doesn't cost a GETATTR for the permission check of each one
+ * while the directory is locked.
+ */
+#define FUSE_DIR_CHANGED_MASK \
+	(STATX_MTIME | STATX_CTIME | STATX_SIZE | STATX_BLOCKS | STATX_NLINK)
+
 static void fuse_dir_changed(struct inode *dir)
 {
-	fuse_invalidate_attr(dir);
+	/*
+	 * Only trust the server not to change anything else behind our back
+	 * if it was mounted with dir_keep_attrs.
+	 */
+	if (get_fuse_conn(dir)->dir_keep_attrs)
+		fuse_invalidate_attr_mask(dir, FUSE_DIR_CHANGED_MASK);
+	else
+		fuse_invalidate_attr(dir);
 	inode_maybe_inc_iversion(dir, false);
 }
 
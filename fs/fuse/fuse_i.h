@@ -478,6 +478,9 @@ struct fuse_dev {
 
 	/** list entry on fc->devices */
 	struct list_head entry;
+
+	/** Shared-memory request ring, if set up by the daemon */
+	struct fuse_ring *ring;
 };
 
 enum fuse_dax_mode {
@@ -509,6 +512,7 @@ struct fuse_fs_context {
 	bool no_control:1;
 	bool no_force_umount:1;
 	bool legacy_opts_show:1;
+	bool dir_keep_attrs:1;
 	enum fuse_dax_mode dax_mode;
 	unsigned int max_read;
 	unsigned int blksize;
@@ -644,6 +648,9 @@ struct fuse_conn {
 	/** allow parallel lookups and readdir (default is serialized) */
 	unsigned parallel_dirops:1;
 
+	/** entry changes leave the directory's mode and ownership valid */
+	unsigned dir_keep_attrs:1;
+
 	/** handle fs handles killing suid/sgid/cap on write/chown/trunc */
 	unsigned handle_killpriv:1;
 
@@ -636,6 +636,7 @@ enum {
 	OPT_ALLOW_OTHER,
 	OPT_MAX_READ,
 	OPT_BLKSIZE,
+	OPT_DIR_KEEP_ATTRS,
 	OPT_ERR
 };
 
@@ -650,6 +651,7 @@ static const struct fs_parameter_spec fuse_fs_parameters[] = {
 	fsparam_u32	("max_read",		OPT_MAX_READ),
 	fsparam_u32	("blksize",		OPT_BLKSIZE),
 	fsparam_string	("subtype",		OPT_SUBTYPE),
+	fsparam_flag	("dir_keep_attrs",	OPT_DIR_KEEP_ATTRS),
 	{}
 };
 
@@ -733,6 +735,10 @@ static int fuse_parse_param(struct fs_context *fsc, struct fs_parameter *param)
 		ctx->blksize = result.uint_32;
 		break;
 
+	case OPT_DIR_KEEP_ATTRS:
+		ctx->dir_keep_attrs = true;
+		break;
+
 	default:
 		return -EINVAL;
 	}
@@ -769,6 +775,8 @@ static int fuse_show_options(struct seq_file *m, struct dentry *root)
 		if (sb->s_bdev && sb->s_blocksize != FUSE_DEFAULT_BLKSIZE)
 			seq_printf(m, ",blksize=%lu", sb->s_blocksize);
 	}
+	if (fc->dir_keep_attrs)
+		seq_puts(m, ",dir_keep_attrs");
 #ifdef CONFIG_FUSE_DAX
 	if (fc->dax_mode == FUSE_DAX_ALWAYS)
 		seq_puts(m, ",dax=always");
@@ -1567,6 +1575,7 @@ int fuse_fill_super_common(struct super_block *sb, struct fuse_fs_context *ctx)
 	fc->destroy = ctx->destroy;
 	fc->no_control = ctx->no_control;
 	fc->no_force_umount = ctx->no_force_umount;
+	fc->dir_keep_attrs = ctx->dir_keep_attrs;
 
 	err = -ENOMEM;
 	root = fuse_get_root_inode(sb, ctx->rootmode);
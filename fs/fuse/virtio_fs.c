@@ -16,6 +16,8 @@
 #include <linux/fs_parser.h>
 #include <linux/highmem.h>
 #include <linux/uio.h>
+#include <linux/interrupt.h>
+#include <linux/cpumask.h>
 #include "fuse_i.h"
 
 /* Used to help calculate the FUSE connection's max_pages limit for a request's
@@ -42,6 +44,7 @@ struct virtio_fs_vq {
 	spinlock_t lock;
 	struct virtqueue *vq;     /* protected by ->lock */
 	struct work_struct done_work;
+	int done_cpu;             /* CPU to run done_work on, or -1 */
 	struct list_head queued_reqs;
 	struct list_head end_reqs;	/* End these requests */
 	struct delayed_work dispatch_work;
@@ -60,6 +63,7 @@ struct virtio_fs {
 	struct virtio_fs_vq *vqs;
 	unsigned int nvqs;               /* number of virtqueues */
 	unsigned int num_request_queues; /* number of request queues */
+	unsigned int *mq_map;            /* cpu -> request queue index */
 	struct dax_device *dax_dev;
 
 	/* DAX memory window where file contents are mapped */
@@ -165,6 +169,7 @@ static void release_virtio_fs_obj(struct kref *ref)
 	struct virtio_fs *vfs = container_of(ref, struct virtio_fs, refcount);
 
 	kfree(vfs->vqs);
+	kfree(vfs->mq_map);
 	kfree(vfs);
 }
 
@@ -648,14 +653,27 @@ static void virtio_fs_requests_done_work(struct work_struct *work)
 	}
 }
 
-/* Virtqueue interrupt handler */
+/*
+ * Virtqueue interrupt handler
+ *
+ * Completions for a request queue run on a CPU that submits to it.  When
+ * the transport shares one interrupt between queues, that keeps the
+ * completion work of different queues from piling up on a single CPU.
+ */
 static void virtio_fs_vq_done(struct virtqueue *vq)
 {
 	struct virtio_fs_vq *fsvq = vq_to_fsvq(vq);
+	struct virtio_fs *fs = vq->vdev->priv;
+	unsigned int cpu = raw_smp_processor_id();
 
 	dev_dbg(&vq->vdev->dev, "%s %s\n", __func__, fsvq->name);
 
-	schedule_work(&fsvq->done_work);
+	if (fsvq->done_cpu < 0 || !fs || !fs->mq_map ||
+	    VQ_REQUEST + fs->mq_map[cpu] == vq->index ||
+	    !cpu_online(fsvq->done_cpu))
+		schedule_work(&fsvq->done_work);
+	else
+		queue_work_on(fsvq->done_cpu, system_wq, &fsvq->done_work);
 }
 
 static void virtio_fs_init_vq(struct virtio_fs_vq *fsvq, char *name,
@@ -666,6 +684,7 @@ static void virtio_fs_init_vq(struct virtio_fs_vq *fsvq, char *name,
 	INIT_LIST_HEAD(&fsvq->queued_reqs);
 	INIT_LIST_HEAD(&fsvq->end_reqs);
 	init_completion(&fsvq->in_flight_zero);
+	fsvq->done_cpu = -1;
 
 	if (vq_type == VQ_REQUEST) {
 		INIT_WORK(&fsvq->done_work, virtio_fs_requests_done_work);
@@ -678,10 +697,46 @@ static void virtio_fs_init_vq(struct virtio_fs_vq *fsvq, char *name,
 	}
 }
 
+/*
+ * Map each CPU to the request queue whose interrupt is affine to it, so
+ * that a request is submitted and completed on the same CPU.  Without
+ * affinity information from the transport, spread the CPUs round-robin.
+ */
+static void virtio_fs_map_queues(struct virtio_device *vdev,
+				 struct virtio_fs *fs)
+{
+	const struct cpumask *mask;
+	unsigned int q, cpu;
+
+	for_each_possible_cpu(cpu)
+		fs->mq_map[cpu] = cpu % fs->num_request_queues;
+
+	if (vdev->config->get_vq_affinity) {
+		for (q = 0; q < fs->num_request_queues; q++) {
+			mask = vdev->config->get_vq_affinity(vdev,
+							     VQ_REQUEST + q);
+			if (!mask)
+				continue;
+			for_each_cpu(cpu, mask)
+				fs->mq_map[cpu] = q;
+		}
+	}
+
+	/* CPUs that are offline now may never come up, don't pick them */
+	for_each_online_cpu(cpu) {
+		struct virtio_fs_vq *fsvq;
+
+		fsvq = &fs->vqs[VQ_REQUEST + fs->mq_map[cpu]];
+		if (fsvq->done_cpu < 0)
+			fsvq->done_cpu = cpu;
+	}
+}
+
 /* Initialize virtqueues */
 static int virtio_fs_setup_vqs(struct virtio_device *vdev,
 			       struct virtio_fs *fs)
 {
+	struct irq_affinity desc = { .pre_vectors = VQ_REQUEST };
 	struct virtqueue **vqs;
 	vq_callback_t **callbacks;
 	const char **names;
@@ -693,6 +748,10 @@ static int virtio_fs_setup_vqs(struct virtio_device *vdev,
 	if (fs->num_request_queues == 0)
 		return -EINVAL;
 
+	/* More request queues than CPUs would never be used */
+	fs->num_request_queues = min_t(unsigned int, fs->num_request_queues,
+				       nr_cpu_ids);
+
 	fs->nvqs = VQ_REQUEST + fs->num_request_queues;
 	fs->vqs = kcalloc(fs->nvqs, sizeof(fs->vqs[VQ_HIPRIO]), GFP_KERNEL);
 	if (!fs->vqs)
@@ -702,7 +761,8 @@ static int virtio_fs_setup_vqs(struct virtio_device *vdev,
 	callbacks = kmalloc_array(fs->nvqs, sizeof(callbacks[VQ_HIPRIO]),
 					GFP_KERNEL);
 	names = kmalloc_array(fs->nvqs, sizeof(names[VQ_HIPRIO]), GFP_KERNEL);
-	if (!vqs || !callbacks || !names) {
+	fs->mq_map = kcalloc(nr_cpu_ids, sizeof(*fs->mq_map), GFP_KERNEL);
+	if (!vqs || !callbacks || !names || !fs->mq_map) {
 		ret = -ENOMEM;
 		goto out;
 	}
@@ -722,20 +782,28 @@ static int virtio_fs_setup_vqs(struct virtio_device *vdev,
 		names[i] = fs->vqs[i].name;
 	}
 
-	ret = virtio_find_vqs(vdev, fs->nvqs, vqs, callbacks, names, NULL);
+	/*
+	 * Spread the request queue interrupts over the CPUs; the hiprio
+	 * queue is only used for FORGET and interrupts and is left alone.
+	 */
+	ret = virtio_find_vqs(vdev, fs->nvqs, vqs, callbacks, names, &desc);
 	if (ret < 0)
 		goto out;
 
 	for (i = 0; i < fs->nvqs; i++)
 		fs->vqs[i].vq = vqs[i];
 
+	virtio_fs_map_queues(vdev, fs);
 	virtio_fs_start_all_queues(fs);
 out:
 	kfree(names);
 	kfree(callbacks);
 	kfree(vqs);
-	if (ret)
+	if (ret) {
 		kfree(fs->vqs);
+		kfree(fs->mq_map);
+		fs->mq_map = NULL;
+	}
 	return ret;
 }
 
@@ -873,8 +941,6 @@ static int virtio_fs_probe(struct virtio_device *vdev)
 	if (ret < 0)
 		goto out;
 
-	/* TODO vq affinity */
-
 	ret = virtio_fs_setup_dax(vdev, fs);
 	if (ret < 0)
 		goto out_vqs;
@@ -894,6 +960,7 @@ static int virtio_fs_probe(struct virtio_device *vdev)
 	virtio_reset_device(vdev);
 	virtio_fs_cleanup_vqs(vdev, fs);
 	kfree(fs->vqs);
+	kfree(fs->mq_map);
 
 out:
 	vdev->priv = NULL;
@@ -1221,7 +1288,7 @@ static int virtio_fs_enqueue_req(struct virtio_fs_vq *fsvq,
 static void virtio_fs_wake_pending_and_unlock(struct fuse_iqueue *fiq)
 __releases(fiq->lock)
 {
-	unsigned int queue_id = VQ_REQUEST; /* TODO multiqueue */
+	unsigned int queue_id;
 	struct virtio_fs *fs;
 	struct fuse_req *req;
 	struct virtio_fs_vq *fsvq;
@@ -1235,6 +1302,7 @@ __releases(fiq->lock)
 	spin_unlock(&fiq->lock);
 
 	fs = fiq->priv;
+	queue_id = VQ_REQUEST + fs->mq_map[raw_smp_processor_id()];
 
 	pr_debug("%s: opcode %u unique %#llx nodeid %#llx in.len %u out.len %u\n",
 		  __func__, req->in.h.opcode, req->in.h.unique,
@@ -1014,6 +1014,15 @@ struct vmbus_channel {
 	 */
 	u64 out_full_first;
 
+	/* Packets written through vmbus_sendpacket_batch(). */
+	u64 out_batch_pkts;
+
+	/*
+	 * Write index updates, and the signal checks that go with them,
+	 * saved by publishing a batch of outbound packets at once.
+	 */
+	u64 out_batch_signals_saved;
+
 	/* enabling/disabling fuzz testing on the channel (default is false)*/
 	bool fuzz_testing_state;
 
@@ -1168,6 +1177,19 @@ extern int vmbus_sendpacket(struct vmbus_channel *channel,
 				  enum vmbus_packet_type type,
 				  u32 flags);
 
+/* One in-band packet of a vmbus_sendpacket_batch() call */
+struct vmbus_batch_packet {
+	void *buffer;
+	u32 bufferlen;
+	u64 requestid;
+	u16 type;
+	u16 flags;
+};
+
+extern int vmbus_sendpacket_batch(struct vmbus_channel *channel,
+				  const struct vmbus_batch_packet *pkts,
+				  u32 count);
+
 extern int vmbus_sendpacket_pagebuffer(struct vmbus_channel *channel,
 					    struct hv_page_buffer pagebuffers[],
 					    u32 pagecount,
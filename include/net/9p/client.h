@@ -11,6 +11,7 @@
 
 #include <linux/utsname.h>
 #include <linux/idr.h>
+#include <linux/sbitmap.h>
 
 /* Number of requests per row */
 #define P9_ROW_MAXTAG 255
@@ -83,16 +84,26 @@ struct p9_req_t {
 	struct list_head req_list;
 };
 
+/*
+ * The request table is split into chunks that are allocated as tags are
+ * first used, so that a client doing little I/O doesn't pay for 64K tags.
+ */
+#define P9_TAG_CHUNK_SHIFT	8
+#define P9_TAG_CHUNK_SIZE	(1 << P9_TAG_CHUNK_SHIFT)
+#define P9_TAG_CHUNKS		((P9_NOTAG + 1) >> P9_TAG_CHUNK_SHIFT)
+
 /**
  * struct p9_client - per client instance state
- * @lock: protect @fids and @reqs
+ * @lock: protect @fids
  * @msize: maximum data size negotiated by protocol
  * @proto_version: 9P protocol version to use
  * @trans_mod: module API instantiated with this client
  * @status: connection state
  * @trans: tranport instance state and API
  * @fids: All active FID handles
- * @reqs: All active requests.
+ * @tags: Tag allocator, with per-CPU allocation hints
+ * @overflow_tags: Tags beyond the depth of @tags
+ * @reqs: All active requests, indexed by tag. Looked up under RCU.
  * @name: node name used as client id
  *
  * The client structure is used to keep track of various per-client
@@ -120,7 +131,9 @@ struct p9_client {
 	} trans_opts;
 
 	struct idr fids;
-	struct idr reqs;
+	struct sbitmap tags;
+	struct ida overflow_tags;
+	struct p9_req_t __rcu **reqs[P9_TAG_CHUNKS];
 
 	char name[__NEW_UTS_LEN + 1];
 };
@@ -157,6 +170,7 @@ struct p9_fid {
 
 	struct hlist_node dlist;	/* list of all fids attached to a dentry */
 	struct hlist_node ilist;
+	struct rcu_head rcu;
 };
 
 /**
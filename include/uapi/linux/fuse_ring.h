@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: ((GPL-2.0 WITH Linux-syscall-note) OR BSD-2-Clause) */
+/*
+ * Shared-memory request ring for FUSE daemons
+ *
+ * Instead of one read() and one write() on /dev/fuse per request, a daemon
+ * can set up a ring on a /dev/fuse file descriptor (typically one clone per
+ * CPU) and exchange requests and replies through memory mapped from it.
+ *
+ * The mapping, FUSE_DEV_IOC_RING_SETUP.mmap_size bytes at offset 0, holds
+ * a struct fuse_ring_hdr, the request ring, the completion ring and
+ * 'entries' slot buffers of 'entry_size' bytes each.
+ *
+ * FUSE_DEV_IOC_RING_ENTER first consumes the completion ring: each entry
+ * names a slot whose buffer holds a reply in the format otherwise passed
+ * to write(), or has len 0 if no reply is due (e.g. FORGET).  Either way
+ * the slot is returned to the kernel.  It then moves as many pending
+ * requests as fit into free slots, each in the format otherwise returned
+ * by read(), and publishes them on the request ring.  With
+ * FUSE_RING_ENTER_WAIT it sleeps until at least one request is available.
+ *
+ * read() and write() keep working alongside the ring, so a daemon may fall
+ * back to them at any time.  The ring needs no INIT negotiation: a kernel
+ * without it fails FUSE_DEV_IOC_RING_SETUP, and the daemon keeps using
+ * read() and write().
+ */
+
+#ifndef _LINUX_FUSE_RING_H
+#define _LINUX_FUSE_RING_H
+
+#include <linux/fuse.h>
+
+/* Maximum number of slots in a ring */
+#define FUSE_RING_MAX_ENTRIES	4096
+
+/* Maximum size of all slot buffers of a ring, entries * entry_size */
+#define FUSE_RING_MAX_BUF_SIZE	(16 << 20)
+
+/**
+ * struct fuse_ring_setup - argument of FUSE_DEV_IOC_RING_SETUP
+ * @entries: in: number of slots, a power of two
+ * @entry_size: in: size of each slot buffer, a multiple of the page size
+ * @flags: in: must be zero
+ * @req_offset: out: offset of the request ring in the mapping
+ * @cmpl_offset: out: offset of the completion ring in the mapping
+ * @buf_offset: out: offset of the first slot buffer in the mapping
+ * @mmap_size: out: size of the mapping
+ */
+struct fuse_ring_setup {
+	uint32_t	entries;
+	uint32_t	entry_size;
+	uint32_t	flags;
+	uint32_t	req_offset;
+	uint32_t	cmpl_offset;
+	uint32_t	buf_offset;
+	uint64_t	mmap_size;
+};
+
+/**
+ * struct fuse_ring_hdr - start of the shared mapping
+ * @req_head: requests published by the kernel
+ * @req_tail: requests consumed by the daemon
+ * @cmpl_head: completions published by the daemon
+ * @cmpl_tail: completions consumed by the kernel
+ * @entries: number of slots
+ * @entry_size: size of each slot buffer
+ *
+ * The indices are free-running; ring positions are index & (entries - 1).
+ */
+struct fuse_ring_hdr {
+	uint32_t	req_head;
+	uint32_t	req_tail;
+	uint32_t	cmpl_head;
+	uint32_t	cmpl_tail;
+	uint32_t	entries;
+	uint32_t	entry_size;
+};
+
+/**
+ * struct fuse_ring_ent - entry of the request and completion rings
+ * @slot: slot buffer holding the request or reply
+ * @len: length of the request or reply, 0 if there is no reply
+ */
+struct fuse_ring_ent {
+	uint32_t	slot;
+	uint32_t	len;
+};
+
+/* Sleep until at least one request has been published */
+#define FUSE_RING_ENTER_WAIT	(1 << 0)
+
+/**
+ * struct fuse_ring_enter - argument of FUSE_DEV_IOC_RING_ENTER
+ * @flags: in: FUSE_RING_ENTER_* flags
+ * @completed: out: number of completions consumed
+ * @submitted: out: number of requests published
+ * @padding: unused
+ */
+struct fuse_ring_enter {
+	uint32_t	flags;
+	uint32_t	completed;
+	uint32_t	submitted;
+	uint32_t	padding;
+};
+
+#define FUSE_DEV_IOC_RING_SETUP		_IOWR(FUSE_DEV_IOC_MAGIC, 1, \
+					      struct fuse_ring_setup)
+#define FUSE_DEV_IOC_RING_ENTER		_IOWR(FUSE_DEV_IOC_MAGIC, 2, \
+					      struct fuse_ring_enter)
+
+#endif /* _LINUX_FUSE_RING_H */
@@ -251,6 +251,81 @@ EXPORT_SYMBOL(p9_fcall_fini);
 
 static struct kmem_cache *p9_req_cache;
 
+/*
+ * Tags below this come from the client's sbitmap, which spreads
+ * concurrent allocations over per-CPU hints instead of a shared lock.
+ * Deeper queues than this are rare and fall back to an IDA.
+ */
+#define P9_TAG_FAST_DEPTH	1024
+
+static int p9_tag_table_init(struct p9_client *c)
+{
+	memset(c->reqs, 0, sizeof(c->reqs));
+	ida_init(&c->overflow_tags);
+	return sbitmap_init_node(&c->tags, P9_TAG_FAST_DEPTH, -1, GFP_KERNEL,
+				 NUMA_NO_NODE, false, true);
+}
+
+static void p9_tag_table_free(struct p9_client *c)
+{
+	int i;
+
+	for (i = 0; i < P9_TAG_CHUNKS; i++)
+		kfree(c->reqs[i]);
+	ida_destroy(&c->overflow_tags);
+	sbitmap_free(&c->tags);
+}
+
+/*
+ * Return the request table slot for a tag. Chunks of the table are
+ * allocated on first use if @alloc is set, and are never freed before
+ * the client is, so the slot may be used locklessly.
+ */
+static struct p9_req_t __rcu **p9_tag_slot(struct p9_client *c, u16 tag,
+					   bool alloc)
+{
+	struct p9_req_t __rcu ***pchunk = &c->reqs[tag >> P9_TAG_CHUNK_SHIFT];
+	struct p9_req_t __rcu **chunk, **old;
+
+	chunk = smp_load_acquire(pchunk);
+	if (!chunk && alloc) {
+		chunk = kcalloc(P9_TAG_CHUNK_SIZE, sizeof(*chunk), GFP_NOFS);
+		if (!chunk)
+			return NULL;
+		old = cmpxchg(pchunk, NULL, chunk);
+		if (old) {
+			kfree(chunk);
+			chunk = old;
+		}
+	}
+	if (!chunk)
+		return NULL;
+
+	return &chunk[tag & (P9_TAG_CHUNK_SIZE - 1)];
+}
+
+static int p9_tag_get(struct p9_client *c)
+{
+	int tag = sbitmap_get(&c->tags);
+
+	if (tag >= 0)
+		return tag;
+
+	return ida_alloc_range(&c->overflow_tags, P9_TAG_FAST_DEPTH,
+			       P9_NOTAG - 1, GFP_NOFS);
+}
+
+static void p9_tag_put(struct p9_client *c, u16 tag)
+{
+	if (tag < P9_TAG_FAST_DEPTH) {
+		/* Order clearing the slot before the tag can be reused. */
+		smp_mb__before_atomic();
+		sbitmap_put(&c->tags, tag);
+	} else if (tag != P9_NOTAG) {
+		ida_free(&c->overflow_tags, tag);
+	}
+}
+
 /**
  * p9_tag_alloc - Allocate a new request.
  * @c: Client session.
@@ -265,6 +340,7 @@ p9_tag_alloc(struct p9_client *c, int8_t type, unsigned int max_size)
 {
 	struct p9_req_t *req = kmem_cache_alloc(p9_req_cache, GFP_NOFS);
 	int alloc_msize = min(c->msize, max_size);
+	struct p9_req_t __rcu **slot;
 	int tag;
 
 	if (!req)
@@ -282,19 +358,21 @@ p9_tag_alloc(struct p9_client *c, int8_t type, unsigned int max_size)
 	init_waitqueue_head(&req->wq);
 	INIT_LIST_HEAD(&req->req_list);
 
-	idr_preload(GFP_NOFS);
-	spin_lock_irq(&c->lock);
+	/* Tversion is only sent while the client is being set up. */
 	if (type == P9_TVERSION)
-		tag = idr_alloc(&c->reqs, req, P9_NOTAG, P9_NOTAG + 1,
-				GFP_NOWAIT);
+		tag = P9_NOTAG;
 	else
-		tag = idr_alloc(&c->reqs, req, 0, P9_NOTAG, GFP_NOWAIT);
-	req->tc.tag = tag;
-	spin_unlock_irq(&c->lock);
-	idr_preload_end();
+		tag = p9_tag_get(c);
 	if (tag < 0)
 		goto free;
 
+	slot = p9_tag_slot(c, tag, true);
+	if (!slot) {
+		p9_tag_put(c, tag);
+		goto free;
+	}
+	req->tc.tag = tag;
+
 	/* Init ref to two because in the general case there is one ref
 	 * that is put asynchronously by a writer thread, one ref
 	 * temporarily given by p9_tag_lookup and put by p9_client_cb
@@ -307,6 +385,9 @@ p9_tag_alloc(struct p9_client *c, int8_t type, unsigned int max_size)
 	 */
 	refcount_set(&req->refcount.refcount, 2);
 
+	/* Publish the request only once its tag and refcount are set. */
+	rcu_assign_pointer(*slot, req);
+
 	return req;
 
 free:
@@ -327,11 +408,13 @@ p9_tag_alloc(struct p9_client *c, int8_t type, unsigned int max_size)
  */
 struct p9_req_t *p9_tag_lookup(struct p9_client *c, u16 tag)
 {
+	struct p9_req_t __rcu **slot;
 	struct p9_req_t *req;
 
 	rcu_read_lock();
+	slot = p9_tag_slot(c, tag, false);
 again:
-	req = idr_find(&c->reqs, tag);
+	req = slot ? rcu_dereference(*slot) : NULL;
 	if (req) {
 		/* We have to be careful with the req found under rcu_read_lock
 		 * Thanks to SLAB_TYPESAFE_BY_RCU we can safely try to get the
@@ -360,13 +443,11 @@ EXPORT_SYMBOL(p9_tag_lookup);
  */
 static int p9_tag_remove(struct p9_client *c, struct p9_req_t *r)
 {
-	unsigned long flags;
 	u16 tag = r->tc.tag;
 
 	p9_debug(P9_DEBUG_MUX, "clnt %p req %p tag: %d\n", c, r, tag);
-	spin_lock_irqsave(&c->lock, flags);
-	idr_remove(&c->reqs, tag);
-	spin_unlock_irqrestore(&c->lock, flags);
+	RCU_INIT_POINTER(*p9_tag_slot(c, tag, false), NULL);
+	p9_tag_put(c, tag);
 	return p9_req_put(r);
 }
 
@@ -394,15 +475,25 @@ EXPORT_SYMBOL(p9_req_put);
  */
 static void p9_tag_cleanup(struct p9_client *c)
 {
+	struct p9_req_t __rcu **chunk;
 	struct p9_req_t *req;
-	int id;
+	int i, id;
 
 	rcu_read_lock();
-	idr_for_each_entry(&c->reqs, req, id) {
-		pr_info("Tag %d still in use\n", id);
-		if (p9_tag_remove(c, req) == 0)
-			pr_warn("Packet with tag %d has still references",
-				req->tc.tag);
+	for (i = 0; i < P9_TAG_CHUNKS; i++) {
+		chunk = c->reqs[i];
+		if (!chunk)
+			continue;
+		for (id = 0; id < P9_TAG_CHUNK_SIZE; id++) {
+			req = rcu_dereference(chunk[id]);
+			if (!req)
+				continue;
+			pr_info("Tag %d still in use\n",
+				(i << P9_TAG_CHUNK_SHIFT) + id);
+			if (p9_tag_remove(c, req) == 0)
+				pr_warn("Packet with tag %d has still references",
+					req->tc.tag);
+		}
 	}
 	rcu_read_unlock();
 }
@@ -925,7 +1016,8 @@ static void p9_fid_destroy(struct p9_fid *fid)
 	idr_remove(&clnt->fids, fid->fid);
 	spin_unlock_irqrestore(&clnt->lock, flags);
 	kfree(fid->rdir);
-	kfree(fid);
+	/* v9fs looks fids up locklessly */
+	kfree_rcu(fid, rcu);
 }
 
 static int p9_client_version(struct p9_client *c)
@@ -1015,11 +1107,13 @@ struct p9_client *p9_client_create(const char *dev_name, char *options)
 
 	spin_lock_init(&clnt->lock);
 	idr_init(&clnt->fids);
-	idr_init(&clnt->reqs);
+	err = p9_tag_table_init(clnt);
+	if (err)
+		goto free_client;
 
 	err = parse_opts(options, clnt);
 	if (err < 0)
-		goto free_client;
+		goto free_tags;
 
 	if (!clnt->trans_mod)
 		clnt->trans_mod = v9fs_get_default_trans();
@@ -1028,7 +1122,7 @@ struct p9_client *p9_client_create(const char *dev_name, char *options)
 		err = -EPROTONOSUPPORT;
 		p9_debug(P9_DEBUG_ERROR,
 			 "No transport defined or default transport\n");
-		goto free_client;
+		goto free_tags;
 	}
 
 	p9_debug(P9_DEBUG_MUX, "clnt %p trans %p msize %d protocol %d\n",
@@ -1072,6 +1166,8 @@ struct p9_client *p9_client_create(const char *dev_name, char *options)
 	clnt->trans_mod->close(clnt);
 put_trans:
 	v9fs_put_trans(clnt->trans_mod);
+free_tags:
+	p9_tag_table_free(clnt);
 free_client:
 	kfree(clnt);
 	return ERR_PTR(err);
@@ -1096,6 +1192,7 @@ void p9_client_destroy(struct p9_client *clnt)
 	}
 
 	p9_tag_cleanup(clnt);
+	p9_tag_table_free(clnt);
 
 	kmem_cache_destroy(clnt->fcall_cache);
 	kfree(clnt);
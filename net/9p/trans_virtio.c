@@ -37,23 +37,51 @@
 #include "trans_common.h"
 
 #define VIRTQUEUE_NUM	128
+#define VQ_NAME_LEN	16
+
+static unsigned int num_request_queues = 1;
+module_param(num_request_queues, uint, 0644);
+MODULE_PARM_DESC(num_request_queues,
+		 "Number of request queues to use per 9p device, fewer if the "
+		 "device doesn't expose that many. "
+		 "Values > nr_cpu_ids truncated to nr_cpu_ids.");
 
 /* a single mutex to manage channel initialization and attachment */
 static DEFINE_MUTEX(virtio_9p_lock);
 static DECLARE_WAIT_QUEUE_HEAD(vp_wq);
 static atomic_t vp_pinned = ATOMIC_INIT(0);
 
+/**
+ * struct virtio_9p_queue - per-virtqueue transport information
+ * @lock: protects the virtqueue and the scatter gather list
+ * @vq: request virtqueue
+ * @ring_bufs_avail: flag to indicate there is some available in the ring buf
+ * @vc_wq: wait queue for waiting for thing to be added to ring buf
+ * @name: virtqueue name
+ * @sg: scatter gather list which is used to pack a request
+ *
+ * Requests are spread over the queues by submitting CPU, so that
+ * concurrent requests don't all serialize on one lock.
+ */
+
+struct virtio_9p_queue {
+	spinlock_t lock;
+	struct virtqueue *vq;
+	int ring_bufs_avail;
+	wait_queue_head_t vc_wq;
+	char name[VQ_NAME_LEN];
+	/* Scatterlist: can be too big for stack. */
+	struct scatterlist sg[VIRTQUEUE_NUM];
+} ____cacheline_aligned_in_smp;
+
 /**
  * struct virtio_chan - per-instance transport information
  * @inuse: whether the channel is in use
- * @lock: protects multiple elements within this structure
  * @client: client instance
  * @vdev: virtio dev associated with this channel
- * @vq: virtio queue associated with this channel
- * @ring_bufs_avail: flag to indicate there is some available in the ring buf
- * @vc_wq: wait queue for waiting for thing to be added to ring buf
+ * @num_vqs: number of request queues
+ * @vqs: request queues
  * @p9_max_pages: maximum number of pinned pages
- * @sg: scatter gather list which is used to pack a request (protected?)
  * @chan_list: linked list of channels
  *
  * We keep all per-channel information in a structure.
@@ -65,19 +93,14 @@ static atomic_t vp_pinned = ATOMIC_INIT(0);
 struct virtio_chan {
 	bool inuse;
 
-	spinlock_t lock;
-
 	struct p9_client *client;
 	struct virtio_device *vdev;
-	struct virtqueue *vq;
-	int ring_bufs_avail;
-	wait_queue_head_t *vc_wq;
+	unsigned int num_vqs;
+	struct virtio_9p_queue *vqs;
 	/* This is global limit. Since we don't have a global structure,
 	 * will be placing it in each channel.
 	 */
 	unsigned long p9_max_pages;
-	/* Scatterlist: can be too big for stack. */
-	struct scatterlist sg[VIRTQUEUE_NUM];
 	/**
 	 * @tag: name to identify a mount null terminated
 	 */
@@ -88,6 +111,12 @@ struct virtio_chan {
 
 static struct list_head virtio_chan_list;
 
+/* Pick the request queue for the submitting CPU. */
+static struct virtio_9p_queue *p9_virtio_queue(struct virtio_chan *chan)
+{
+	return &chan->vqs[raw_smp_processor_id() % chan->num_vqs];
+}
+
 /* How many bytes left in this page. */
 static unsigned int rest_of_page(void *data)
 {
@@ -129,6 +158,7 @@ static void p9_virtio_close(struct p9_client *client)
 static void req_done(struct virtqueue *vq)
 {
 	struct virtio_chan *chan = vq->vdev->priv;
+	struct virtio_9p_queue *q = &chan->vqs[vq->index];
 	unsigned int len;
 	struct p9_req_t *req;
 	bool need_wakeup = false;
@@ -136,10 +166,10 @@ static void req_done(struct virtqueue *vq)
 
 	p9_debug(P9_DEBUG_TRANS, ": request done\n");
 
-	spin_lock_irqsave(&chan->lock, flags);
-	while ((req = virtqueue_get_buf(chan->vq, &len)) != NULL) {
-		if (!chan->ring_bufs_avail) {
-			chan->ring_bufs_avail = 1;
+	spin_lock_irqsave(&q->lock, flags);
+	while ((req = virtqueue_get_buf(q->vq, &len)) != NULL) {
+		if (!q->ring_bufs_avail) {
+			q->ring_bufs_avail = 1;
 			need_wakeup = true;
 		}
 
@@ -148,10 +178,10 @@ static void req_done(struct virtqueue *vq)
 			p9_client_cb(chan->client, req, REQ_STATUS_RCVD);
 		}
 	}
-	spin_unlock_irqrestore(&chan->lock, flags);
+	spin_unlock_irqrestore(&q->lock, flags);
 	/* Wakeup if anyone waiting for VirtIO ring space. */
 	if (need_wakeup)
-		wake_up(chan->vc_wq);
+		wake_up(&q->vc_wq);
 }
 
 /**
@@ -259,48 +289,54 @@ p9_virtio_request(struct p9_client *client, struct p9_req_t *req)
 	int in, out, out_sgs, in_sgs;
 	unsigned long flags;
 	struct virtio_chan *chan = client->trans;
+	struct virtio_9p_queue *q = p9_virtio_queue(chan);
 	struct scatterlist *sgs[2];
+	bool notify;
 
 	p9_debug(P9_DEBUG_TRANS, "9p debug: virtio request\n");
 
 	req->status = REQ_STATUS_SENT;
 req_retry:
-	spin_lock_irqsave(&chan->lock, flags);
+	spin_lock_irqsave(&q->lock, flags);
 
 	out_sgs = in_sgs = 0;
 	/* Handle out VirtIO ring buffers */
-	out = pack_sg_list(chan->sg, 0,
+	out = pack_sg_list(q->sg, 0,
 			   VIRTQUEUE_NUM, req->tc.sdata, req->tc.size);
 	if (out)
-		sgs[out_sgs++] = chan->sg;
+		sgs[out_sgs++] = q->sg;
 
-	in = pack_sg_list(chan->sg, out,
+	in = pack_sg_list(q->sg, out,
 			  VIRTQUEUE_NUM, req->rc.sdata, req->rc.capacity);
 	if (in)
-		sgs[out_sgs + in_sgs++] = chan->sg + out;
+		sgs[out_sgs + in_sgs++] = q->sg + out;
 
-	err = virtqueue_add_sgs(chan->vq, sgs, out_sgs, in_sgs, req,
+	err = virtqueue_add_sgs(q->vq, sgs, out_sgs, in_sgs, req,
 				GFP_ATOMIC);
 	if (err < 0) {
 		if (err == -ENOSPC) {
-			chan->ring_bufs_avail = 0;
-			spin_unlock_irqrestore(&chan->lock, flags);
-			err = wait_event_killable(*chan->vc_wq,
-						  chan->ring_bufs_avail);
+			q->ring_bufs_avail = 0;
+			spin_unlock_irqrestore(&q->lock, flags);
+			err = wait_event_killable(q->vc_wq,
+						  q->ring_bufs_avail);
 			if (err  == -ERESTARTSYS)
 				return err;
 
 			p9_debug(P9_DEBUG_TRANS, "Retry virtio request\n");
 			goto req_retry;
 		} else {
-			spin_unlock_irqrestore(&chan->lock, flags);
+			spin_unlock_irqrestore(&q->lock, flags);
 			p9_debug(P9_DEBUG_TRANS,
 				 "virtio rpc add_sgs returned failure\n");
 			return -EIO;
 		}
 	}
-	virtqueue_kick(chan->vq);
-	spin_unlock_irqrestore(&chan->lock, flags);
+	notify = virtqueue_kick_prepare(q->vq);
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	/* Notify the device without holding the queue lock. */
+	if (notify)
+		virtqueue_notify(q->vq);
 
 	p9_debug(P9_DEBUG_TRANS, "virtio request kicked\n");
 	return 0;
@@ -398,10 +434,12 @@ p9_virtio_zc_request(struct p9_client *client, struct p9_req_t *req,
 	int in_nr_pages = 0, out_nr_pages = 0;
 	struct page **in_pages = NULL, **out_pages = NULL;
 	struct virtio_chan *chan = client->trans;
+	struct virtio_9p_queue *q;
 	struct scatterlist *sgs[4];
 	size_t offs;
 	int need_drop = 0;
 	int kicked = 0;
+	bool notify;
 
 	p9_debug(P9_DEBUG_TRANS, "virtio request\n");
 
@@ -440,21 +478,22 @@ p9_virtio_zc_request(struct p9_client *client, struct p9_req_t *req,
 		}
 	}
 	req->status = REQ_STATUS_SENT;
+	q = p9_virtio_queue(chan);
 req_retry_pinned:
-	spin_lock_irqsave(&chan->lock, flags);
+	spin_lock_irqsave(&q->lock, flags);
 
 	out_sgs = in_sgs = 0;
 
 	/* out data */
-	out = pack_sg_list(chan->sg, 0,
+	out = pack_sg_list(q->sg, 0,
 			   VIRTQUEUE_NUM, req->tc.sdata, req->tc.size);
 
 	if (out)
-		sgs[out_sgs++] = chan->sg;
+		sgs[out_sgs++] = q->sg;
 
 	if (out_pages) {
-		sgs[out_sgs++] = chan->sg + out;
-		out += pack_sg_list_p(chan->sg, out, VIRTQUEUE_NUM,
+		sgs[out_sgs++] = q->sg + out;
+		out += pack_sg_list_p(q->sg, out, VIRTQUEUE_NUM,
 				      out_pages, out_nr_pages, offs, outlen);
 	}
 
@@ -465,41 +504,43 @@ p9_virtio_zc_request(struct p9_client *client, struct p9_req_t *req,
 	 * Arrange in such a way that server places header in the
 	 * allocated memory and payload onto the user buffer.
 	 */
-	in = pack_sg_list(chan->sg, out,
+	in = pack_sg_list(q->sg, out,
 			  VIRTQUEUE_NUM, req->rc.sdata, in_hdr_len);
 	if (in)
-		sgs[out_sgs + in_sgs++] = chan->sg + out;
+		sgs[out_sgs + in_sgs++] = q->sg + out;
 
 	if (in_pages) {
-		sgs[out_sgs + in_sgs++] = chan->sg + out + in;
-		in += pack_sg_list_p(chan->sg, out + in, VIRTQUEUE_NUM,
+		sgs[out_sgs + in_sgs++] = q->sg + out + in;
+		in += pack_sg_list_p(q->sg, out + in, VIRTQUEUE_NUM,
 				     in_pages, in_nr_pages, offs, inlen);
 	}
 
 	BUG_ON(out_sgs + in_sgs > ARRAY_SIZE(sgs));
-	err = virtqueue_add_sgs(chan->vq, sgs, out_sgs, in_sgs, req,
+	err = virtqueue_add_sgs(q->vq, sgs, out_sgs, in_sgs, req,
 				GFP_ATOMIC);
 	if (err < 0) {
 		if (err == -ENOSPC) {
-			chan->ring_bufs_avail = 0;
-			spin_unlock_irqrestore(&chan->lock, flags);
-			err = wait_event_killable(*chan->vc_wq,
-						  chan->ring_bufs_avail);
+			q->ring_bufs_avail = 0;
+			spin_unlock_irqrestore(&q->lock, flags);
+			err = wait_event_killable(q->vc_wq,
+						  q->ring_bufs_avail);
 			if (err  == -ERESTARTSYS)
 				goto err_out;
 
 			p9_debug(P9_DEBUG_TRANS, "Retry virtio request\n");
 			goto req_retry_pinned;
 		} else {
-			spin_unlock_irqrestore(&chan->lock, flags);
+			spin_unlock_irqrestore(&q->lock, flags);
 			p9_debug(P9_DEBUG_TRANS,
 				 "virtio rpc add_sgs returned failure\n");
 			err = -EIO;
 			goto err_out;
 		}
 	}
-	virtqueue_kick(chan->vq);
-	spin_unlock_irqrestore(&chan->lock, flags);
+	notify = virtqueue_kick_prepare(q->vq);
+	spin_unlock_irqrestore(&q->lock, flags);
+	if (notify)
+		virtqueue_notify(q->vq);
 	kicked = 1;
 	p9_debug(P9_DEBUG_TRANS, "virtio request kicked\n");
 	err = wait_event_killable(req->wq, req->status >= REQ_STATUS_RCVD);
@@ -546,6 +587,82 @@ static ssize_t p9_mount_tag_show(struct device *dev,
 
 static DEVICE_ATTR(mount_tag, 0444, p9_mount_tag_show, NULL);
 
+/**
+ * p9_virtio_init_vqs - find the request virtqueues of a channel
+ * @chan: channel being probed
+ *
+ * The virtio spec doesn't define a way for 9p devices to report how many
+ * request queues they have, so ask for num_request_queues and halve the
+ * number until the device exposes that many. The first queue is always
+ * there.
+ */
+
+static int p9_virtio_init_vqs(struct virtio_chan *chan)
+{
+	struct virtio_device *vdev = chan->vdev;
+	vq_callback_t **callbacks;
+	struct virtqueue **vqs;
+	const char **names;
+	unsigned int num_vqs;
+	int err, i;
+
+	num_vqs = clamp_t(unsigned int, READ_ONCE(num_request_queues), 1,
+			  nr_cpu_ids);
+
+	chan->vqs = kcalloc(num_vqs, sizeof(*chan->vqs), GFP_KERNEL);
+	if (!chan->vqs)
+		return -ENOMEM;
+
+	names = kmalloc_array(num_vqs, sizeof(*names), GFP_KERNEL);
+	callbacks = kmalloc_array(num_vqs, sizeof(*callbacks), GFP_KERNEL);
+	vqs = kmalloc_array(num_vqs, sizeof(*vqs), GFP_KERNEL);
+	if (!names || !callbacks || !vqs) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	/* The first queue keeps its historical name. */
+	for (i = 0; i < num_vqs; i++) {
+		callbacks[i] = req_done;
+		if (i)
+			snprintf(chan->vqs[i].name, VQ_NAME_LEN,
+				 "requests.%d", i);
+		else
+			strscpy(chan->vqs[i].name, "requests", VQ_NAME_LEN);
+		names[i] = chan->vqs[i].name;
+	}
+
+	for (;;) {
+		err = virtio_find_vqs(vdev, num_vqs, vqs, callbacks, names,
+				      NULL);
+		if (!err || num_vqs == 1)
+			break;
+		num_vqs /= 2;
+	}
+	if (err)
+		goto out;
+
+	for (i = 0; i < num_vqs; i++) {
+		struct virtio_9p_queue *q = &chan->vqs[i];
+
+		spin_lock_init(&q->lock);
+		init_waitqueue_head(&q->vc_wq);
+		sg_init_table(q->sg, VIRTQUEUE_NUM);
+		q->ring_bufs_avail = 1;
+		q->vq = vqs[i];
+	}
+	chan->num_vqs = num_vqs;
+	vdev->priv = chan;
+
+out:
+	kfree(vqs);
+	kfree(callbacks);
+	kfree(names);
+	if (err)
+		kfree(chan->vqs);
+	return err;
+}
+
 /**
  * p9_virtio_probe - probe for existence of 9P virtio channels
  * @vdev: virtio device to probe
@@ -576,44 +693,31 @@ static int p9_virtio_probe(struct virtio_device *vdev)
 
 	chan->vdev = vdev;
 
-	/* We expect one virtqueue, for requests. */
-	chan->vq = virtio_find_single_vq(vdev, req_done, "requests");
-	if (IS_ERR(chan->vq)) {
-		err = PTR_ERR(chan->vq);
-		goto out_free_chan;
-	}
-	chan->vq->vdev->priv = chan;
-	spin_lock_init(&chan->lock);
-
-	sg_init_table(chan->sg, VIRTQUEUE_NUM);
-
 	chan->inuse = false;
 	if (virtio_has_feature(vdev, VIRTIO_9P_MOUNT_TAG)) {
 		virtio_cread(vdev, struct virtio_9p_config, tag_len, &tag_len);
 	} else {
 		err = -EINVAL;
-		goto out_free_vq;
+		goto out_free_chan;
 	}
 	tag = kzalloc(tag_len + 1, GFP_KERNEL);
 	if (!tag) {
 		err = -ENOMEM;
-		goto out_free_vq;
+		goto out_free_chan;
 	}
 
 	virtio_cread_bytes(vdev, offsetof(struct virtio_9p_config, tag),
 			   tag, tag_len);
 	chan->tag = tag;
+
+	err = p9_virtio_init_vqs(chan);
+	if (err)
+		goto out_free_tag;
+
 	err = sysfs_create_file(&(vdev->dev.kobj), &dev_attr_mount_tag.attr);
 	if (err) {
-		goto out_free_tag;
+		goto out_free_vqs;
 	}
-	chan->vc_wq = kmalloc(sizeof(wait_queue_head_t), GFP_KERNEL);
-	if (!chan->vc_wq) {
-		err = -ENOMEM;
-		goto out_remove_file;
-	}
-	init_waitqueue_head(chan->vc_wq);
-	chan->ring_bufs_avail = 1;
 	/* Ceiling limit to avoid denial of service attacks */
 	chan->p9_max_pages = nr_free_buffer_pages()/4;
 
@@ -628,12 +732,11 @@ static int p9_virtio_probe(struct virtio_device *vdev)
 
 	return 0;
 
-out_remove_file:
-	sysfs_remove_file(&vdev->dev.kobj, &dev_attr_mount_tag.attr);
+out_free_vqs:
+	vdev->config->del_vqs(vdev);
+	kfree(chan->vqs);
 out_free_tag:
 	kfree(tag);
-out_free_vq:
-	vdev->config->del_vqs(vdev);
 out_free_chan:
 	kfree(chan);
 fail:
@@ -727,7 +830,7 @@ static void p9_virtio_remove(struct virtio_device *vdev)
 	sysfs_remove_file(&(vdev->dev.kobj), &dev_attr_mount_tag.attr);
 	kobject_uevent(&(vdev->dev.kobj), KOBJ_CHANGE);
 	kfree(chan->tag);
-	kfree(chan->vc_wq);
+	kfree(chan->vqs);
 	kfree(chan);
 
 }
@@ -51,9 +51,9 @@ struct hvs_recv_buf {
  * guest and the host processing as one VMBUS packet is the smallest processing
  * unit.
  *
- * Note: the buffer can be eliminated in the future when we add new VMBus
- * ringbuffer APIs that allow us to directly copy data from userspace buffer
- * to VMBus ringbuffer.
+ * Up to HVS_SEND_BATCH such buffers are filled before they are handed to
+ * vmbus_sendpacket_batch(), so that a large send signals the host once per
+ * batch rather than once per packet.
  */
 #define HVS_SEND_BUF_SIZE \
 		(HV_HYP_PAGE_SIZE - sizeof(struct vmpipe_proto_header))
@@ -66,6 +66,8 @@ struct hvs_send_buf {
 	u8 data[HVS_SEND_BUF_SIZE];
 };
 
+#define HVS_SEND_BATCH	8
+
 #define HVS_HEADER_LEN	(sizeof(struct vmpacket_descriptor) + \
 			 sizeof(struct vmpipe_proto_header))
 
@@ -208,9 +210,8 @@ static int hvs_channel_readable_payload(struct vmbus_channel *chan)
 	return -1;
 }
 
-static size_t hvs_channel_writable_bytes(struct vmbus_channel *chan)
+static size_t __hvs_writable_bytes(u32 writeable)
 {
-	u32 writeable = hv_get_bytes_to_write(&chan->outbound);
 	size_t ret;
 
 	/* The ringbuffer mustn't be 100% full, and we should reserve a
@@ -225,6 +226,11 @@ static size_t hvs_channel_writable_bytes(struct vmbus_channel *chan)
 	return round_down(ret, 8);
 }
 
+static size_t hvs_channel_writable_bytes(struct vmbus_channel *chan)
+{
+	return __hvs_writable_bytes(hv_get_bytes_to_write(&chan->outbound));
+}
+
 static int __hvs_send_data(struct vmbus_channel *chan,
 			   struct vmpipe_proto_header *hdr,
 			   size_t to_write)
@@ -235,12 +241,6 @@ static int __hvs_send_data(struct vmbus_channel *chan,
 				0, VM_PKT_DATA_INBAND, 0);
 }
 
-static int hvs_send_data(struct vmbus_channel *chan,
-			 struct hvs_send_buf *send_buf, size_t to_write)
-{
-	return __hvs_send_data(chan, &send_buf->hdr, to_write);
-}
-
 static void hvs_channel_cb(void *ctx)
 {
 	struct sock *sk = (struct sock *)ctx;
@@ -634,14 +634,17 @@ static ssize_t hvs_stream_enqueue(struct vsock_sock *vsk, struct msghdr *msg,
 {
 	struct hvsock *hvs = vsk->trans;
 	struct vmbus_channel *chan = hvs->chan;
+	struct vmbus_batch_packet pkts[HVS_SEND_BATCH];
 	struct hvs_send_buf *send_buf;
 	ssize_t to_write, max_writable;
 	ssize_t ret = 0;
 	ssize_t bytes_written = 0;
+	u32 writeable;
+	int i, n, sent;
 
 	BUILD_BUG_ON(sizeof(*send_buf) != HV_HYP_PAGE_SIZE);
 
-	send_buf = kmalloc(sizeof(*send_buf), GFP_KERNEL);
+	send_buf = kmalloc_array(HVS_SEND_BATCH, sizeof(*send_buf), GFP_KERNEL);
 	if (!send_buf)
 		return -ENOMEM;
 
@@ -650,26 +653,50 @@ static ssize_t hvs_stream_enqueue(struct vsock_sock *vsk, struct msghdr *msg,
 	 * full.
 	 */
 	while (len) {
-		max_writable = hvs_channel_writable_bytes(chan);
-		if (!max_writable)
-			break;
-		to_write = min_t(ssize_t, len, max_writable);
-		to_write = min_t(ssize_t, to_write, HVS_SEND_BUF_SIZE);
-		/* memcpy_from_msg is safe for loop as it advances the offsets
-		 * within the message iterator.
+		/* We are the only writer of the channel, and hold the socket
+		 * lock: the space found here can only grow before the batch
+		 * is sent, so every packet accounted for below will fit.
 		 */
-		ret = memcpy_from_msg(send_buf->data, msg, to_write);
-		if (ret < 0)
-			goto out;
-
-		ret = hvs_send_data(hvs->chan, send_buf, to_write);
-		if (ret < 0)
-			goto out;
+		writeable = hv_get_bytes_to_write(&chan->outbound);
+
+		for (n = 0; n < HVS_SEND_BATCH && len; n++) {
+			max_writable = __hvs_writable_bytes(writeable);
+			if (!max_writable)
+				break;
+			to_write = min_t(ssize_t, len, max_writable);
+			to_write = min_t(ssize_t, to_write, HVS_SEND_BUF_SIZE);
+			/* memcpy_from_msg is safe for loop as it advances the
+			 * offsets within the message iterator.
+			 */
+			ret = memcpy_from_msg(send_buf[n].data, msg, to_write);
+			if (ret < 0)
+				break;
+
+			send_buf[n].hdr.pkt_type = 1;
+			send_buf[n].hdr.data_size = to_write;
+			pkts[n].buffer = &send_buf[n];
+			pkts[n].bufferlen = sizeof(send_buf[n].hdr) + to_write;
+			pkts[n].requestid = 0;
+			pkts[n].type = VM_PKT_DATA_INBAND;
+			pkts[n].flags = 0;
+
+			writeable -= HVS_PKT_LEN(to_write);
+			len -= to_write;
+		}
+		if (!n)
+			break;
 
-		bytes_written += to_write;
-		len -= to_write;
+		sent = vmbus_sendpacket_batch(chan, pkts, n);
+		if (sent < 0) {
+			ret = sent;
+			break;
+		}
+		for (i = 0; i < sent; i++)
+			bytes_written += send_buf[i].hdr.data_size;
+		if (sent < n || ret < 0)
+			break;
 	}
-out:
+
 	/* If any data has been sent, return that */
 	if (bytes_written)
 		ret = bytes_written;